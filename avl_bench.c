@@ -0,0 +1,1464 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+/*
+ * head-to-head benchmark
+ *
+ * runs identical workloads on the AVL tree and on a red-black tree, a skip list,
+ * a B-tree and a sorted array, all implemented below. every container stores
+ * mydata pointers and orders them with compare_func, so the indirection cost is the same.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include "avl_bf.h"
+#include "avl_data.h"
+
+#define SAMPLE_EVERY 8 /* time one operation out of SAMPLE_EVERY for the latency columns */
+#define BATCH 16 /* keys per lookup in the batch phase */
+
+typedef struct {
+	const char *name;
+	void *(*create)(void);
+	int (*insert)(void *c, mydata *data); /* return 0 if out of memory */
+	mydata *(*find)(void *c, mydata *query);
+	void (*find_batch)(void *c, mydata **queries, int n, mydata **out); /* NULL if find is used */
+	int (*delete)(void *c, mydata *query); /* delete and destroy data, return 0 if not found */
+	void (*destroy)(void *c);
+	size_t (*memory)(void *c); /* bytes used by the container itself, excluding data */
+	int (*height)(void *c); /* levels walked by the deepest search */
+	long limit; /* skipped above this many entries (0 if unlimited) */
+} container;
+
+enum phase {
+	BUILD,
+	LOOKUP,
+	BATCH_LOOKUP,
+	MISS,
+	CHURN,
+	DELETE,
+	TEARDOWN,
+	NPHASES
+};
+
+static const char *phase_names[NPHASES] = {"build", "lookup", "batch", "miss", "churn", "delete", "teardown"};
+
+/*
+ * hardware counters sampled per phase with perf_event_open
+ * a counter the kernel or the CPU does not provide reads as -1
+ */
+enum hwcounter {
+	INSTRUCTIONS,
+	CACHE_MISSES,
+	LLC_MISSES,
+	BRANCH_MISSES,
+	DTLB_MISSES,
+	NCOUNTERS
+};
+
+static const char *counter_names[NCOUNTERS] = {"instr", "cache-miss", "LLC-miss", "br-miss", "dTLB-miss"};
+
+static int counter_fds[NCOUNTERS];
+
+typedef struct {
+	double seconds;
+	long ops;
+	long *samples; /* nanoseconds */
+	long nsamples;
+	long long counters[NCOUNTERS];
+} phase_result;
+
+typedef struct {
+	avltree *avlt;
+	long count;
+} avl_bench;
+
+typedef struct rbnode {
+	struct rbnode *left;
+	struct rbnode *right;
+	struct rbnode *parent;
+	int red;
+	void *data;
+} rbnode;
+
+typedef struct {
+	rbnode *root;
+	rbnode nil;
+	long count;
+} rbtree;
+
+#define SL_MAXLEVEL 32
+
+typedef struct slnode {
+	void *data;
+	int level;
+	struct slnode *next[1];
+} slnode;
+
+typedef struct {
+	slnode *head;
+	int level;
+	long count;
+	size_t bytes;
+} skiplist;
+
+#define BT_T 8
+#define BT_MAX (2 * BT_T - 1)
+
+typedef struct btnode {
+	int n;
+	int leaf;
+	void *keys[BT_MAX];
+	struct btnode *child[BT_MAX + 1];
+} btnode;
+
+typedef struct {
+	btnode *root;
+	long count;
+	long nodes;
+} btree;
+
+typedef struct {
+	void **a;
+	long n;
+	long cap;
+} sortedarray;
+
+static unsigned long long rng(void);
+static void shuffle(int *a, long n);
+static long now_ns(void);
+#ifdef __linux__
+static int counter_open(unsigned int type, unsigned long long config);
+#endif
+static int counters_open(void);
+static void counters_start(void);
+static void counters_stop(long long *values);
+static void counters_close(void);
+static int compare_long(const void *a, const void *b);
+
+static void *avl_bench_create(void);
+static void *wavl_bench_create(void);
+static int avl_bench_insert(void *c, mydata *data);
+static mydata *avl_bench_find(void *c, mydata *query);
+static void avl_bench_find_batch(void *c, mydata **queries, int n, mydata **out);
+static int avl_bench_delete(void *c, mydata *query);
+static void avl_bench_destroy(void *c);
+static size_t avl_bench_memory(void *c);
+static int avl_bench_height_r(avltree *avlt, avlnode *n);
+static int avl_bench_height(void *c);
+
+static void *rb_create(void);
+static void rb_rotate_left(rbtree *t, rbnode *x);
+static void rb_rotate_right(rbtree *t, rbnode *x);
+static int rb_insert(void *c, mydata *data);
+static rbnode *rb_search(rbtree *t, mydata *query);
+static mydata *rb_find(void *c, mydata *query);
+static void rb_transplant(rbtree *t, rbnode *u, rbnode *v);
+static int rb_delete(void *c, mydata *query);
+static void rb_destroy_r(rbtree *t, rbnode *x);
+static void rb_destroy(void *c);
+static size_t rb_memory(void *c);
+static int rb_height_r(rbtree *t, rbnode *x);
+static int rb_height(void *c);
+
+static void *sl_create(void);
+static slnode *sl_search(skiplist *s, mydata *query, slnode **update);
+static int sl_insert(void *c, mydata *data);
+static mydata *sl_find(void *c, mydata *query);
+static int sl_delete(void *c, mydata *query);
+static void sl_destroy(void *c);
+static size_t sl_memory(void *c);
+static int sl_height(void *c);
+
+static btnode *bt_node(btree *t, int leaf);
+static void *bt_create(void);
+static int bt_lower(btnode *x, mydata *query);
+static int bt_split(btree *t, btnode *x, int i);
+static int bt_insert(void *c, mydata *data);
+static mydata *bt_find(void *c, mydata *query);
+static void bt_merge(btree *t, btnode *x, int i);
+static int bt_fill(btree *t, btnode *x, int i);
+static int bt_delete(void *c, mydata *query);
+static void bt_destroy_r(btnode *x);
+static void bt_destroy(void *c);
+static size_t bt_memory(void *c);
+static int bt_height(void *c);
+
+static void *sa_create(void);
+static long sa_lower(sortedarray *s, mydata *query);
+static int sa_insert(void *c, mydata *data);
+static mydata *sa_find(void *c, mydata *query);
+static int sa_delete(void *c, mydata *query);
+static void sa_destroy(void *c);
+static size_t sa_memory(void *c);
+static int sa_height(void *c);
+
+static void phase_begin(phase_result *r, long ops);
+static void phase_end(phase_result *r);
+static long percentile(phase_result *r, double p);
+static int run(container *c, int *keys, int *probe, long n, phase_result *res, size_t *memory, int *height);
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+unsigned long long rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+void shuffle(int *a, long n)
+{
+	long i, j;
+	int t;
+
+	for (i = n - 1; i > 0; i--) {
+		j = (long) (rng() % (unsigned long long) (i + 1));
+		t = a[i];
+		a[i] = a[j];
+		a[j] = t;
+	}
+}
+
+long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long) ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+#ifdef __linux__
+int counter_open(unsigned int type, unsigned long long config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/*
+ * return the number of counters available
+ */
+int counters_open(void)
+{
+	int i, n = 0;
+
+	for (i = 0; i < NCOUNTERS; i++)
+		counter_fds[i] = -1;
+
+	#ifdef __linux__
+	counter_fds[INSTRUCTIONS] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	counter_fds[CACHE_MISSES] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	counter_fds[LLC_MISSES] = counter_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	counter_fds[BRANCH_MISSES] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	counter_fds[DTLB_MISSES] = counter_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	#endif
+
+	for (i = 0; i < NCOUNTERS; i++)
+		if (counter_fds[i] >= 0)
+			n++;
+	return n;
+}
+
+void counters_start(void)
+{
+	#ifdef __linux__
+	int i;
+
+	for (i = 0; i < NCOUNTERS; i++) {
+		if (counter_fds[i] >= 0) {
+			ioctl(counter_fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+	#endif
+}
+
+void counters_stop(long long *values)
+{
+	int i;
+
+	for (i = 0; i < NCOUNTERS; i++) {
+		values[i] = -1;
+		#ifdef __linux__
+		if (counter_fds[i] >= 0) {
+			long long v;
+			ioctl(counter_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+			if (read(counter_fds[i], &v, sizeof(v)) == sizeof(v))
+				values[i] = v;
+		}
+		#endif
+	}
+}
+
+void counters_close(void)
+{
+	#ifdef __linux__
+	int i;
+
+	for (i = 0; i < NCOUNTERS; i++)
+		if (counter_fds[i] >= 0)
+			close(counter_fds[i]);
+	#endif
+}
+
+int compare_long(const void *a, const void *b)
+{
+	long x = *(const long *) a, y = *(const long *) b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * AVL tree
+ */
+
+#ifdef AVL_STATS
+static avlcounters avl_counters; /* of the last AVL tree destroyed */
+#endif
+
+#ifdef AVL_HIST
+static avlhist avl_hists[AVL_NOPS]; /* every AVL operation, in cycles */
+static const char *avl_op_names[AVL_NOPS] = {"insert", "find", "delete", "destroy"};
+#endif
+
+void *avl_bench_create(void)
+{
+	avl_bench *b;
+
+	if ((b = malloc(sizeof(avl_bench))) == NULL)
+		return NULL;
+	if ((b->avlt = avl_create(compare_func, destroy_func)) == NULL) {
+		free(b);
+		return NULL;
+	}
+	b->count = 0;
+
+	#ifdef AVL_HIST
+	int i;
+	for (i = 0; i < AVL_NOPS; i++)
+		avl_hist_init(&avl_hists[i]);
+	avl_set_hist(b->avlt, avl_hists);
+	#endif
+
+	return b;
+}
+
+void *wavl_bench_create(void)
+{
+	avl_bench *b;
+
+	if ((b = avl_bench_create()) != NULL)
+		avl_set_engine(b->avlt, AVL_WAVL);
+	return b;
+}
+
+int avl_bench_insert(void *c, mydata *data)
+{
+	avl_bench *b = c;
+
+	if (avl_insert(b->avlt, data) == NULL)
+		return 0;
+	b->count++;
+	return 1;
+}
+
+mydata *avl_bench_find(void *c, mydata *query)
+{
+	avl_bench *b = c;
+	avlnode *node;
+
+	node = avl_find(b->avlt, query);
+	return node ? node->data : NULL;
+}
+
+void avl_bench_find_batch(void *c, mydata **queries, int n, mydata **out)
+{
+	avl_bench *b = c;
+	avlnode *nodes[BATCH];
+	int i;
+
+	avl_find_batch(b->avlt, (void **) queries, n, nodes);
+	for (i = 0; i < n; i++)
+		out[i] = nodes[i] ? nodes[i]->data : NULL;
+}
+
+int avl_bench_delete(void *c, mydata *query)
+{
+	avl_bench *b = c;
+	avlnode *node;
+
+	if ((node = avl_find(b->avlt, query)) == NULL)
+		return 0;
+	avl_delete(b->avlt, node, 0);
+	b->count--;
+	return 1;
+}
+
+void avl_bench_destroy(void *c)
+{
+	avl_bench *b = c;
+
+	#ifdef AVL_STATS
+	avl_counters = b->avlt->counters;
+	#endif
+	avl_destroy(b->avlt);
+	free(b);
+}
+
+size_t avl_bench_memory(void *c)
+{
+	avl_bench *b = c;
+	return sizeof(avltree) + (size_t) b->count * sizeof(avlnode);
+}
+
+int avl_bench_height_r(avltree *avlt, avlnode *n)
+{
+	int lh, rh;
+
+	if (n == AVL_NIL(avlt))
+		return 0;
+	lh = avl_bench_height_r(avlt, n->left);
+	rh = avl_bench_height_r(avlt, n->right);
+	return 1 + ((lh > rh) ? lh : rh);
+}
+
+int avl_bench_height(void *c)
+{
+	avl_bench *b = c;
+	return avl_bench_height_r(b->avlt, AVL_FIRST(b->avlt));
+}
+
+/*
+ * red-black tree (CLRS, with sentinel)
+ */
+
+void *rb_create(void)
+{
+	rbtree *t;
+
+	if ((t = malloc(sizeof(rbtree))) == NULL)
+		return NULL;
+	t->nil.left = t->nil.right = t->nil.parent = &t->nil;
+	t->nil.red = 0;
+	t->nil.data = NULL;
+	t->root = &t->nil;
+	t->count = 0;
+	return t;
+}
+
+void rb_rotate_left(rbtree *t, rbnode *x)
+{
+	rbnode *y = x->right;
+
+	x->right = y->left;
+	if (y->left != &t->nil)
+		y->left->parent = x;
+	y->parent = x->parent;
+	if (x->parent == &t->nil)
+		t->root = y;
+	else if (x == x->parent->left)
+		x->parent->left = y;
+	else
+		x->parent->right = y;
+	y->left = x;
+	x->parent = y;
+}
+
+void rb_rotate_right(rbtree *t, rbnode *x)
+{
+	rbnode *y = x->left;
+
+	x->left = y->right;
+	if (y->right != &t->nil)
+		y->right->parent = x;
+	y->parent = x->parent;
+	if (x->parent == &t->nil)
+		t->root = y;
+	else if (x == x->parent->right)
+		x->parent->right = y;
+	else
+		x->parent->left = y;
+	y->right = x;
+	x->parent = y;
+}
+
+int rb_insert(void *c, mydata *data)
+{
+	rbtree *t = c;
+	rbnode *z, *x, *y;
+
+	y = &t->nil;
+	for (x = t->root; x != &t->nil; x = (compare_func(data, x->data) < 0) ? x->left : x->right)
+		y = x;
+
+	if ((z = malloc(sizeof(rbnode))) == NULL)
+		return 0;
+	z->data = data;
+	z->parent = y;
+	z->left = z->right = &t->nil;
+	z->red = 1;
+	if (y == &t->nil)
+		t->root = z;
+	else if (compare_func(data, y->data) < 0)
+		y->left = z;
+	else
+		y->right = z;
+
+	while (z->parent->red) {
+		rbnode *g = z->parent->parent;
+		if (z->parent == g->left) {
+			y = g->right;
+			if (y->red) {
+				z->parent->red = y->red = 0;
+				g->red = 1;
+				z = g;
+			} else {
+				if (z == z->parent->right) {
+					z = z->parent;
+					rb_rotate_left(t, z);
+				}
+				z->parent->red = 0;
+				z->parent->parent->red = 1;
+				rb_rotate_right(t, z->parent->parent);
+			}
+		} else {
+			y = g->left;
+			if (y->red) {
+				z->parent->red = y->red = 0;
+				g->red = 1;
+				z = g;
+			} else {
+				if (z == z->parent->left) {
+					z = z->parent;
+					rb_rotate_right(t, z);
+				}
+				z->parent->red = 0;
+				z->parent->parent->red = 1;
+				rb_rotate_left(t, z->parent->parent);
+			}
+		}
+	}
+	t->root->red = 0;
+	t->count++;
+	return 1;
+}
+
+rbnode *rb_search(rbtree *t, mydata *query)
+{
+	rbnode *x;
+	int cmp;
+
+	for (x = t->root; x != &t->nil; x = (cmp < 0) ? x->left : x->right)
+		if ((cmp = compare_func(query, x->data)) == 0)
+			return x;
+	return NULL;
+}
+
+mydata *rb_find(void *c, mydata *query)
+{
+	rbnode *x = rb_search(c, query);
+	return x ? x->data : NULL;
+}
+
+void rb_transplant(rbtree *t, rbnode *u, rbnode *v)
+{
+	if (u->parent == &t->nil)
+		t->root = v;
+	else if (u == u->parent->left)
+		u->parent->left = v;
+	else
+		u->parent->right = v;
+	v->parent = u->parent;
+}
+
+int rb_delete(void *c, mydata *query)
+{
+	rbtree *t = c;
+	rbnode *z, *y, *x, *w;
+	int red;
+
+	if ((z = rb_search(t, query)) == NULL)
+		return 0;
+
+	y = z;
+	red = y->red;
+	if (z->left == &t->nil) {
+		x = z->right;
+		rb_transplant(t, z, z->right);
+	} else if (z->right == &t->nil) {
+		x = z->left;
+		rb_transplant(t, z, z->left);
+	} else {
+		for (y = z->right; y->left != &t->nil; y = y->left) ;
+		red = y->red;
+		x = y->right;
+		if (y->parent == z) {
+			x->parent = y;
+		} else {
+			rb_transplant(t, y, y->right);
+			y->right = z->right;
+			y->right->parent = y;
+		}
+		rb_transplant(t, z, y);
+		y->left = z->left;
+		y->left->parent = y;
+		y->red = z->red;
+	}
+
+	if (!red) {
+		while (x != t->root && !x->red) {
+			if (x == x->parent->left) {
+				w = x->parent->right;
+				if (w->red) {
+					w->red = 0;
+					x->parent->red = 1;
+					rb_rotate_left(t, x->parent);
+					w = x->parent->right;
+				}
+				if (!w->left->red && !w->right->red) {
+					w->red = 1;
+					x = x->parent;
+				} else {
+					if (!w->right->red) {
+						w->left->red = 0;
+						w->red = 1;
+						rb_rotate_right(t, w);
+						w = x->parent->right;
+					}
+					w->red = x->parent->red;
+					x->parent->red = 0;
+					w->right->red = 0;
+					rb_rotate_left(t, x->parent);
+					x = t->root;
+				}
+			} else {
+				w = x->parent->left;
+				if (w->red) {
+					w->red = 0;
+					x->parent->red = 1;
+					rb_rotate_right(t, x->parent);
+					w = x->parent->left;
+				}
+				if (!w->right->red && !w->left->red) {
+					w->red = 1;
+					x = x->parent;
+				} else {
+					if (!w->left->red) {
+						w->right->red = 0;
+						w->red = 1;
+						rb_rotate_left(t, w);
+						w = x->parent->left;
+					}
+					w->red = x->parent->red;
+					x->parent->red = 0;
+					w->left->red = 0;
+					rb_rotate_right(t, x->parent);
+					x = t->root;
+				}
+			}
+		}
+		x->red = 0;
+	}
+	t->nil.parent = &t->nil;
+
+	destroy_func(z->data);
+	free(z);
+	t->count--;
+	return 1;
+}
+
+void rb_destroy_r(rbtree *t, rbnode *x)
+{
+	if (x != &t->nil) {
+		rb_destroy_r(t, x->left);
+		rb_destroy_r(t, x->right);
+		destroy_func(x->data);
+		free(x);
+	}
+}
+
+void rb_destroy(void *c)
+{
+	rbtree *t = c;
+
+	rb_destroy_r(t, t->root);
+	free(t);
+}
+
+size_t rb_memory(void *c)
+{
+	rbtree *t = c;
+	return sizeof(rbtree) + (size_t) t->count * sizeof(rbnode);
+}
+
+int rb_height_r(rbtree *t, rbnode *x)
+{
+	int lh, rh;
+
+	if (x == &t->nil)
+		return 0;
+	lh = rb_height_r(t, x->left);
+	rh = rb_height_r(t, x->right);
+	return 1 + ((lh > rh) ? lh : rh);
+}
+
+int rb_height(void *c)
+{
+	rbtree *t = c;
+	return rb_height_r(t, t->root);
+}
+
+/*
+ * skip list (p = 1/4)
+ */
+
+void *sl_create(void)
+{
+	skiplist *s;
+	int i;
+
+	if ((s = malloc(sizeof(skiplist))) == NULL)
+		return NULL;
+	s->bytes = sizeof(slnode) + (SL_MAXLEVEL - 1) * sizeof(slnode *);
+	if ((s->head = malloc(s->bytes)) == NULL) {
+		free(s);
+		return NULL;
+	}
+	s->head->data = NULL;
+	s->head->level = SL_MAXLEVEL;
+	for (i = 0; i < SL_MAXLEVEL; i++)
+		s->head->next[i] = NULL;
+	s->level = 1;
+	s->count = 0;
+	s->bytes += sizeof(skiplist);
+	return s;
+}
+
+slnode *sl_search(skiplist *s, mydata *query, slnode **update)
+{
+	slnode *x;
+	int i;
+
+	x = s->head;
+	for (i = s->level - 1; i >= 0; i--) {
+		while (x->next[i] != NULL && compare_func(x->next[i]->data, query) < 0)
+			x = x->next[i];
+		if (update)
+			update[i] = x;
+	}
+	x = x->next[0];
+	return (x != NULL && compare_func(x->data, query) == 0) ? x : NULL;
+}
+
+int sl_insert(void *c, mydata *data)
+{
+	skiplist *s = c;
+	slnode *update[SL_MAXLEVEL];
+	slnode *x;
+	int i, level;
+
+	sl_search(s, data, update);
+
+	for (level = 1; level < SL_MAXLEVEL && (rng() & 3) == 0; level++) ;
+	if (level > s->level) {
+		for (i = s->level; i < level; i++)
+			update[i] = s->head;
+		s->level = level;
+	}
+
+	if ((x = malloc(sizeof(slnode) + (level - 1) * sizeof(slnode *))) == NULL)
+		return 0;
+	x->data = data;
+	x->level = level;
+	for (i = 0; i < level; i++) {
+		x->next[i] = update[i]->next[i];
+		update[i]->next[i] = x;
+	}
+	s->bytes += sizeof(slnode) + (level - 1) * sizeof(slnode *);
+	s->count++;
+	return 1;
+}
+
+mydata *sl_find(void *c, mydata *query)
+{
+	slnode *x = sl_search(c, query, NULL);
+	return x ? x->data : NULL;
+}
+
+int sl_delete(void *c, mydata *query)
+{
+	skiplist *s = c;
+	slnode *update[SL_MAXLEVEL];
+	slnode *x;
+	int i;
+
+	if ((x = sl_search(s, query, update)) == NULL)
+		return 0;
+	for (i = 0; i < x->level; i++)
+		update[i]->next[i] = x->next[i];
+	while (s->level > 1 && s->head->next[s->level - 1] == NULL)
+		s->level--;
+	s->bytes -= sizeof(slnode) + (x->level - 1) * sizeof(slnode *);
+	s->count--;
+	destroy_func(x->data);
+	free(x);
+	return 1;
+}
+
+void sl_destroy(void *c)
+{
+	skiplist *s = c;
+	slnode *x, *next;
+
+	for (x = s->head->next[0]; x != NULL; x = next) {
+		next = x->next[0];
+		destroy_func(x->data);
+		free(x);
+	}
+	free(s->head);
+	free(s);
+}
+
+size_t sl_memory(void *c)
+{
+	skiplist *s = c;
+	return s->bytes;
+}
+
+int sl_height(void *c)
+{
+	skiplist *s = c;
+	return s->level;
+}
+
+/*
+ * B-tree (CLRS, minimum degree BT_T)
+ */
+
+btnode *bt_node(btree *t, int leaf)
+{
+	btnode *x;
+
+	if ((x = malloc(sizeof(btnode))) == NULL)
+		return NULL;
+	x->n = 0;
+	x->leaf = leaf;
+	t->nodes++;
+	return x;
+}
+
+void *bt_create(void)
+{
+	btree *t;
+
+	if ((t = malloc(sizeof(btree))) == NULL)
+		return NULL;
+	t->nodes = 0;
+	t->count = 0;
+	if ((t->root = bt_node(t, 1)) == NULL) {
+		free(t);
+		return NULL;
+	}
+	return t;
+}
+
+/* index of the first key >= query */
+int bt_lower(btnode *x, mydata *query)
+{
+	int lo = 0, hi = x->n, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (compare_func(x->keys[mid], query) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int bt_split(btree *t, btnode *x, int i)
+{
+	btnode *y, *z;
+
+	y = x->child[i];
+	if ((z = bt_node(t, y->leaf)) == NULL)
+		return 0;
+	z->n = BT_T - 1;
+	memcpy(z->keys, y->keys + BT_T, (BT_T - 1) * sizeof(void *));
+	if (!y->leaf)
+		memcpy(z->child, y->child + BT_T, BT_T * sizeof(btnode *));
+	y->n = BT_T - 1;
+
+	memmove(x->child + i + 2, x->child + i + 1, (x->n - i) * sizeof(btnode *));
+	x->child[i + 1] = z;
+	memmove(x->keys + i + 1, x->keys + i, (x->n - i) * sizeof(void *));
+	x->keys[i] = y->keys[BT_T - 1];
+	x->n++;
+	return 1;
+}
+
+int bt_insert(void *c, mydata *data)
+{
+	btree *t = c;
+	btnode *x, *s;
+	int i;
+
+	if (t->root->n == BT_MAX) {
+		if ((s = bt_node(t, 0)) == NULL)
+			return 0;
+		s->child[0] = t->root;
+		if (!bt_split(t, s, 0)) {
+			free(s);
+			return 0;
+		}
+		t->root = s;
+	}
+
+	x = t->root;
+	while (!x->leaf) {
+		i = bt_lower(x, data);
+		if (x->child[i]->n == BT_MAX) {
+			if (!bt_split(t, x, i))
+				return 0;
+			if (compare_func(data, x->keys[i]) > 0)
+				i++;
+		}
+		x = x->child[i];
+	}
+	i = bt_lower(x, data);
+	memmove(x->keys + i + 1, x->keys + i, (x->n - i) * sizeof(void *));
+	x->keys[i] = data;
+	x->n++;
+	t->count++;
+	return 1;
+}
+
+mydata *bt_find(void *c, mydata *query)
+{
+	btree *t = c;
+	btnode *x;
+	int i;
+
+	for (x = t->root; ; x = x->child[i]) {
+		i = bt_lower(x, query);
+		if (i < x->n && compare_func(x->keys[i], query) == 0)
+			return x->keys[i];
+		if (x->leaf)
+			return NULL;
+	}
+}
+
+/* merge child[i], keys[i] and child[i + 1] of x into child[i] */
+void bt_merge(btree *t, btnode *x, int i)
+{
+	btnode *y = x->child[i], *z = x->child[i + 1];
+
+	y->keys[y->n] = x->keys[i];
+	memcpy(y->keys + y->n + 1, z->keys, z->n * sizeof(void *));
+	if (!y->leaf)
+		memcpy(y->child + y->n + 1, z->child, (z->n + 1) * sizeof(btnode *));
+	y->n += z->n + 1;
+
+	memmove(x->keys + i, x->keys + i + 1, (x->n - i - 1) * sizeof(void *));
+	memmove(x->child + i + 1, x->child + i + 2, (x->n - i - 1) * sizeof(btnode *));
+	x->n--;
+	free(z);
+	t->nodes--;
+}
+
+/* make sure x->child[i] has at least BT_T keys before descending, return the child to descend */
+int bt_fill(btree *t, btnode *x, int i)
+{
+	btnode *y = x->child[i], *s;
+
+	if (y->n >= BT_T)
+		return i;
+
+	if (i > 0 && (s = x->child[i - 1])->n >= BT_T) { /* borrow from left sibling */
+		memmove(y->keys + 1, y->keys, y->n * sizeof(void *));
+		if (!y->leaf)
+			memmove(y->child + 1, y->child, (y->n + 1) * sizeof(btnode *));
+		y->keys[0] = x->keys[i - 1];
+		if (!y->leaf)
+			y->child[0] = s->child[s->n];
+		x->keys[i - 1] = s->keys[s->n - 1];
+		s->n--;
+		y->n++;
+	} else if (i < x->n && (s = x->child[i + 1])->n >= BT_T) { /* borrow from right sibling */
+		y->keys[y->n] = x->keys[i];
+		if (!y->leaf)
+			y->child[y->n + 1] = s->child[0];
+		x->keys[i] = s->keys[0];
+		memmove(s->keys, s->keys + 1, (s->n - 1) * sizeof(void *));
+		if (!s->leaf)
+			memmove(s->child, s->child + 1, s->n * sizeof(btnode *));
+		s->n--;
+		y->n++;
+	} else if (i < x->n) {
+		bt_merge(t, x, i);
+	} else {
+		bt_merge(t, x, i - 1);
+		i--;
+	}
+	return i;
+}
+
+int bt_delete(void *c, mydata *query)
+{
+	btree *t = c;
+	btnode *x, *y;
+	void *found = NULL;
+	int i;
+
+	x = t->root;
+	for (;;) {
+		i = bt_lower(x, query);
+		if (i < x->n && compare_func(x->keys[i], query) == 0) {
+			if (x->leaf) {
+				if (found == NULL)
+					found = x->keys[i];
+				memmove(x->keys + i, x->keys + i + 1, (x->n - i - 1) * sizeof(void *));
+				x->n--;
+				break;
+			}
+			if (x->child[i]->n >= BT_T) { /* replace with predecessor, then delete it below */
+				for (y = x->child[i]; !y->leaf; y = y->child[y->n]) ;
+				found = x->keys[i];
+				x->keys[i] = y->keys[y->n - 1];
+				query = x->keys[i];
+				x = x->child[i];
+			} else if (x->child[i + 1]->n >= BT_T) { /* replace with successor, then delete it below */
+				for (y = x->child[i + 1]; !y->leaf; y = y->child[0]) ;
+				found = x->keys[i];
+				x->keys[i] = y->keys[0];
+				query = x->keys[i];
+				x = x->child[i + 1];
+			} else {
+				bt_merge(t, x, i);
+				x = x->child[i];
+			}
+		} else {
+			if (x->leaf)
+				return 0; /* not found */
+			x = x->child[bt_fill(t, x, i)];
+		}
+
+		if (t->root->n == 0 && !t->root->leaf) {
+			y = t->root;
+			t->root = y->child[0];
+			free(y);
+			t->nodes--;
+		}
+	}
+
+	if (t->root->n == 0 && !t->root->leaf) {
+		y = t->root;
+		t->root = y->child[0];
+		free(y);
+		t->nodes--;
+	}
+
+	destroy_func(found);
+	t->count--;
+	return 1;
+}
+
+void bt_destroy_r(btnode *x)
+{
+	int i;
+
+	for (i = 0; i < x->n; i++)
+		destroy_func(x->keys[i]);
+	if (!x->leaf)
+		for (i = 0; i <= x->n; i++)
+			bt_destroy_r(x->child[i]);
+	free(x);
+}
+
+void bt_destroy(void *c)
+{
+	btree *t = c;
+
+	bt_destroy_r(t->root);
+	free(t);
+}
+
+size_t bt_memory(void *c)
+{
+	btree *t = c;
+	return sizeof(btree) + (size_t) t->nodes * sizeof(btnode);
+}
+
+int bt_height(void *c)
+{
+	btree *t = c;
+	btnode *x;
+	int h;
+
+	for (h = 1, x = t->root; !x->leaf; x = x->child[0])
+		h++;
+	return h;
+}
+
+/*
+ * sorted array
+ */
+
+void *sa_create(void)
+{
+	sortedarray *s;
+
+	if ((s = malloc(sizeof(sortedarray))) == NULL)
+		return NULL;
+	s->a = NULL;
+	s->n = s->cap = 0;
+	return s;
+}
+
+/* index of the first element >= query */
+long sa_lower(sortedarray *s, mydata *query)
+{
+	long lo = 0, hi = s->n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (compare_func(s->a[mid], query) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+int sa_insert(void *c, mydata *data)
+{
+	sortedarray *s = c;
+	long i;
+
+	if (s->n == s->cap) {
+		long cap = s->cap ? 2 * s->cap : 64;
+		void **a = realloc(s->a, cap * sizeof(void *));
+		if (a == NULL)
+			return 0;
+		s->a = a;
+		s->cap = cap;
+	}
+	i = sa_lower(s, data);
+	memmove(s->a + i + 1, s->a + i, (s->n - i) * sizeof(void *));
+	s->a[i] = data;
+	s->n++;
+	return 1;
+}
+
+mydata *sa_find(void *c, mydata *query)
+{
+	sortedarray *s = c;
+	long i;
+
+	i = sa_lower(s, query);
+	return (i < s->n && compare_func(s->a[i], query) == 0) ? s->a[i] : NULL;
+}
+
+int sa_delete(void *c, mydata *query)
+{
+	sortedarray *s = c;
+	long i;
+
+	i = sa_lower(s, query);
+	if (i == s->n || compare_func(s->a[i], query) != 0)
+		return 0;
+	destroy_func(s->a[i]);
+	memmove(s->a + i, s->a + i + 1, (s->n - i - 1) * sizeof(void *));
+	s->n--;
+	return 1;
+}
+
+void sa_destroy(void *c)
+{
+	sortedarray *s = c;
+	long i;
+
+	for (i = 0; i < s->n; i++)
+		destroy_func(s->a[i]);
+	free(s->a);
+	free(s);
+}
+
+size_t sa_memory(void *c)
+{
+	sortedarray *s = c;
+	return sizeof(sortedarray) + (size_t) s->cap * sizeof(void *);
+}
+
+int sa_height(void *c)
+{
+	sortedarray *s = c;
+	int h;
+	long n;
+
+	for (h = 0, n = s->n; n > 0; n >>= 1)
+		h++;
+	return h;
+}
+
+static container containers[] = {
+	{"avl", avl_bench_create, avl_bench_insert, avl_bench_find, avl_bench_find_batch, avl_bench_delete, avl_bench_destroy, avl_bench_memory, avl_bench_height, 0},
+	{"wavl", wavl_bench_create, avl_bench_insert, avl_bench_find, avl_bench_find_batch, avl_bench_delete, avl_bench_destroy, avl_bench_memory, avl_bench_height, 0},
+	{"rbtree", rb_create, rb_insert, rb_find, NULL, rb_delete, rb_destroy, rb_memory, rb_height, 0},
+	{"skiplist", sl_create, sl_insert, sl_find, NULL, sl_delete, sl_destroy, sl_memory, sl_height, 0},
+	{"btree", bt_create, bt_insert, bt_find, NULL, bt_delete, bt_destroy, bt_memory, bt_height, 0},
+	{"sorted", sa_create, sa_insert, sa_find, NULL, sa_delete, sa_destroy, sa_memory, sa_height, 200000} /* O(n) insert/delete */
+};
+
+/*
+ * workload
+ */
+
+void phase_begin(phase_result *r, long ops)
+{
+	r->ops = ops;
+	r->nsamples = 0;
+	r->samples = malloc((ops / SAMPLE_EVERY + 1) * sizeof(long));
+	counters_start();
+	r->seconds = (double) now_ns();
+}
+
+void phase_end(phase_result *r)
+{
+	r->seconds = ((double) now_ns() - r->seconds) / 1e9;
+	counters_stop(r->counters);
+	if (r->samples)
+		qsort(r->samples, r->nsamples, sizeof(long), compare_long);
+}
+
+#define TIMED(r, i, stmt) \
+do { \
+	if ((i) % SAMPLE_EVERY == 0 && (r)->samples) { \
+		long _t0 = now_ns(); \
+		stmt; \
+		(r)->samples[(r)->nsamples++] = now_ns() - _t0; \
+	} else { \
+		stmt; \
+	} \
+} while (0)
+
+long percentile(phase_result *r, double p)
+{
+	long i;
+
+	if (r->nsamples == 0)
+		return 0;
+	i = (long) (p * (r->nsamples - 1) + 0.5);
+	return r->samples[i];
+}
+
+/*
+ * keys 2*i are present, keys 2*i+1 are never inserted (misses)
+ * return 0 if a container misbehaves
+ */
+int run(container *c, int *keys, int *probe, long n, phase_result *res, size_t *memory, int *height)
+{
+	void *ds;
+	mydata query, *data;
+	long i;
+	int ok = 1;
+
+	if ((ds = c->create()) == NULL)
+		return 0;
+
+	phase_begin(&res[BUILD], n);
+	for (i = 0; i < n; i++) {
+		if ((data = makedata(keys[i])) == NULL)
+			return 0;
+		TIMED(&res[BUILD], i, ok &= c->insert(ds, data));
+	}
+	phase_end(&res[BUILD]);
+
+	*memory = c->memory(ds);
+	*height = c->height(ds);
+
+	phase_begin(&res[LOOKUP], n);
+	for (i = 0; i < n; i++) {
+		query.key = probe[i];
+		TIMED(&res[LOOKUP], i, ok &= (c->find(ds, &query) != NULL));
+	}
+	phase_end(&res[LOOKUP]);
+
+	/* the same lookups, BATCH keys at a time; one latency sample covers a whole batch */
+	phase_begin(&res[BATCH_LOOKUP], n);
+	for (i = 0; i < n; i += BATCH) {
+		mydata queries[BATCH], *qp[BATCH], *found[BATCH];
+		int m, q;
+
+		m = (n - i < BATCH) ? (int) (n - i) : BATCH;
+		for (q = 0; q < m; q++) {
+			queries[q].key = probe[i + q];
+			qp[q] = &queries[q];
+		}
+		if (c->find_batch) {
+			TIMED(&res[BATCH_LOOKUP], i / BATCH, c->find_batch(ds, qp, m, found));
+		} else {
+			TIMED(&res[BATCH_LOOKUP], i / BATCH, for (q = 0; q < m; q++) found[q] = c->find(ds, qp[q]));
+		}
+		for (q = 0; q < m; q++)
+			ok &= (found[q] != NULL);
+	}
+	phase_end(&res[BATCH_LOOKUP]);
+
+	phase_begin(&res[MISS], n);
+	for (i = 0; i < n; i++) {
+		query.key = probe[i] + 1;
+		TIMED(&res[MISS], i, ok &= (c->find(ds, &query) == NULL));
+	}
+	phase_end(&res[MISS]);
+
+	/* churn: delete a present key, insert a fresh one; the tree size stays n */
+	phase_begin(&res[CHURN], n);
+	for (i = 0; i < n; i++) {
+		query.key = keys[i];
+		data = makedata(keys[i] + 2 * (int) n);
+		TIMED(&res[CHURN], i, ok &= c->delete(ds, &query) & c->insert(ds, data));
+	}
+	phase_end(&res[CHURN]);
+
+	phase_begin(&res[DELETE], n / 2);
+	for (i = 0; i < n / 2; i++) {
+		query.key = probe[i] + 2 * (int) n;
+		TIMED(&res[DELETE], i, ok &= c->delete(ds, &query));
+	}
+	phase_end(&res[DELETE]);
+
+	phase_begin(&res[TEARDOWN], n - n / 2);
+	TIMED(&res[TEARDOWN], 0, c->destroy(ds));
+	phase_end(&res[TEARDOWN]);
+
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	long n, i;
+	int *keys, *probe;
+	int j, k, l, ncounters;
+
+	n = (argc > 1) ? atol(argv[1]) : 1000000;
+	if (n <= 0 || n > 100000000) {
+		fprintf(stderr, "usage: %s [n]\n", argv[0]);
+		return 1;
+	}
+
+	keys = malloc(n * sizeof(int));
+	probe = malloc(n * sizeof(int));
+	if (keys == NULL || probe == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < n; i++)
+		keys[i] = probe[i] = 2 * (int) i;
+	shuffle(keys, n);
+	shuffle(probe, n);
+
+	ncounters = counters_open();
+
+	printf("n = %ld, latency sampled every %d ops (ns, including timer overhead)\n", n, SAMPLE_EVERY);
+	if (ncounters == 0)
+		printf("hardware counters unavailable (perf_event_open failed), reporting wall-clock only\n");
+	printf("\n");
+	printf("%-10s %-9s %10s %8s %8s %8s %10s\n", "container", "phase", "Mops/s", "p50", "p99", "p999", "max");
+
+	for (j = 0; j < (int) (sizeof(containers) / sizeof(containers[0])); j++) {
+		phase_result res[NPHASES];
+		size_t memory = 0;
+		int height = 0;
+
+		if (containers[j].limit && n > containers[j].limit) {
+			printf("%-10s skipped above %ld entries\n\n", containers[j].name, containers[j].limit);
+			continue;
+		}
+
+		memset(res, 0, sizeof(res));
+		if (!run(&containers[j], keys, probe, n, res, &memory, &height))
+			printf("%-10s FAILED\n", containers[j].name);
+
+		for (k = 0; k < NPHASES; k++) {
+			printf("%-10s %-9s %10.3f %8ld %8ld %8ld %10ld\n", containers[j].name, phase_names[k],
+				res[k].seconds > 0 ? res[k].ops / res[k].seconds / 1e6 : 0.0,
+				percentile(&res[k], 0.50), percentile(&res[k], 0.99), percentile(&res[k], 0.999),
+				res[k].nsamples ? res[k].samples[res[k].nsamples - 1] : 0);
+			free(res[k].samples);
+		}
+		printf("%-10s %-9s %10.1f bytes/entry, height %d\n", containers[j].name, "shape", (double) memory / n, height);
+
+		#ifdef AVL_STATS
+		if (containers[j].destroy == avl_bench_destroy) {
+			printf("%-10s %-9s insert %lu single + %lu double, delete %lu single + %lu double\n", containers[j].name,
+				"rotations", avl_counters.insert_single_rotations, avl_counters.insert_double_rotations,
+				avl_counters.delete_single_rotations, avl_counters.delete_double_rotations);
+			printf("%-10s %-9s insert %.2f avg %lu max, delete %.2f avg %lu max levels\n", containers[j].name,
+				"backtrack", (double) avl_counters.insert_backtrack / (n + n), avl_counters.insert_backtrack_max,
+				(double) avl_counters.delete_backtrack / (n + n / 2), avl_counters.delete_backtrack_max);
+		}
+		#endif
+
+		#ifdef AVL_HIST
+		if (containers[j].destroy == avl_bench_destroy) { /* reset by each create */
+			printf("%s operation latency (cycles, every operation):\n", containers[j].name);
+			for (k = 0; k < AVL_NOPS; k++)
+				avl_hist_print(&avl_hists[k], avl_op_names[k]);
+		}
+		#endif
+
+		if (ncounters > 0) {
+			printf("%-10s %-9s", "", "per op");
+			for (l = 0; l < NCOUNTERS; l++)
+				printf(" %10s", counter_names[l]);
+			printf("\n");
+			for (k = 0; k < NPHASES; k++) {
+				printf("%-10s %-9s", containers[j].name, phase_names[k]);
+				for (l = 0; l < NCOUNTERS; l++) {
+					if (res[k].counters[l] < 0)
+						printf(" %10s", "n/a");
+					else
+						printf(" %10.2f", (double) res[k].counters[l] / res[k].ops);
+				}
+				printf("\n");
+			}
+		}
+		printf("\n");
+	}
+
+	counters_close();
+
+	free(keys);
+	free(probe);
+	return 0;
+}
+
+/*
+ * usage: gcc -O2 avl_bench.c avl_bf.c avl_data.c avl_hist.c && ./a.out [n], or avl_bench.sh [n]
+ * add -DAVL_STATS -DAVL_HIST (AVL_FLAGS for avl_bench.sh) for AVL operation counters, rotations included,
+ * and latency histograms of both engines; timing every operation slows the avl and wavl rows;
+ * "wavl" is the same tree rebalanced by ranks, see avl_set_engine()
+ */
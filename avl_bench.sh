@@ -0,0 +1,5 @@
+#!/bin/bash
+# usage: avl_bench.sh [n]
+# AVL_FLAGS="-DAVL_STATS -DAVL_HIST" avl_bench.sh [n] adds rotation counters and latency histograms for avl and wavl
+
+gcc -O2 $AVL_FLAGS avl_bf.c avl_data.c avl_hist.c avl_bench.c && ./a.out "$@"
@@ -5,8 +5,124 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include "avl_bf.h"
 
+#ifdef AVL_STATS
+#define STAT_INC(avlt, field) ((avlt)->counters.field++)
+#define STAT_BACKTRACK(avlt, op, depth) \
+do { \
+	(avlt)->counters.op##_backtrack += (depth); \
+	if ((depth) > (avlt)->counters.op##_backtrack_max) \
+		(avlt)->counters.op##_backtrack_max = (depth); \
+} while (0)
+#else
+#define STAT_INC(avlt, field) ((void) 0)
+#define STAT_BACKTRACK(avlt, op, depth) ((void) (depth))
+#endif
+
+#ifdef AVL_HIST
+#define HIST_START(avlt) unsigned long long hist_start = ((avlt)->hist ? avl_cycles() : 0)
+#define HIST_RECORD(avlt, hist, op) \
+do { \
+	if ((hist) != NULL) \
+		avl_hist_record(&(hist)[op], avl_cycles() - hist_start); \
+} while (0)
+#else
+#define HIST_START(avlt) ((void) 0)
+#define HIST_RECORD(avlt, hist, op) ((void) 0)
+#endif
+
+#if defined(__GNUC__)
+#define PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define PREFETCH(addr) ((void) 0)
+#endif
+
+#define COMPARE(avlt, d1, d2) (STAT_INC(avlt, compares), (avlt)->compare((d1), (d2)))
+
+/*
+ * with a normalizer, keys are ordered by their cached prefixes first
+ * and the comparator only breaks ties
+ */
+#ifdef AVL_PREFIX
+#define PREFIX(avlt, data) ((avlt)->normalize ? (avlt)->normalize(data) : 0)
+#define NODE_COMPARE(avlt, d, pfx, n) \
+	(((pfx) != (n)->prefix) ? (((pfx) < (n)->prefix) ? -1 : 1) : COMPARE(avlt, d, (n)->data))
+#else
+#define NODE_COMPARE(avlt, d, pfx, n) COMPARE(avlt, d, (n)->data)
+#endif
+
+/*
+ * subtree aggregates are recomputed bottom-up from the children,
+ * on the path above a changed node and for both nodes of a rotation
+ */
+#ifdef AVL_AUGMENT
+#define AUGMENT(avlt, n) ((avlt)->combine(&(n)->aux, &(n)->left->aux, (n), &(n)->right->aux))
+#define AUGMENT_NODE(avlt, n) \
+do { \
+	if ((avlt)->combine != NULL) \
+		AUGMENT(avlt, n); \
+} while (0)
+#define AUGMENT_PATH(avlt, n) AUGMENT_UP(avlt, n, AVL_ROOT(avlt))
+#define AUGMENT_UP(avlt, n, top) \
+do { \
+	if ((avlt)->combine != NULL) \
+		augment_path(avlt, n, top); \
+} while (0)
+#define AUGMENT_ROTATION(avlt, x, y) \
+do { \
+	if ((avlt)->combine != NULL) { \
+		AUGMENT(avlt, x); \
+		AUGMENT(avlt, y); \
+	} \
+} while (0)
+#else
+#define AUGMENT_NODE(avlt, n) ((void) 0)
+#define AUGMENT_PATH(avlt, n) ((void) 0)
+#define AUGMENT_UP(avlt, n, top) ((void) 0)
+#define AUGMENT_ROTATION(avlt, x, y) ((void) 0)
+#endif
+
+/*
+ * a deletion only marks the node if the tree is lazy and keeps no aggregates,
+ * which would still include the data of a tombstone
+ */
+#ifdef AVL_LAZY
+#ifdef AVL_AUGMENT
+#define LAZY(avlt) ((avlt)->lazy > 0 && (avlt)->combine == NULL)
+#else
+#define LAZY(avlt) ((avlt)->lazy > 0)
+#endif
+#endif
+
+/*
+ * a key sets BLOOM_PROBES bits in one block of the filter, so a test touches one cache line
+ */
+#ifdef AVL_BLOOM
+#define BLOOM_WORDS 8 /* 64-bit words per block */
+#define BLOOM_PROBES 6
+#define BLOOM_ADD(avlt, data) \
+do { \
+	if ((avlt)->bloom != NULL) \
+		bloom_add(avlt, (avlt)->bloom_hash(data)); \
+} while (0)
+#define BLOOM_STALE(avlt, n) ((avlt)->bloom_stale += (n))
+#else
+#define BLOOM_ADD(avlt, data) ((void) 0)
+#define BLOOM_STALE(avlt, n) ((void) 0)
+#endif
+
+#define WAVL(avlt) ((avlt)->engine == AVL_WAVL)
+#define RANK(avlt, n) ((n) == AVL_NIL(avlt) ? -1 : (int) (unsigned char) (n)->bf)
+#define SET_RANK(n, r) ((n)->bf = (char) (r))
+
+#define MAX_HEIGHT 96 /* height bound of any AVL tree with fewer than 2^64 nodes */
+#define COMPACT_TOP 10 /* levels laid out breadth-first by avl_compact */
+
+#define IN_SLAB(slab, n) ((n) >= (slab)->nodes && (n) < (slab)->nodes + (slab)->size)
+
 static avlnode *rotate_left(avltree *avlt, avlnode *x);
 static avlnode *rotate_right(avltree *avlt, avlnode *x);
 
@@ -17,6 +133,76 @@ static avlnode *fix_delete_rightimbalance(avltree *avlt, avlnode *p);
 
 static int check_order(avltree *avlt, avlnode *n, void *min, void *max);
 static int check_height(avltree *avlt, avlnode *n);
+static int check_rank(avltree *avlt, avlnode *n);
+static void shape(avltree *avlt, avlnode *n, int depth, avlstats *stats);
+
+static void *mem_alloc(const avlallocator *allocator, size_t size, int aligned);
+static void mem_free(const avlallocator *allocator, void *p, size_t size);
+static avlnode *alloc_node(avltree *avlt);
+static void free_node(avltree *avlt, avlnode *n);
+static avlslab *new_slab(avltree *avlt, unsigned long size);
+static void release_slab(avltree *avlt, avlslab *slab);
+static avlnode *move_node(avltree *avlt, avlnode *n, avlslab *slab);
+static avlnode *successor(avltree *avlt, avlnode *node);
+static avlnode *predecessor(avltree *avlt, avlnode *node);
+static int height(avltree *avlt, avlnode *n);
+static int grow(avltree *avlt, avlnode *current, avlnode *top);
+static avlnode *join(avltree *avlt, avlnode *l, int hl, avlnode *k, avlnode *r, int hr, int *h);
+static void split(avltree *avlt, avlnode *n, int hn, void *bound, avlnode **l, int *hl, avlnode **r, int *hr);
+static avlnode *split_last(avltree *avlt, avlnode *n, int hn, avlnode **rest, int *hrest);
+static unsigned long erase(avltree *avlt, avlnode *n, void (*func)(void *, void *), void *cookie);
+static void swap_successor(avltree *avlt, avlnode *node, avlnode *succ);
+static void link_node(avltree *avlt, avlnode *node, avlnode *parent);
+static void unlink_node(avltree *avlt, avlnode *node);
+static void wavl_insert(avltree *avlt, avlnode *x);
+static void wavl_delete(avltree *avlt, avlnode *p, avlnode *x);
+static int rank_all(avltree *avlt, avlnode *n);
+static unsigned long delete_range(avltree *avlt, void *lo, void *hi, void (*func)(void *, void *), void *cookie);
+static unsigned long range(avltree *avlt, void *lo, void *hi, void (*func)(void *, void *), void *cookie);
+static int find_shortcut(avltree *avlt, void *data, avlnode **out, unsigned long long *h);
+
+#ifdef AVL_PREFIX
+static void renormalize(avltree *avlt, avlnode *n);
+#endif
+
+#ifdef AVL_CACHE
+static avlnode *cache_lookup(avltree *avlt, void *data, unsigned long long h);
+static void cache_fill(avltree *avlt, avlnode *n, unsigned long long h);
+static void cache_replace(avltree *avlt, avlnode *n, avlnode *m);
+#endif
+
+#ifdef AVL_BLOOM
+static void bloom_add(avltree *avlt, unsigned long long h);
+static int bloom_test(avltree *avlt, unsigned long long h);
+#endif
+
+#ifdef AVL_LAZY
+#ifndef AVL_DUP
+static void revive(avltree *avlt, avlnode *n);
+#endif
+static unsigned long gather(avltree *avlt, avlnode *n, avlnode **nodes, unsigned long i);
+static avlnode *rebuild(avltree *avlt, avlnode **nodes, unsigned long n, avlnode *parent, int *h);
+#endif
+
+#ifdef AVL_AUGMENT
+static void augment_path(avltree *avlt, avlnode *n, avlnode *top);
+static void augment_all(avltree *avlt, avlnode *n);
+static void aggregate(avltree *avlt, avlnode *n, void *lo, void *hi, avlaux *result);
+#endif
+
+#ifdef AVL_INTERVAL
+static void interval_combine(avlaux *aux, const avlaux *left, const avlnode *node, const avlaux *right);
+static int overlap(avltree *avlt, avlnode *n, long long lo, long long hi, int (*func)(void *, void *), void *cookie);
+#endif
+
+#ifdef AVL_MULTISET
+static int bucket_push(avltree *avlt, avlnode *n, void *data, int limited);
+static void bucket_free(avltree *avlt, avlnode *n);
+static void bucket_destroy(avltree *avlt, avlnode *n);
+#endif
+
+static avlnode *clone(avltree *avlt, avltree *copy, avlnode *n, avlnode *parent, avlslab *slab, \
+	void *(*copy_func)(void *));
 
 static void print(avltree *avlt, avlnode *n, void (*print_func)(void *), int depth, char *label);
 static void destroy(avltree *avlt, avlnode *n);
@@ -26,10 +212,20 @@ static void destroy(avltree *avlt, avlnode *n);
  * return NULL if out of memory
  */
 avltree *avl_create(int (*compare_func)(const void *, const void *), void (*destroy_func)(void *))
+{
+	return avl_create_with(compare_func, destroy_func, NULL);
+}
+
+/*
+ * construction of a tree whose memory comes from allocator, which must outlive it
+ * return NULL if out of memory
+ */
+avltree *avl_create_with(int (*compare_func)(const void *, const void *), void (*destroy_func)(void *), \
+	const avlallocator *allocator)
 {
 	avltree *avlt;
 
-	avlt = (avltree *) malloc(sizeof(avltree));
+	avlt = (avltree *) mem_alloc(allocator, sizeof(avltree), 0);
 	if (avlt == NULL)
 		return NULL; /* out of memory */
 
@@ -39,17 +235,67 @@ avltree *avl_create(int (*compare_func)(const void *, const void *), void (*dest
 	/* sentinel node nil */
 	avlt->nil.left = avlt->nil.right = avlt->nil.parent = AVL_NIL(avlt);
 	avlt->nil.bf = 0;
+	avlt->nil.flags = 0;
 	avlt->nil.data = NULL;
 
 	/* sentinel node root */
 	avlt->root.left = avlt->root.right = avlt->root.parent = AVL_NIL(avlt);
 	avlt->root.bf = 0;
+	avlt->root.flags = 0;
 	avlt->root.data = NULL;
 
 	#ifdef AVL_MIN
 	avlt->min = NULL;
 	#endif
 
+	avlt->count = 0;
+	avlt->engine = AVL_BF;
+
+	avlt->slabs = NULL;
+	avlt->compact = NULL;
+	avlt->cursor = NULL;
+	avlt->relocate = NULL;
+	avlt->arena = NULL;
+	avlt->allocator = allocator;
+	avlt->bytes = 0;
+	avlt->limit = 0;
+
+	#ifdef AVL_STATS
+	avl_reset_counters(avlt);
+	#endif
+
+	#ifdef AVL_HIST
+	avlt->hist = NULL;
+	#endif
+
+	#ifdef AVL_PREFIX
+	avlt->normalize = NULL;
+	#endif
+
+	#ifdef AVL_AUGMENT
+	avlt->combine = NULL;
+	memset(&avlt->nil.aux, 0, sizeof(avlaux));
+	#endif
+
+	#ifdef AVL_LAZY
+	avlt->lazy = 0;
+	avlt->tombstones = 0;
+	#endif
+
+	#ifdef AVL_CACHE
+	avlt->hash = NULL;
+	avlt->cache = NULL;
+	avlt->cache_mask = 0;
+	avlt->cache_hits = avlt->cache_misses = 0;
+	#endif
+
+	#ifdef AVL_BLOOM
+	avlt->bloom_hash = NULL;
+	avlt->bloom = NULL;
+	avlt->bloom_mask = 0;
+	avlt->bloom_stale = 0;
+	#endif
+
 	return avlt;
 }
 
@@ -58,257 +304,2003 @@ avltree *avl_create(int (*compare_func)(const void *, const void *), void (*dest
  */
 void avl_destroy(avltree *avlt)
 {
+	HIST_START(avlt);
+
+	#ifdef AVL_HIST
+	avlhist *hist = avlt->hist;
+	#endif
+
 	destroy(avlt, AVL_FIRST(avlt));
-	free(avlt);
+
+	while (avlt->slabs != NULL) { /* the compaction target may be left empty */
+		avlslab *slab = avlt->slabs;
+		avlt->slabs = slab->next;
+		mem_free(avlt->allocator, slab, sizeof(avlslab) + slab->size * sizeof(avlnode));
+	}
+
+	#ifdef AVL_CACHE
+	if (avlt->cache != NULL)
+		mem_free(avlt->allocator, avlt->cache, (avlt->cache_mask + 1) * sizeof(avlcacheset));
+	#endif
+
+	#ifdef AVL_BLOOM
+	if (avlt->bloom != NULL)
+		mem_free(avlt->allocator, avlt->bloom, (avlt->bloom_mask + 1) * BLOOM_WORDS * sizeof(unsigned long long));
+	#endif
+
+	mem_free(avlt->allocator, avlt, sizeof(avltree));
+
+	HIST_RECORD(avlt, hist, AVL_OP_DESTROY);
 }
 
 /*
- * look up
- * return NULL if not found
+ * take all nodes of avlt in O(1) and leave it empty, with its configuration, for reuse;
+ * the nodes and their data are freed by avl_reclaim
+ * return NULL if out of memory (avlt is unchanged)
  */
-avlnode *avl_find(avltree *avlt, void *data)
+avlreclaim *avl_detach(avltree *avlt)
 {
-	avlnode *p;
+	avlreclaim *r;
 
-	p = AVL_FIRST(avlt);
+	if ((r = (avlreclaim *) mem_alloc(avlt->allocator, sizeof(avlreclaim), 0)) == NULL)
+		return NULL; /* out of memory */
 
-	while (p != AVL_NIL(avlt)) {
-		int cmp;
-		cmp = avlt->compare(data, p->data);
-		if (cmp == 0)
-			return p; /* found */
-		p = (cmp < 0) ? p->left : p->right;
+	r->destroy = avlt->destroy;
+	r->nil = AVL_NIL(avlt);
+	r->next = NULL;
+	r->slabs = avlt->slabs;
+	r->arena = avlt->arena;
+	r->allocator = avlt->allocator;
+	r->count = avlt->count;
+	r->queue = NULL;
+
+	if (AVL_FIRST(avlt) != AVL_NIL(avlt)) {
+		r->next = AVL_FIRST(avlt);
+		r->next->parent = NULL; /* the top, no longer below root */
 	}
 
-	return NULL; /* not found */
+	AVL_FIRST(avlt) = AVL_NIL(avlt);
+
+	#ifdef AVL_MIN
+	avlt->min = NULL;
+	#endif
+
+	avlt->count = 0;
+
+	avlt->slabs = NULL;
+	avlt->compact = NULL;
+	avlt->cursor = NULL;
+	avlt->bytes = 0; /* the nodes, slabs and buckets went to r */
+
+	#ifdef AVL_LAZY
+	avlt->tombstones = 0;
+	#endif
+
+	#ifdef AVL_CACHE
+	if (avlt->cache != NULL) /* entries of the detached nodes */
+		memset(avlt->cache, 0, (avlt->cache_mask + 1) * sizeof(avlcacheset));
+	#endif
+
+	#ifdef AVL_BLOOM
+	if (avlt->bloom != NULL)
+		memset(avlt->bloom, 0, (avlt->bloom_mask + 1) * BLOOM_WORDS * sizeof(unsigned long long));
+	avlt->bloom_stale = 0;
+	#endif
+
+	return r;
 }
 
 /*
- * next larger
- * return NULL if not found
+ * destroy the data of at most budget nodes of r and free them, in bounded time per node:
+ * leaves are cut off bottom-up through the parent pointers, without recursion
+ * return 1 if nodes are left, 0 if done (r is freed)
  */
-avlnode *avl_successor(avltree *avlt, avlnode *node)
+int avl_reclaim(avlreclaim *r, unsigned long budget)
 {
-	avlnode *p;
+	avlnode *n;
+	avlslab **pp, *slab;
+
+	while (budget > 0 && (n = r->next) != NULL) {
+		/* move down to a leaf */
+		if (n->left != r->nil) {
+			r->next = n->left;
+			continue;
+		}
+		if (n->right != r->nil) {
+			r->next = n->right;
+			continue;
+		}
 
-	p = node->right;
+		/* cut it off, its parent may be a leaf now */
+		r->next = n->parent;
+		if (r->next != NULL) {
+			if (r->next->left == n)
+				r->next->left = r->nil;
+			else
+				r->next->right = r->nil;
+		}
 
-	if (p != AVL_NIL(avlt)) {
-		/* move down until we find it */
-		for ( ; p->left != AVL_NIL(avlt); p = p->left) ;
-	} else {
-		/* move up until we find it or hit the root */
-		for (p = node->parent; node == p->right; node = p, p = p->parent) ;
+		r->destroy(n->data);
+		#ifdef AVL_MULTISET
+		if (n->bucket != NULL) {
+			unsigned long i;
+			for (i = 0; i < n->bucket->count; i++)
+				r->destroy(n->bucket->data[i]);
+			mem_free(r->allocator, n->bucket, AVL_BUCKET_BYTES(n->bucket->size));
+		}
+		#endif
 
-		if (p == AVL_ROOT(avlt))
-			p = NULL; /* not found */
+		if (n->flags & AVL_POOLED) {
+			for (pp = &r->slabs; !IN_SLAB(*pp, n); pp = &(*pp)->next) ;
+			if (--(*pp)->live == 0) {
+				slab = *pp;
+				*pp = slab->next;
+				mem_free(r->allocator, slab, sizeof(avlslab) + slab->size * sizeof(avlnode));
+			}
+		} else if (r->arena != NULL) {
+			n->left = r->arena->free;
+			r->arena->free = n;
+			r->arena->live--;
+		} else {
+			mem_free(r->allocator, n, sizeof(avlnode));
+		}
+
+		r->count--;
+		budget--;
 	}
 
-	return p;
+	if (r->next != NULL)
+		return 1;
+
+	while (r->slabs != NULL) { /* a compaction target may be left empty */
+		slab = r->slabs;
+		r->slabs = slab->next;
+		mem_free(r->allocator, slab, sizeof(avlslab) + slab->size * sizeof(avlnode));
+	}
+	mem_free(r->allocator, r, sizeof(avlreclaim));
+
+	return 0;
 }
 
 /*
- * apply func
- * return non-zero if error
+ * create an empty arena allocating chunk nodes at a time
+ * return NULL if out of memory
  */
-int avl_apply(avltree *avlt, avlnode *node, int (*func)(void *, void *), void *cookie, enum avltraversal order)
+avlarena *avl_arena_create(unsigned long chunk)
 {
-	int err;
+	avlarena *arena;
 
-	if (node != AVL_NIL(avlt)) {
-		if (order == PREORDER && (err = func(node->data, cookie)) != 0) /* preorder */
-			return err;
-		if ((err = avl_apply(avlt, node->left, func, cookie, order)) != 0) /* left */
-			return err;
-		if (order == INORDER && (err = func(node->data, cookie)) != 0) /* inorder */
-			return err;
-		if ((err = avl_apply(avlt, node->right, func, cookie, order)) != 0) /* right */
-			return err;
-		if (order == POSTORDER && (err = func(node->data, cookie)) != 0) /* postorder */
-			return err;
+	if ((arena = (avlarena *) malloc(sizeof(avlarena))) == NULL)
+		return NULL; /* out of memory */
+
+	arena->free = NULL;
+	arena->chunks = NULL;
+	arena->chunk = (chunk > 0) ? chunk : 1;
+	arena->live = 0;
+
+	return arena;
+}
+
+/*
+ * free an arena and all its nodes; the trees set to it must be destroyed or empty
+ */
+void avl_arena_destroy(avlarena *arena)
+{
+	while (arena->chunks != NULL) {
+		avlslab *chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		free(chunk);
 	}
 
+	free(arena);
+}
+
+/*
+ * take the nodes inserted from now on from arena, from the allocator of avlt if arena is NULL
+ * return non-zero if avlt is not empty (the tree is unchanged)
+ */
+int avl_set_arena(avltree *avlt, avlarena *arena)
+{
+	if (avlt->count > 0)
+		return -1;
+
+	avlt->arena = arena;
+
 	return 0;
 }
 
 /*
- * print tree
+ * fail inserts that would take the bytes of the nodes, slabs and buckets of avlt over bytes, 0 for no limit;
+ * the limit is soft: other operations, such as compaction or cloning, may go over it
  */
-void avl_print(avltree *avlt, void (*print_func)(void *))
+void avl_set_limit(avltree *avlt, unsigned long bytes)
 {
-	printf("\n--\n");
-	print(avlt, AVL_FIRST(avlt), print_func, 0, "T");
-	printf("\nheight = %d\n", check_height(avlt, AVL_FIRST(avlt)));
+	avlt->limit = bytes;
 }
 
 /*
- * check order of tree
+ * have relocate_func(data, node) called for each node moved by avl_compact or avl_compact_step,
+ * with the data of the node and its new place, so that handles kept to nodes can follow them;
+ * NULL to turn it off
  */
-int avl_check_order(avltree *avlt, void *min, void *max)
+void avl_set_relocate(avltree *avlt, void (*relocate_func)(void *, avlnode *))
 {
-	return check_order(avlt, AVL_FIRST(avlt), min, max);
+	avlt->relocate = relocate_func;
 }
 
 /*
- * check height of tree
+ * rebalance avlt by balance factors (AVL_BF, the default) or by ranks (AVL_WAVL) from now on;
+ * an AVL tree is a valid weak AVL tree, so a tree is switched to AVL_WAVL in O(n) at any time,
+ * but a weak AVL tree may not be an AVL tree, so it is switched back only while empty
+ * return non-zero if avlt is not empty and cannot be switched (the tree is unchanged)
  */
-int avl_check_height(avltree *avlt)
+int avl_set_engine(avltree *avlt, enum avlengine engine)
 {
-	int height;
-	height = check_height(avlt, AVL_FIRST(avlt));
+	if (engine == avlt->engine)
+		return 0;
+	if (engine == AVL_BF && avlt->count > 0)
+		return -1;
 
-	return (height < 0) ? 0 : 1;
+	if (engine == AVL_WAVL)
+		rank_all(avlt, AVL_FIRST(avlt));
+	avlt->engine = engine;
+
+	return 0;
 }
 
 /*
- * insert (or update) data
+ * allocate size bytes for the nodes of avlt, for the modules building slabs
  * return NULL if out of memory
  */
-avlnode *avl_insert(avltree *avlt, void *data)
+void *avl_alloc(avltree *avlt, size_t size)
 {
-	avlnode *current, *parent;
-	avlnode *new_node;
-
-	/* do a binary search to find where it should be */
+	void *p;
 
-	current = AVL_FIRST(avlt);
-	parent = AVL_ROOT(avlt);
+	if ((p = mem_alloc(avlt->allocator, size, 0)) != NULL)
+		avlt->bytes += size;
 
-	while (current != AVL_NIL(avlt)) {
-		int cmp;
-		cmp = avlt->compare(data, current->data);
+	return p;
+}
 
-		#ifndef AVL_DUP
-		if (cmp == 0) {
-			avlt->destroy(current->data);
-			current->data = data;
-			return current; /* updated */
-		}
-		#endif
+/*
+ * free size bytes allocated by avl_alloc
+ */
+void avl_free(avltree *avlt, void *p, size_t size)
+{
+	mem_free(avlt->allocator, p, size);
+	avlt->bytes -= size;
+}
 
-		parent = current;
-		current = (cmp < 0) ? current->left : current->right;
-	}
-	
-	/* replace the termination NIL pointer with the new node pointer */
+/*
+ * copy the tree node for node into one slab, without compares or rotations;
+ * data is copied by copy_func, configuration set on avlt is kept, histograms and the relocate
+ * function, which follows handles to the nodes of avlt, are not
+ * return NULL if out of memory or copy_func returns NULL
+ */
+avltree *avl_clone(avltree *avlt, void *(*copy_func)(void *))
+{
+	avltree *copy;
+	avlslab *slab;
 
-	current = new_node = (avlnode *) malloc(sizeof(avlnode));
-	if (current == NULL)
+	if ((copy = avl_create_with(avlt->compare, avlt->destroy, avlt->allocator)) == NULL)
 		return NULL; /* out of memory */
 
-	current->left = current->right = AVL_NIL(avlt);
-	current->parent = parent;
-	current->bf = 0;
-	current->data = data;
+	copy->arena = avlt->arena;
+	copy->limit = avlt->limit;
+	copy->engine = avlt->engine;
 
-	if (parent == AVL_ROOT(avlt) || avlt->compare(data, parent->data) < 0)
-		parent->left = current;
-	else
-		parent->right = current;
+	#ifdef AVL_PREFIX
+	copy->normalize = avlt->normalize;
+	#endif
 
-	#ifdef AVL_MIN
-	if (avlt->min == NULL || avlt->compare(current->data, avlt->min->data) < 0)
-		avlt->min = current;
+	#ifdef AVL_AUGMENT
+	copy->combine = avlt->combine;
+	copy->nil.aux = avlt->nil.aux;
 	#endif
 
-	/*
-	 * After insertion it is necessary to update the balance factors of all nodes, 
-	 * observe that all nodes requiring correction must be on the path from the root to the new node.
-	 * 
-	 * Backtracking the top-down path from the root to the new node:
-	 * 1. update the balance factor of parent node; 
-	 * 2. rebalance if the balance factor of parent node temporarily becomes +2 or -2 (parent subtree has the same height as before, thus backtracking terminate immediately); 
-	 * 3. terminate if the height of that parent subtree remains unchanged.
-	 */
-	while (current != AVL_FIRST(avlt)) { /* Loop (possibly up to the root) */
-		if (current == parent->left) { /* The height of left subtree of parent subtree increases */
-			if (parent->bf == 1) { /* parent subtree is right-heavy */
-				/*
-				 * height increase of left subtree is absorbed at parent node, 
-				 * height of parent subtree remains unchanged, thus backtracking terminate.
-				 */
-				parent->bf = 0; /* height unchanged, balanced, goto break */
-				break;
-			} else if (parent->bf == 0) { /* parent subtree is balanced */
-				/*
-				 * height of parent subtree increases by one, thus backtracking continue.
-				 */
-				parent->bf = -1; /* height increased, left-heavy, goto loop */
-			} else if (parent->bf == -1) { /* parent subtree is left-heavy */
-				/*
-				 * the balance factor becomes -2, this has to be repaired by an appropriate rotation
-				 * after which parent subtree has the same height as before.
-				 */
-				fix_insert_leftimbalance(avlt, parent); /* height unchanged, balanced, goto break */
-				break;
-			}
-		} else { /* The height of right subtree of parent subtree increases */
-			if (parent->bf == -1) { /* parent subtree is left-heavy */
-				/*
-				 * height increase of right subtree is absorbed at parent node, 
-				 * height of parent subtree remains unchanged, thus backtracking terminate.
-				 */
-				parent->bf = 0; /* height unchanged, balanced, goto break */
-				break;
-			} else if (parent->bf == 0) { /* parent subtree is balanced */
-				/*
-				 * height of parent subtree increases by one, thus backtracking continue.
-				 */
-				parent->bf = 1; /* height increased, right-heavy, goto loop */
-			} else if (parent->bf == 1) {
-				/*
-				 * the balance factor becomes 2, this has to be repaired by an appropriate rotation
-				 * after which parent subtree has the same height as before.
-				 */
-				fix_insert_rightimbalance(avlt, parent); /* height unchanged, balanced, goto break */
-				break;
-			}
+	#ifdef AVL_LAZY
+	copy->lazy = avlt->lazy;
+	#endif
+
+	#ifdef AVL_CACHE
+	if (avlt->hash != NULL && avl_set_cache(copy, avlt->hash, avlt->cache_mask + 1) != 0) {
+		avl_destroy(copy);
+		return NULL; /* out of memory */
+	}
+	#endif
+
+	if (avlt->count > 0) {
+		if ((slab = new_slab(copy, avlt->count)) == NULL) {
+			avl_destroy(copy);
+			return NULL; /* out of memory */
 		}
 
-		/* move up */
-		current = parent;
-		parent = current->parent;
+		copy->root.left = clone(avlt, copy, AVL_FIRST(avlt), AVL_ROOT(copy), slab, copy_func);
+		if (slab->live != avlt->count) {
+			avl_destroy(copy); /* the nodes copied so far */
+			return NULL;
+		}
+		copy->count = avlt->count;
+		#ifdef AVL_LAZY
+		copy->tombstones = avlt->tombstones; /* copied as they are */
+		#endif
 	}
 
-	return new_node;
+	#ifdef AVL_BLOOM
+	/* rebuilt at the same size, without the stale keys */
+	if (avlt->bloom != NULL && avl_set_bloom(copy, avlt->bloom_hash, AVL_BLOOM_CAPACITY(avlt)) != 0) {
+		avl_destroy(copy);
+		return NULL; /* out of memory */
+	}
+	#endif
+
+	return copy;
 }
 
 /*
- * delete node
- * return NULL if keep is zero (already freed)
+ * look up
+ * return NULL if not found
  */
-void *avl_delete(avltree *avlt, avlnode *node, int keep)
+avlnode *avl_find(avltree *avlt, void *data)
 {
-	avlnode *current, *parent;
-	avlnode *target;
-	void *data;
+	avlnode *p;
+	unsigned long long h;
+	HIST_START(avlt);
 
-	data = node->data;
+	if (find_shortcut(avlt, data, &p, &h)) {
+		HIST_RECORD(avlt, avlt->hist, AVL_OP_FIND);
+		return p;
+	}
 
-	/* choose node's in-order successor if it has two children */
+	#ifdef AVL_PREFIX
+	unsigned long long prefix = PREFIX(avlt, data);
+	#endif
+
+	p = AVL_FIRST(avlt);
+
+	while (p != AVL_NIL(avlt)) {
+		int cmp;
+		/* fetch both children while the comparator runs */
+		PREFETCH(p->left);
+		PREFETCH(p->right);
+		cmp = NODE_COMPARE(avlt, data, prefix, p);
+		if (cmp == 0)
+			break; /* found */
+		p = (cmp < 0) ? p->left : p->right;
+	}
+
+	#ifdef AVL_LAZY
+	if (p != AVL_NIL(avlt) && AVL_DEAD(p)) {
+		#ifdef AVL_DUP
+		/* a live duplicate is next to the tombstone in order */
+		avlnode *q;
+		for (q = predecessor(avlt, p); q != NULL && AVL_DEAD(q) && COMPARE(avlt, data, q->data) == 0; q = predecessor(avlt, q)) ;
+		if (q == NULL || AVL_DEAD(q) || COMPARE(avlt, data, q->data) != 0)
+			for (q = successor(avlt, p); q != NULL && AVL_DEAD(q) && COMPARE(avlt, data, q->data) == 0; q = successor(avlt, q)) ;
+		p = (q != NULL && !AVL_DEAD(q) && COMPARE(avlt, data, q->data) == 0) ? q : AVL_NIL(avlt);
+		#else
+		p = AVL_NIL(avlt); /* deleted */
+		#endif
+	}
+	#endif
+
+	#ifdef AVL_CACHE
+	if (avlt->cache != NULL && p != AVL_NIL(avlt))
+		cache_fill(avlt, p, h);
+	#endif
+
+	HIST_RECORD(avlt, avlt->hist, AVL_OP_FIND);
+
+	return (p != AVL_NIL(avlt)) ? p : NULL; /* NULL if not found */
+}
+
+/*
+ * look up n keys at once
+ * keeps AVL_BATCH independent searches in flight and advances them in turn, so the cache misses
+ * of one search overlap with the work of the others: each step either prefetches the data of a node
+ * (whose node has been prefetched one round earlier) or compares and prefetches the next node
+ * keys ruled out by the Bloom filter or found in the cache never take a slot
+ * out[i] is NULL if data[i] is not found
+ * return the number of keys found
+ */
+int avl_find_batch(avltree *avlt, void **data, int n, avlnode **out)
+{
+	struct {
+		int i; /* index of key, -1 if slot idle */
+		int loaded; /* node->data prefetched */
+		avlnode *p;
+		unsigned long long h; /* hash of key for the cache */
+		#ifdef AVL_PREFIX
+		unsigned long long prefix;
+		#endif
+	} slot[AVL_BATCH];
+	int next, active, found;
+	int s;
+	HIST_START(avlt);
+
+	next = 0;
+	active = 0;
+	found = 0;
+
+	for (s = 0; s < AVL_BATCH; s++) {
+		for (; next < n && find_shortcut(avlt, data[next], &out[next], &slot[s].h); next++)
+			found += (out[next] != NULL);
+		if (next < n) {
+			slot[s].i = next++;
+			slot[s].p = AVL_FIRST(avlt);
+			slot[s].loaded = 0;
+			#ifdef AVL_PREFIX
+			slot[s].prefix = PREFIX(avlt, data[slot[s].i]);
+			#endif
+			PREFETCH(slot[s].p);
+			active++;
+		} else {
+			slot[s].i = -1;
+		}
+	}
+
+	while (active > 0) {
+		for (s = 0; s < AVL_BATCH; s++) {
+			avlnode *p;
+			int cmp;
+
+			if (slot[s].i < 0)
+				continue;
+
+			p = slot[s].p;
+
+			if (p != AVL_NIL(avlt) && !slot[s].loaded) {
+				PREFETCH(p->data);
+				slot[s].loaded = 1;
+				continue;
+			}
+
+			if (p != AVL_NIL(avlt)) {
+				cmp = NODE_COMPARE(avlt, data[slot[s].i], slot[s].prefix, p);
+				if (cmp != 0) {
+					slot[s].p = (cmp < 0) ? p->left : p->right;
+					slot[s].loaded = 0;
+					PREFETCH(slot[s].p);
+					continue;
+				}
+				found++;
+			}
+
+			/* search finished, start the next key in this slot */
+			out[slot[s].i] = (p != AVL_NIL(avlt)) ? p : NULL;
+
+			#ifdef AVL_CACHE
+			if (avlt->cache != NULL && p != AVL_NIL(avlt) && !AVL_DEAD(p))
+				cache_fill(avlt, p, slot[s].h);
+			#endif
+
+			for (; next < n && find_shortcut(avlt, data[next], &out[next], &slot[s].h); next++)
+				found += (out[next] != NULL);
+			if (next < n) {
+				slot[s].i = next++;
+				slot[s].p = AVL_FIRST(avlt);
+				slot[s].loaded = 0;
+				#ifdef AVL_PREFIX
+				slot[s].prefix = PREFIX(avlt, data[slot[s].i]);
+				#endif
+				PREFETCH(slot[s].p);
+			} else {
+				slot[s].i = -1;
+				active--;
+			}
+		}
+	}
+
+	#ifdef AVL_LAZY
+	/* a search ending on a tombstone is looked up again */
+	int i;
+	for (i = 0; avlt->tombstones > 0 && i < n; i++) {
+		if (out[i] != NULL && AVL_DEAD(out[i]) && (out[i] = avl_find(avlt, data[i])) == NULL)
+			found--;
+	}
+	#endif
+
+	HIST_RECORD(avlt, avlt->hist, AVL_OP_FIND);
+
+	return found;
+}
+
+/*
+ * next larger, tombstones are skipped
+ * return NULL if not found
+ */
+avlnode *avl_successor(avltree *avlt, avlnode *node)
+{
+	while ((node = successor(avlt, node)) != NULL && AVL_DEAD(node)) ;
+
+	return node;
+}
+
+/*
+ * apply func
+ * return non-zero if error
+ */
+int avl_apply(avltree *avlt, avlnode *node, int (*func)(void *, void *), void *cookie, enum avltraversal order)
+{
+	int err;
+
+	if (node != AVL_NIL(avlt)) {
+		int live = !AVL_DEAD(node); /* tombstones are skipped */
+		if (live && order == PREORDER && (err = func(node->data, cookie)) != 0) /* preorder */
+			return err;
+		if ((err = avl_apply(avlt, node->left, func, cookie, order)) != 0) /* left */
+			return err;
+		if (live && order == INORDER && (err = func(node->data, cookie)) != 0) /* inorder */
+			return err;
+		if ((err = avl_apply(avlt, node->right, func, cookie, order)) != 0) /* right */
+			return err;
+		if (live && order == POSTORDER && (err = func(node->data, cookie)) != 0) /* postorder */
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * print tree
+ */
+void avl_print(avltree *avlt, void (*print_func)(void *))
+{
+	printf("\n--\n");
+	print(avlt, AVL_FIRST(avlt), print_func, 0, "T");
+	printf("\nheight = %d\n", WAVL(avlt) ? check_rank(avlt, AVL_FIRST(avlt)) : check_height(avlt, AVL_FIRST(avlt)));
+}
+
+/*
+ * relocate all nodes into one contiguous slab
+ * the top COMPACT_TOP levels are laid out breadth-first, each subtree below them in preorder,
+ * so a search touches few pages and neighbouring nodes of a subtree share cache lines
+ * nodes keep their data, balance factors and shape; pointers to nodes are invalidated,
+ * each moved node is reported to the relocate function if one is set, see avl_set_relocate()
+ * return non-zero if out of memory (the tree is unchanged)
+ */
+int avl_compact(avltree *avlt)
+{
+	avlslab *slab;
+	avlnode **cur, **next, **tmp, *x;
+	avlnode *stack[MAX_HEIGHT + 1];
+	unsigned long ncur, nnext, i;
+	int depth, top;
+
+	if (avlt->count == 0)
+		return 0;
+
+	if ((slab = new_slab(avlt, avlt->count)) == NULL)
+		return 1; /* out of memory */
+
+	cur = (avlnode **) malloc(2 * (1UL << COMPACT_TOP) * sizeof(avlnode *));
+	if (cur == NULL) {
+		release_slab(avlt, slab);
+		return 1; /* out of memory */
+	}
+	next = cur + (1UL << COMPACT_TOP);
+
+	if (avlt->compact != NULL) { /* abandon an incremental compaction */
+		if (avlt->compact->live == 0)
+			release_slab(avlt, avlt->compact);
+		avlt->compact = NULL;
+		avlt->cursor = NULL;
+	}
+
+	/* breadth-first */
+	cur[0] = AVL_FIRST(avlt);
+	ncur = 1;
+	for (depth = 0; depth < COMPACT_TOP && ncur > 0; depth++) {
+		for (i = 0, nnext = 0; i < ncur; i++) {
+			x = move_node(avlt, cur[i], slab);
+			if (x->left != AVL_NIL(avlt))
+				next[nnext++] = x->left;
+			if (x->right != AVL_NIL(avlt))
+				next[nnext++] = x->right;
+		}
+		tmp = cur, cur = next, next = tmp;
+		ncur = nnext;
+	}
+
+	/* subtree-clustered */
+	for (i = 0; i < ncur; i++) {
+		top = 0;
+		stack[top++] = cur[i];
+		while (top > 0) {
+			x = move_node(avlt, stack[--top], slab);
+			if (x->right != AVL_NIL(avlt))
+				stack[top++] = x->right;
+			if (x->left != AVL_NIL(avlt))
+				stack[top++] = x->left;
+		}
+	}
+
+	free(cur < next ? cur : next);
+	return 0;
+}
+
+/*
+ * relocate at most budget nodes, in key order, into one contiguous slab
+ * the tree stays usable between steps, but as with avl_compact pointers to the nodes moved by a step
+ * are invalidated and the moved nodes are reported to the relocate function if one is set;
+ * nodes inserted behind the cursor are not relocated
+ * return 1 if more work remains, 0 if done, -1 if out of memory
+ */
+int avl_compact_step(avltree *avlt, unsigned long budget)
+{
+	avlnode *next;
+	avlslab *slab;
+
+	if (avlt->compact == NULL) {
+		if (avlt->count == 0)
+			return 0;
+		if ((avlt->compact = new_slab(avlt, avlt->count)) == NULL)
+			return -1; /* out of memory */
+		avlt->cursor = NULL;
+	}
+
+	for ( ; budget > 0; budget--) {
+		if (avlt->cursor == NULL) {
+			for (next = AVL_FIRST(avlt); next != AVL_NIL(avlt) && next->left != AVL_NIL(avlt); next = next->left) ;
+			if (next == AVL_NIL(avlt))
+				next = NULL;
+		} else {
+			next = successor(avlt, avlt->cursor);
+		}
+
+		if (next == NULL || avlt->compact->used == avlt->compact->size) { /* done */
+			slab = avlt->compact;
+			avlt->compact = NULL;
+			avlt->cursor = NULL;
+			if (slab->live == 0)
+				release_slab(avlt, slab);
+			return 0;
+		}
+
+		if (!IN_SLAB(avlt->compact, next))
+			next = move_node(avlt, next, avlt->compact);
+		avlt->cursor = next;
+	}
+
+	return 1;
+}
+
+/*
+ * report tree shape and operation counters
+ */
+void avl_stats(avltree *avlt, avlstats *stats)
+{
+	stats->height = WAVL(avlt) ? check_rank(avlt, AVL_FIRST(avlt)) : check_height(avlt, AVL_FIRST(avlt));
+	stats->count = 0;
+	stats->leaves = 0;
+	stats->avg_leaf_depth = 0;
+
+	shape(avlt, AVL_FIRST(avlt), 1, stats);
+
+	if (stats->leaves > 0)
+		stats->avg_leaf_depth /= stats->leaves;
+
+	avlslab *slab;
+	unsigned long pooled = 0;
+
+	stats->memory = sizeof(avltree);
+	for (slab = avlt->slabs; slab != NULL; slab = slab->next) {
+		stats->memory += sizeof(avlslab) + slab->size * sizeof(avlnode);
+		pooled += slab->live;
+	}
+	stats->memory += (stats->count - pooled) * sizeof(avlnode);
+
+	#ifdef AVL_STATS
+	stats->counters = avlt->counters;
+	#else
+	memset(&stats->counters, 0, sizeof(stats->counters));
+	#endif
+
+	#ifdef AVL_BLOOM
+	if (avlt->bloom != NULL)
+		stats->memory += (avlt->bloom_mask + 1) * BLOOM_WORDS * sizeof(unsigned long long);
+	#endif
+
+	#ifdef AVL_CACHE
+	if (avlt->cache != NULL)
+		stats->memory += (avlt->cache_mask + 1) * sizeof(avlcacheset);
+	stats->cache_hits = avlt->cache_hits;
+	stats->cache_misses = avlt->cache_misses;
+	#else
+	stats->cache_hits = stats->cache_misses = 0;
+	#endif
+}
+
+/*
+ * reset operation counters
+ */
+void avl_reset_counters(avltree *avlt)
+{
+	#if !defined(AVL_STATS) && !defined(AVL_CACHE)
+	(void) avlt;
+	#endif
+
+	#ifdef AVL_STATS
+	memset(&avlt->counters, 0, sizeof(avlt->counters));
+	#endif
+
+	#ifdef AVL_CACHE
+	avlt->cache_hits = avlt->cache_misses = 0;
+	#endif
+}
+
+#ifdef AVL_HIST
+/*
+ * time operations into hist[AVL_NOPS], or stop timing if hist is NULL
+ */
+void avl_set_hist(avltree *avlt, avlhist *hist)
+{
+	avlt->hist = hist;
+}
+#endif
+
+#ifdef AVL_PREFIX
+/*
+ * set the key normalizer, NULL to turn it off; prefixes of present nodes are recomputed
+ * normalize_func must preserve order: compare(a, b) <= 0 implies normalize(a) <= normalize(b),
+ * so keys that compare equal have equal prefixes
+ */
+void avl_set_normalizer(avltree *avlt, unsigned long long (*normalize_func)(const void *))
+{
+	avlt->normalize = normalize_func;
+	renormalize(avlt, AVL_FIRST(avlt));
+}
+
+/*
+ * order-preserving prefix of a byte string (memcmp order), for use in a normalizer
+ * the first 8 bytes big-endian, zero padded
+ */
+unsigned long long avl_prefix(const void *key, unsigned long len)
+{
+	const unsigned char *p = (const unsigned char *) key;
+	unsigned long long prefix = 0;
+	unsigned long i;
+
+	for (i = 0; i < 8; i++)
+		prefix = (prefix << 8) | ((i < len) ? p[i] : 0);
+
+	return prefix;
+}
+#endif
+
+#ifdef AVL_AUGMENT
+/*
+ * set the function computing the aggregate of a node from those of its children, NULL to turn it off;
+ * identity is the aggregate of an empty subtree; aggregates of present nodes are recomputed
+ */
+void avl_set_augment(avltree *avlt, void (*combine_func)(avlaux *, const avlaux *, const avlnode *, const avlaux *), \
+	const avlaux *identity)
+{
+	#ifdef AVL_LAZY
+	avl_purge(avlt); /* aggregates would include the tombstones */
+	#endif
+
+	avlt->combine = combine_func;
+	if (combine_func != NULL) {
+		avlt->nil.aux = *identity;
+		augment_all(avlt, AVL_FIRST(avlt));
+	}
+}
+
+/*
+ * aggregate of the nodes with lo <= key < hi, in O(log n); lo or hi may be NULL for no bound
+ * the identity if the range is empty
+ */
+void avl_aggregate(avltree *avlt, void *lo, void *hi, avlaux *result)
+{
+	aggregate(avlt, AVL_FIRST(avlt), lo, hi, result);
+}
+#endif
+
+#ifdef AVL_INTERVAL
+/*
+ * order intervals by start, then by end
+ */
+int avl_interval_compare(const void *d1, const void *d2)
+{
+	const avlinterval *p1 = (const avlinterval *) d1;
+	const avlinterval *p2 = (const avlinterval *) d2;
+
+	if (p1->lo != p2->lo)
+		return (p1->lo < p2->lo) ? -1 : 1;
+	if (p1->hi != p2->hi)
+		return (p1->hi < p2->hi) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * make avlt an interval tree, data must start with an avlinterval
+ * and the tree must be ordered by start first, as by avl_interval_compare
+ */
+void avl_set_interval(avltree *avlt)
+{
+	avlaux identity;
+
+	identity.i[0] = LLONG_MIN; /* maximal end of an empty subtree */
+	avl_set_augment(avlt, interval_combine, &identity);
+}
+
+/*
+ * apply func to the data of every interval overlapping [lo, hi], by start, in O(log n + k)
+ * return non-zero if error
+ */
+int avl_overlap(avltree *avlt, long long lo, long long hi, int (*func)(void *, void *), void *cookie)
+{
+	return overlap(avlt, AVL_FIRST(avlt), lo, hi, func, cookie);
+}
+#endif
+
+#ifdef AVL_CACHE
+/*
+ * cache up to sets * AVL_CACHE_WAYS found nodes, by the hash of their keys, in front of avl_find;
+ * sets is rounded up to a power of two, and a hash_func of NULL drops the cache
+ * return non-zero if out of memory (the tree is not cached)
+ */
+int avl_set_cache(avltree *avlt, unsigned long long (*hash_func)(const void *), unsigned long sets)
+{
+	unsigned long n;
+
+	if (avlt->cache != NULL)
+		mem_free(avlt->allocator, avlt->cache, (avlt->cache_mask + 1) * sizeof(avlcacheset));
+	avlt->hash = NULL;
+	avlt->cache = NULL;
+	avlt->cache_mask = 0;
+
+	if (hash_func == NULL)
+		return 0;
+
+	for (n = 1; n < sets && n < (1UL << 31); n <<= 1) ;
+	if ((avlt->cache = (avlcacheset *) mem_alloc(avlt->allocator, n * sizeof(avlcacheset), 1)) == NULL)
+		return 1; /* out of memory */
+	memset(avlt->cache, 0, n * sizeof(avlcacheset));
+
+	avlt->hash = hash_func;
+	avlt->cache_mask = n - 1;
+
+	return 0;
+}
+#endif
+
+#ifdef AVL_BLOOM
+/*
+ * filter lookups by a blocked Bloom filter of AVL_BLOOM_BITS bits per key for capacity keys,
+ * or for the present keys if capacity is 0, built from them; avl_find of a key not in the filter
+ * returns at once. deleted keys stay in the filter, call again to rebuild it once bloom_stale is high
+ * a hash_func of NULL drops the filter
+ * return non-zero if out of memory (the tree is not filtered)
+ */
+int avl_set_bloom(avltree *avlt, unsigned long long (*hash_func)(const void *), unsigned long capacity)
+{
+	avlnode *p;
+	unsigned long n;
+
+	if (avlt->bloom != NULL)
+		mem_free(avlt->allocator, avlt->bloom, (avlt->bloom_mask + 1) * BLOOM_WORDS * sizeof(unsigned long long));
+	avlt->bloom_hash = NULL;
+	avlt->bloom = NULL;
+	avlt->bloom_mask = 0;
+	avlt->bloom_stale = 0;
+
+	if (hash_func == NULL)
+		return 0;
+
+	if (capacity == 0)
+		capacity = AVL_COUNT(avlt);
+	for (n = 1; n * BLOOM_WORDS * 64 < capacity * AVL_BLOOM_BITS && n < (1UL << 40); n <<= 1) ;
+	avlt->bloom = (unsigned long long *) mem_alloc(avlt->allocator, n * BLOOM_WORDS * sizeof(unsigned long long), 1);
+	if (avlt->bloom == NULL)
+		return 1; /* out of memory */
+	memset(avlt->bloom, 0, n * BLOOM_WORDS * sizeof(unsigned long long));
+
+	avlt->bloom_hash = hash_func;
+	avlt->bloom_mask = n - 1;
+
+	for (p = AVL_FIRST(avlt); p != AVL_NIL(avlt) && p->left != AVL_NIL(avlt); p = p->left) ;
+	for ( ; p != NULL && p != AVL_NIL(avlt); p = successor(avlt, p)) {
+		if (!AVL_DEAD(p))
+			bloom_add(avlt, hash_func(p->data));
+	}
+
+	return 0;
+}
+#endif
+
+#ifdef AVL_LAZY
+/*
+ * delete lazily: avl_delete only marks a node as a tombstone, skipped by lookups and iteration,
+ * and the tombstones are purged together once they exceed fraction of the nodes;
+ * with a fraction of 1 or more they are purged only by avl_purge, with 0 at once again
+ */
+void avl_set_lazy(avltree *avlt, double fraction)
+{
+	avlt->lazy = fraction;
+	if (fraction <= 0)
+		avl_purge(avlt);
+}
+
+/*
+ * unlink all tombstones and destroy their data
+ * the live nodes are relinked into a balanced tree in O(n), without compares or rotations,
+ * pointers to them stay valid; if out of memory the tombstones are deleted one by one
+ */
+void avl_purge(avltree *avlt)
+{
+	avlnode **nodes;
+	avlnode *p, *next;
+	unsigned long n;
+	int h;
+
+	if (avlt->tombstones == 0)
+		return;
+
+	n = avlt->count - avlt->tombstones;
+	if ((nodes = (avlnode **) malloc((n ? n : 1) * sizeof(avlnode *))) == NULL) {
+		for (p = AVL_FIRST(avlt); p->left != AVL_NIL(avlt); p = p->left) ;
+		for ( ; p != NULL; p = next) {
+			next = successor(avlt, p); /* nodes other than p stay where they are */
+			if (AVL_DEAD(p))
+				avl_delete(avlt, p, 0);
+		}
+		return;
+	}
+
+	gather(avlt, AVL_FIRST(avlt), nodes, 0);
+
+	AVL_FIRST(avlt) = rebuild(avlt, nodes, n, AVL_ROOT(avlt), &h);
+	avlt->count = n;
+	avlt->tombstones = 0;
+
+	#ifdef AVL_MIN
+	avlt->min = (n > 0) ? nodes[0] : NULL;
+	#endif
+
+	free(nodes);
+}
+#endif
+
+/*
+ * check order of tree
+ */
+int avl_check_order(avltree *avlt, void *min, void *max)
+{
+	return check_order(avlt, AVL_FIRST(avlt), min, max);
+}
+
+/*
+ * check height of tree
+ */
+int avl_check_height(avltree *avlt)
+{
+	int height;
+	height = WAVL(avlt) ? check_rank(avlt, AVL_FIRST(avlt)) : check_height(avlt, AVL_FIRST(avlt));
+
+	return (height < 0) ? 0 : 1;
+}
+
+/*
+ * insert (or update) data
+ * return NULL if out of memory
+ */
+avlnode *avl_insert(avltree *avlt, void *data)
+{
+	avlnode *current, *parent;
+	avlnode *new_node;
+	HIST_START(avlt);
+
+	BLOOM_ADD(avlt, data);
+
+	#ifdef AVL_PREFIX
+	unsigned long long prefix = PREFIX(avlt, data);
+	#endif
+
+	/* do a binary search to find where it should be */
+
+	current = AVL_FIRST(avlt);
+	parent = AVL_ROOT(avlt);
+
+	while (current != AVL_NIL(avlt)) {
+		int cmp;
+		cmp = NODE_COMPARE(avlt, data, prefix, current);
+
+		#ifdef AVL_MULTISET
+		if (cmp == 0) {
+			#ifdef AVL_LAZY
+			if (AVL_DEAD(current)) {
+				avlt->destroy(current->data);
+				current->data = data;
+				revive(avlt, current);
+				HIST_RECORD(avlt, avlt->hist, AVL_OP_INSERT);
+				return current; /* counted again */
+			}
+			#endif
+			if (!bucket_push(avlt, current, data, 1))
+				current = NULL; /* out of memory or over the limit */
+			else
+				AUGMENT_PATH(avlt, current);
+			HIST_RECORD(avlt, avlt->hist, AVL_OP_INSERT);
+			return current; /* counted */
+		}
+		#elif !defined(AVL_DUP)
+		if (cmp == 0) {
+			avlt->destroy(current->data);
+			current->data = data;
+			#ifdef AVL_LAZY
+			if (AVL_DEAD(current))
+				revive(avlt, current);
+			#endif
+			AUGMENT_PATH(avlt, current);
+			HIST_RECORD(avlt, avlt->hist, AVL_OP_INSERT);
+			return current; /* updated */
+		}
+		#endif
+
+		parent = current;
+		current = (cmp < 0) ? current->left : current->right;
+	}
+	
+	/* replace the termination NIL pointer with the new node pointer */
+
+	current = new_node = alloc_node(avlt);
+	if (current == NULL) {
+		HIST_RECORD(avlt, avlt->hist, AVL_OP_INSERT);
+		return NULL; /* out of memory or over the limit */
+	}
+
+	avlt->count++;
+
+	current->flags = 0;
+	#ifdef AVL_CACHE
+	current->cached = 0;
+	#endif
+	current->data = data;
+	#ifdef AVL_MULTISET
+	current->bucket = NULL;
+	#endif
+	#ifdef AVL_PREFIX
+	current->prefix = prefix;
+	#endif
+
+	link_node(avlt, current, parent);
+
+	HIST_RECORD(avlt, avlt->hist, AVL_OP_INSERT);
+
+	return new_node;
+}
+
+/*
+ * delete node
+ * return NULL if keep is zero (already freed)
+ * in multiset mode the other values of node are destroyed regardless of keep
+ * in lazy mode a node deleted with keep zero is only marked, its data is destroyed by the purge
+ * the other nodes stay where they are: handles to them stay valid until they are deleted,
+ * except across avl_compact and avl_compact_step, which move them (see avl_set_relocate())
+ */
+void *avl_delete(avltree *avlt, avlnode *node, int keep)
+{
+	void *data;
+	HIST_START(avlt);
+
+	BLOOM_STALE(avlt, 1);
+
+	#ifdef AVL_LAZY
+	if (keep == 0 && LAZY(avlt) && !AVL_DEAD(node)) {
+		#ifdef AVL_MULTISET
+		bucket_destroy(avlt, node);
+		#endif
+		node->flags |= AVL_TOMBSTONE; /* the data stays as the key until purged */
+		avlt->tombstones++;
+		#ifdef AVL_CACHE
+		cache_replace(avlt, node, NULL);
+		#endif
+
+		#ifdef AVL_MIN
+		if (avlt->min == node)
+			avlt->min = avl_successor(avlt, node);
+		#endif
+
+		if (avlt->tombstones > avlt->lazy * avlt->count)
+			avl_purge(avlt);
+
+		HIST_RECORD(avlt, avlt->hist, AVL_OP_DELETE);
+		return NULL;
+	}
+	#endif
+
+	data = node->data;
+
+	#ifdef AVL_MULTISET
+	bucket_destroy(avlt, node); /* the other values of node go with it */
+	#endif
+
+	unlink_node(avlt, node);
+
+	#ifdef AVL_LAZY
+	if (AVL_DEAD(node))
+		avlt->tombstones--;
+	#endif
+
+	free_node(avlt, node);
+
+	avlt->count--;
+
+	/* keep or discard data */
+
+	if (keep == 0) {
+		avlt->destroy(data);
+		data = NULL; /* freed */
+	}
+
+	HIST_RECORD(avlt, avlt->hist, AVL_OP_DELETE);
+
+	return data;
+}
+
+/*
+ * move node to its place after the key of its data was changed, in O(log n),
+ * without freeing or allocating; node handles stay valid (compaction aside, see avl_delete)
+ * unless AVL_DUP is defined, no other live node may have the new key,
+ * a tombstone with the new key is purged
+ */
+void avl_reposition(avltree *avlt, avlnode *node)
+{
+	avlnode *current, *parent;
+	int cmp;
+
+	#ifdef AVL_PREFIX
+	node->prefix = PREFIX(avlt, node->data);
+	#endif
+
+	BLOOM_ADD(avlt, node->data);
+	BLOOM_STALE(avlt, 1); /* the old key */
+
+	unlink_node(avlt, node);
+
+	current = AVL_FIRST(avlt);
+	parent = AVL_ROOT(avlt);
+	while (current != AVL_NIL(avlt)) {
+		cmp = NODE_COMPARE(avlt, node->data, node->prefix, current);
+		#if defined(AVL_LAZY) && !defined(AVL_DUP)
+		if (cmp == 0 && AVL_DEAD(current)) {
+			avl_delete(avlt, current, 0); /* unlinked at once, a tombstone already */
+			current = AVL_FIRST(avlt);
+			parent = AVL_ROOT(avlt);
+			continue;
+		}
+		#endif
+		parent = current;
+		current = (cmp < 0) ? current->left : current->right;
+	}
+
+	link_node(avlt, node, parent);
+}
+
+#ifdef AVL_MULTISET
+/*
+ * number of values with a key equal to data
+ */
+unsigned long avl_count(avltree *avlt, void *data)
+{
+	avlnode *node;
+
+	if ((node = avl_find(avlt, data)) == NULL)
+		return 0;
+
+	return 1 + (node->bucket ? node->bucket->count : 0);
+}
+
+/*
+ * destroy the most recently inserted value with a key equal to data,
+ * the node goes with its last value
+ * return 1 if erased, 0 if not found
+ */
+int avl_erase_one(avltree *avlt, void *data)
+{
+	avlnode *node;
+
+	if ((node = avl_find(avlt, data)) == NULL)
+		return 0;
+
+	if (node->bucket != NULL && node->bucket->count > 0) {
+		avlt->destroy(node->bucket->data[--node->bucket->count]);
+		if (node->bucket->count == 0)
+			bucket_free(avlt, node);
+		AUGMENT_PATH(avlt, node);
+	} else {
+		avl_delete(avlt, node, 0);
+	}
+
+	return 1;
+}
+
+/*
+ * destroy all values with a key equal to data
+ * return the number of values erased
+ */
+unsigned long avl_erase_all(avltree *avlt, void *data)
+{
+	avlnode *node;
+	unsigned long count;
+
+	if ((node = avl_find(avlt, data)) == NULL)
+		return 0;
+
+	count = 1 + (node->bucket ? node->bucket->count : 0);
+	avl_delete(avlt, node, 0);
+
+	return count;
+}
+#endif
+
+/*
+ * delete the node with a key equal to data and destroy its data, searching and deleting in one call
+ * return 1 if erased, 0 if not found
+ */
+int avl_erase(avltree *avlt, void *data)
+{
+	avlnode *p;
+	int cmp;
+
+	#ifdef AVL_PREFIX
+	unsigned long long prefix = PREFIX(avlt, data);
+	#endif
+
+	for (p = AVL_FIRST(avlt); p != AVL_NIL(avlt); p = (cmp < 0) ? p->left : p->right) {
+		if ((cmp = NODE_COMPARE(avlt, data, prefix, p)) == 0) {
+			#ifdef AVL_LAZY
+			if (AVL_DEAD(p) && (p = avl_find(avlt, data)) == NULL)
+				return 0;
+			#endif
+			avl_delete(avlt, p, 0); /* the successor, if needed, is below p */
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * delete the nodes with lo <= key < hi and destroy their data, lo or hi may be NULL for no bound
+ * the tree is split around the range and the rest joined again, in O(k + log n) for k nodes
+ * return the number of values erased
+ */
+unsigned long avl_erase_range(avltree *avlt, void *lo, void *hi)
+{
+	return range(avlt, lo, hi, NULL, NULL);
+}
+
+/*
+ * as avl_erase_range, but the data is passed to func in key order instead of destroyed;
+ * func runs once the rest of the tree is joined, it may look the tree up but not modify it
+ * return the number of values taken
+ */
+unsigned long avl_take_range(avltree *avlt, void *lo, void *hi, void (*func)(void *, void *), void *cookie)
+{
+	return range(avlt, lo, hi, func, cookie);
+}
+
+/*
+ * rotate left about x
+ * return the new root
+ */
+avlnode *rotate_left(avltree *avlt, avlnode *x)
+{
+	avlnode *y;
+
+	y = x->right; /* child */
+
+	/* tree x */
+	x->right = y->left;
+	if (x->right != AVL_NIL(avlt))
+		x->right->parent = x;
+
+	/* tree y */
+	y->parent = x->parent;
+	if (x == x->parent->left)
+		x->parent->left = y;
+	else
+		x->parent->right = y;
+
+	/* assemble tree x and tree y */
+	y->left = x;
+	x->parent = y;
+
+	AUGMENT_ROTATION(avlt, x, y);
+
+	return y;
+}
+
+/*
+ * rotate right about x
+ * return the new root
+ */
+avlnode *rotate_right(avltree *avlt, avlnode *x)
+{
+	avlnode *y;
+
+	y = x->left; /* child */
+
+	/* tree x */
+	x->left = y->right;
+	if (x->left != AVL_NIL(avlt))
+		x->left->parent = x;
+
+	/* tree y */
+	y->parent = x->parent;
+	if (x == x->parent->left)
+		x->parent->left = y;
+	else
+		x->parent->right = y;
+
+	/* assemble tree x and tree y */
+	y->right = x;
+	x->parent = y;
+
+	AUGMENT_ROTATION(avlt, x, y);
+
+	return y;
+}
+
+/*
+ * fix left imbalance after insertion
+ * return the new root
+ */
+avlnode *fix_insert_leftimbalance(avltree *avlt, avlnode *p)
+{
+	/* p->left->bf updated here */
+
+	if (p->left->bf == p->bf) { /* -1, -1 */
+		STAT_INC(avlt, insert_single_rotations);
+		p = rotate_right(avlt, p);
+		p->bf = p->right->bf = 0;
+	} else { /* 1, -1 */
+		int oldbf;
+		STAT_INC(avlt, insert_double_rotations);
+		oldbf = p->left->right->bf;
+		rotate_left(avlt, p->left);
+		p = rotate_right(avlt, p);
+		p->bf = 0;
+		if (oldbf == -1) {
+			p->left->bf = 0;
+			p->right->bf = 1;
+		} else if (oldbf == 1) {
+			p->left->bf = -1;
+			p->right->bf = 0;
+		} else if (oldbf == 0) {
+			p->left->bf = p->right->bf = 0;
+		}
+	}
+	return p;
+}
+
+/*
+ * fix right imbalance after insertion
+ * return the new root
+ */
+avlnode *fix_insert_rightimbalance(avltree *avlt, avlnode *p)
+{
+	if (p->right->bf == p->bf) { /* 1, 1 */
+		STAT_INC(avlt, insert_single_rotations);
+		p = rotate_left(avlt, p);
+		p->bf = p->left->bf = 0;
+	} else { /* -1, 1 */
+		int oldbf;
+		STAT_INC(avlt, insert_double_rotations);
+		oldbf = p->right->left->bf;
+		rotate_right(avlt, p->right);
+		p = rotate_left(avlt, p);
+		p->bf = 0;
+		if (oldbf == -1) {
+			p->left->bf = 0;
+			p->right->bf = 1;
+		} else if (oldbf == 1) {
+			p->left->bf = -1;
+			p->right->bf = 0;
+		} else if (oldbf == 0) {
+			p->left->bf = p->right->bf = 0;
+		}
+	}
+	return p;
+}
+
+/*
+ * fix left imbalance after deletion
+ * return the new root
+ */
+avlnode *fix_delete_leftimbalance(avltree *avlt, avlnode *p)
+{
+	if (p->left->bf == -1) {
+		STAT_INC(avlt, delete_single_rotations);
+		p = rotate_right(avlt, p);
+		p->bf = p->right->bf = 0;
+	} else if (p->left->bf == 0) {
+		STAT_INC(avlt, delete_single_rotations);
+		p = rotate_right(avlt, p);
+		p->bf = 1;
+		p->right->bf = -1;
+	} else if (p->left->bf == 1) {
+		int oldbf;
+		STAT_INC(avlt, delete_double_rotations);
+		oldbf = p->left->right->bf;
+		rotate_left(avlt, p->left);
+		p = rotate_right(avlt, p);
+		p->bf = 0;
+		if (oldbf == -1) {
+			p->left->bf = 0;
+			p->right->bf = 1;
+		} else if (oldbf == 1) {
+			p->left->bf = -1;
+			p->right->bf = 0;
+		} else if (oldbf == 0) {
+			p->left->bf = p->right->bf = 0;
+		}
+	}
+	return p;
+}
+
+/*
+ * fix right imbalance after deletion
+ * return the new root
+ */
+avlnode *fix_delete_rightimbalance(avltree *avlt, avlnode *p)
+{
+	if (p->right->bf == 1) {
+		STAT_INC(avlt, delete_single_rotations);
+		p = rotate_left(avlt, p);
+		p->bf = p->left->bf = 0;
+	} else if (p->right->bf == 0) {
+		STAT_INC(avlt, delete_single_rotations);
+		p = rotate_left(avlt, p);
+		p->bf = -1;
+		p->left->bf = 1;
+	} else if (p->right->bf == -1) {
+		int oldbf;
+		STAT_INC(avlt, delete_double_rotations);
+		oldbf = p->right->left->bf;
+		rotate_right(avlt, p->right);
+		p = rotate_left(avlt, p);
+		p->bf = 0;
+		if (oldbf == -1) {
+			p->left->bf = 0;
+			p->right->bf = 1;
+		} else if (oldbf == 1) {
+			p->left->bf = -1;
+			p->right->bf = 0;
+		} else if (oldbf == 0) {
+			p->left->bf = p->right->bf = 0;
+		}
+	}
+	return p;
+}
+
+/*
+ * check order recursively
+ */
+int check_order(avltree *avlt, avlnode *n, void *min, void *max)
+{
+	if (n == AVL_NIL(avlt))
+		return 1;
+
+	#ifdef AVL_DUP
+	if (avlt->compare(n->data, min) < 0 || avlt->compare(n->data, max) > 0)
+	#else
+	if (avlt->compare(n->data, min) <= 0 || avlt->compare(n->data, max) >= 0)
+	#endif
+		return 0;
+
+	return check_order(avlt, n->left, min, n->data) && check_order(avlt, n->right, n->data, max);
+}
+
+/*
+ * check height recursively
+ */
+int check_height(avltree *avlt, avlnode *n)
+{
+	int lh, rh, cmp;
+
+	if (n == AVL_NIL(avlt))
+		return 0;
+
+	lh = check_height(avlt, n->left);
+	if (lh < 0)
+		return lh;
+	
+	rh = check_height(avlt, n->right);
+	if (rh < 0)
+		return rh;
+	
+	cmp = rh - lh;
+	if (cmp < -1 || cmp > 1 || cmp != n->bf) /* check recomputed/cached balance factor */
+		return -1;
 	
-	if (node->left == AVL_NIL(avlt) || node->right == AVL_NIL(avlt)) {
-		target = node;
+	return 1 + ((lh > rh) ? lh : rh);
+}
+
+/*
+ * check the rank rule recursively
+ * return the height of n, -1 if a rank difference is not 1 or 2 or a leaf does not rank 0
+ */
+int check_rank(avltree *avlt, avlnode *n)
+{
+	int lh, rh, r;
+
+	if (n == AVL_NIL(avlt))
+		return 0;
+
+	if ((lh = check_rank(avlt, n->left)) < 0 || (rh = check_rank(avlt, n->right)) < 0)
+		return -1;
+
+	r = RANK(avlt, n);
+	if (r - RANK(avlt, n->left) < 1 || r - RANK(avlt, n->left) > 2 || \
+		r - RANK(avlt, n->right) < 1 || r - RANK(avlt, n->right) > 2)
+		return -1;
+	if (n->left == AVL_NIL(avlt) && n->right == AVL_NIL(avlt) && r != 0)
+		return -1;
+
+	return 1 + ((lh > rh) ? lh : rh);
+}
+
+/*
+ * collect node count and leaf depths recursively
+ */
+void shape(avltree *avlt, avlnode *n, int depth, avlstats *stats)
+{
+	if (n != AVL_NIL(avlt)) {
+		stats->count++;
+		if (n->left == AVL_NIL(avlt) && n->right == AVL_NIL(avlt)) {
+			stats->leaves++;
+			stats->avg_leaf_depth += depth;
+		}
+		shape(avlt, n->left, depth + 1, stats);
+		shape(avlt, n->right, depth + 1, stats);
+	}
+}
+
+/*
+ * print node recursively
+ */
+void print(avltree *avlt, avlnode *n, void (*print_func)(void *), int depth, char *label)
+{
+	if (n != AVL_NIL(avlt)) {
+		print(avlt, n->right, print_func, depth + 1, "R");
+		printf("%*s", 8 * depth, "");
+		if (label)
+			printf("%s: ", label);
+		print_func(n->data);
+		printf(" (%s%d)\n", (n->bf >= 0) ? "+" : "", n->bf);
+		print(avlt, n->left, print_func, depth + 1, "L");
+	}
+}
+
+/*
+ * destroy node recursively
+ */
+void destroy(avltree *avlt, avlnode *n)
+{
+	if (n != AVL_NIL(avlt)) {
+		destroy(avlt, n->left);
+		destroy(avlt, n->right);
+		avlt->destroy(n->data);
+		#ifdef AVL_MULTISET
+		bucket_destroy(avlt, n);
+		#endif
+		free_node(avlt, n);
+	}
+}
+
+/*
+ * copy n and its subtrees into slab in preorder
+ * return the copy, NIL of copy if n is NIL or copy_func fails
+ * a node is linked only with its data, so a partial copy can be destroyed
+ */
+avlnode *clone(avltree *avlt, avltree *copy, avlnode *n, avlnode *parent, avlslab *slab, \
+	void *(*copy_func)(void *))
+{
+	avlnode *m;
+
+	if (n == AVL_NIL(avlt))
+		return AVL_NIL(copy);
+
+	m = &slab->nodes[slab->used++];
+	*m = *n; /* bf, flags, prefix and aux */
+	m->flags |= AVL_POOLED;
+	#ifdef AVL_CACHE
+	m->cached = 0; /* not in the cache of the copy */
+	#endif
+	m->parent = parent;
+	m->left = m->right = AVL_NIL(copy);
+	if ((m->data = copy_func(n->data)) == NULL)
+		return AVL_NIL(copy); /* the slot is not reused */
+
+	#ifdef AVL_MULTISET
+	if (n->bucket != NULL) {
+		unsigned long i;
+		m->bucket = NULL;
+		for (i = 0; i < n->bucket->count; i++) {
+			void *data = copy_func(n->bucket->data[i]);
+			if (data == NULL || !bucket_push(copy, m, data, 0)) {
+				if (data != NULL)
+					copy->destroy(data);
+				bucket_destroy(copy, m);
+				copy->destroy(m->data);
+				return AVL_NIL(copy);
+			}
+		}
+	}
+	#endif
+
+	slab->live++;
+
+	#ifdef AVL_MIN
+	if (avlt->min == n)
+		copy->min = m;
+	#endif
+
+	m->left = clone(avlt, copy, n->left, m, slab, copy_func);
+	m->right = clone(avlt, copy, n->right, m, slab, copy_func);
+
+	return m;
+}
+
+/*
+ * allocate size bytes from allocator, or from malloc if it is NULL, on a cache line if aligned
+ * return NULL if out of memory
+ */
+void *mem_alloc(const avlallocator *allocator, size_t size, int aligned)
+{
+	void *p;
+
+	if (allocator != NULL)
+		return allocator->alloc(size, allocator->ctx);
+	if (!aligned)
+		return malloc(size);
+
+	return (posix_memalign(&p, 64, size) == 0) ? p : NULL;
+}
+
+/*
+ * free size bytes allocated by mem_alloc
+ */
+void mem_free(const avlallocator *allocator, void *p, size_t size)
+{
+	if (allocator != NULL)
+		allocator->free(p, size, allocator->ctx);
+	else
+		free(p);
+}
+
+/*
+ * allocate a node, within the limit of avlt
+ * return NULL if out of memory
+ */
+avlnode *alloc_node(avltree *avlt)
+{
+	avlarena *arena = avlt->arena;
+	avlnode *n;
+
+	if (avlt->limit != 0 && avlt->bytes + sizeof(avlnode) > avlt->limit)
+		return NULL; /* over the limit */
+
+	if (arena != NULL) {
+		if ((n = arena->free) != NULL) {
+			arena->free = n->left;
+		} else {
+			avlslab *chunk = arena->chunks;
+			if (chunk == NULL || chunk->used == chunk->size) {
+				chunk = (avlslab *) malloc(sizeof(avlslab) + arena->chunk * sizeof(avlnode));
+				if (chunk == NULL)
+					return NULL; /* out of memory */
+				chunk->size = arena->chunk;
+				chunk->used = chunk->live = 0;
+				chunk->next = arena->chunks;
+				arena->chunks = chunk;
+			}
+			n = &chunk->nodes[chunk->used++];
+		}
+		arena->live++;
+		avlt->bytes += sizeof(avlnode);
+		STAT_INC(avlt, allocs);
+		return n;
+	}
+
+	n = (avlnode *) avl_alloc(avlt, sizeof(avlnode));
+	if (n != NULL)
+		STAT_INC(avlt, allocs);
+
+	return n;
+}
+
+/*
+ * free a node, or drop it from its slab
+ */
+void free_node(avltree *avlt, avlnode *n)
+{
+	avlslab *slab;
+
+	#ifdef AVL_CACHE
+	cache_replace(avlt, n, NULL);
+	#endif
+
+	if (n->flags & AVL_POOLED) {
+		for (slab = avlt->slabs; !IN_SLAB(slab, n); slab = slab->next) ;
+		if (--slab->live == 0 && slab != avlt->compact)
+			release_slab(avlt, slab);
+	} else if (avlt->arena != NULL) {
+		n->left = avlt->arena->free;
+		avlt->arena->free = n;
+		avlt->arena->live--;
+		avlt->bytes -= sizeof(avlnode);
+		STAT_INC(avlt, frees);
+	} else {
+		avl_free(avlt, n, sizeof(avlnode));
+		STAT_INC(avlt, frees);
+	}
+}
+
+/*
+ * allocate an empty slab of size nodes
+ * return NULL if out of memory
+ */
+avlslab *new_slab(avltree *avlt, unsigned long size)
+{
+	avlslab *slab;
+
+	slab = (avlslab *) avl_alloc(avlt, sizeof(avlslab) + size * sizeof(avlnode));
+	if (slab == NULL)
+		return NULL; /* out of memory */
+
+	STAT_INC(avlt, allocs);
+
+	slab->size = size;
+	slab->used = 0;
+	slab->live = 0;
+	slab->next = avlt->slabs;
+	avlt->slabs = slab;
+
+	return slab;
+}
+
+/*
+ * unlink and free a slab
+ */
+void release_slab(avltree *avlt, avlslab *slab)
+{
+	avlslab **pp;
+
+	for (pp = &avlt->slabs; *pp != slab; pp = &(*pp)->next) ;
+	*pp = slab->next;
+	avl_free(avlt, slab, sizeof(avlslab) + slab->size * sizeof(avlnode));
+	STAT_INC(avlt, frees);
+}
+
+/*
+ * copy node n into the next free slot of slab and relink its neighbours
+ * return the new node
+ */
+avlnode *move_node(avltree *avlt, avlnode *n, avlslab *slab)
+{
+	avlnode *m;
+
+	m = &slab->nodes[slab->used++];
+	*m = *n;
+	m->flags |= AVL_POOLED;
+	slab->live++;
+
+	if (n == n->parent->left)
+		n->parent->left = m;
+	else
+		n->parent->right = m;
+	if (m->left != AVL_NIL(avlt))
+		m->left->parent = m;
+	if (m->right != AVL_NIL(avlt))
+		m->right->parent = m;
+
+	#ifdef AVL_MIN
+	if (avlt->min == n)
+		avlt->min = m;
+	#endif
+
+	if (avlt->cursor == n)
+		avlt->cursor = m;
+
+	#ifdef AVL_CACHE
+	cache_replace(avlt, n, m); /* a cached node stays cached */
+	#endif
+
+	if (avlt->relocate != NULL)
+		avlt->relocate(m->data, m);
+
+	free_node(avlt, n);
+
+	return m;
+}
+
+/*
+ * exchange the positions of node and its in-order successor succ (node->right is not NIL, succ->left is NIL)
+ * both keep their data, so pointers to nodes stay valid
+ */
+void swap_successor(avltree *avlt, avlnode *node, avlnode *succ)
+{
+	avlnode *parent, *right;
+	char bf;
+
+	parent = succ->parent;
+	right = succ->right;
+
+	/* succ takes the place of node */
+	succ->parent = node->parent;
+	if (node == node->parent->left)
+		node->parent->left = succ;
+	else
+		node->parent->right = succ;
+	succ->left = node->left;
+	succ->left->parent = succ;
+	if (parent == node) { /* succ is the right child of node */
+		succ->right = node;
+		node->parent = succ;
+	} else {
+		succ->right = node->right;
+		succ->right->parent = succ;
+		parent->left = node; /* succ is the leftmost node of node->right */
+		node->parent = parent;
+	}
+
+	/* node takes the place of succ */
+	node->left = AVL_NIL(avlt);
+	node->right = right;
+	if (right != AVL_NIL(avlt))
+		right->parent = node;
+
+	bf = node->bf;
+	node->bf = succ->bf;
+	succ->bf = bf;
+}
+
+/*
+ * link node, a leaf, below parent and rebalance
+ */
+void link_node(avltree *avlt, avlnode *node, avlnode *parent)
+{
+	avlnode *current;
+	unsigned long depth;
+
+	node->left = node->right = AVL_NIL(avlt);
+	node->parent = parent;
+	node->bf = 0;
+	current = node;
+
+	if (parent == AVL_ROOT(avlt) || NODE_COMPARE(avlt, node->data, node->prefix, parent) < 0)
+		parent->left = current;
+	else
+		parent->right = current;
+
+	#ifdef AVL_MIN
+	if (avlt->min == NULL || NODE_COMPARE(avlt, node->data, node->prefix, avlt->min) < 0)
+		avlt->min = current;
+	#endif
+
+	/* aggregates above the new node first, rotations then keep them */
+	AUGMENT_PATH(avlt, current);
+
+	if (WAVL(avlt)) {
+		wavl_insert(avlt, node);
+		return;
+	}
+
+	/*
+	 * After insertion it is necessary to update the balance factors of all nodes, 
+	 * observe that all nodes requiring correction must be on the path from the root to the new node.
+	 * 
+	 * Backtracking the top-down path from the root to the new node:
+	 * 1. update the balance factor of parent node; 
+	 * 2. rebalance if the balance factor of parent node temporarily becomes +2 or -2 (parent subtree has the same height as before, thus backtracking terminate immediately); 
+	 * 3. terminate if the height of that parent subtree remains unchanged.
+	 */
+	depth = 0;
+	while (current != AVL_FIRST(avlt)) { /* Loop (possibly up to the root) */
+		depth++;
+		if (current == parent->left) { /* The height of left subtree of parent subtree increases */
+			if (parent->bf == 1) { /* parent subtree is right-heavy */
+				/*
+				 * height increase of left subtree is absorbed at parent node, 
+				 * height of parent subtree remains unchanged, thus backtracking terminate.
+				 */
+				parent->bf = 0; /* height unchanged, balanced, goto break */
+				break;
+			} else if (parent->bf == 0) { /* parent subtree is balanced */
+				/*
+				 * height of parent subtree increases by one, thus backtracking continue.
+				 */
+				parent->bf = -1; /* height increased, left-heavy, goto loop */
+			} else if (parent->bf == -1) { /* parent subtree is left-heavy */
+				/*
+				 * the balance factor becomes -2, this has to be repaired by an appropriate rotation
+				 * after which parent subtree has the same height as before.
+				 */
+				fix_insert_leftimbalance(avlt, parent); /* height unchanged, balanced, goto break */
+				break;
+			}
+		} else { /* The height of right subtree of parent subtree increases */
+			if (parent->bf == -1) { /* parent subtree is left-heavy */
+				/*
+				 * height increase of right subtree is absorbed at parent node, 
+				 * height of parent subtree remains unchanged, thus backtracking terminate.
+				 */
+				parent->bf = 0; /* height unchanged, balanced, goto break */
+				break;
+			} else if (parent->bf == 0) { /* parent subtree is balanced */
+				/*
+				 * height of parent subtree increases by one, thus backtracking continue.
+				 */
+				parent->bf = 1; /* height increased, right-heavy, goto loop */
+			} else if (parent->bf == 1) {
+				/*
+				 * the balance factor becomes 2, this has to be repaired by an appropriate rotation
+				 * after which parent subtree has the same height as before.
+				 */
+				fix_insert_rightimbalance(avlt, parent); /* height unchanged, balanced, goto break */
+				break;
+			}
+		}
 
-		#ifdef AVL_MIN
-		if (avlt->min == target)
-			avlt->min = avl_successor(avlt, target); /* deleted, thus min = successor */
-		#endif
-	} else {
-		target = avl_successor(avlt, node); /* node->right must not be NIL, thus move down */
+		/* move up */
+		current = parent;
+		parent = current->parent;
+	}
 
-		node->data = target->data; /* data swapped */
+	STAT_BACKTRACK(avlt, insert, depth);
+}
 
-		#ifdef AVL_MIN
-		/* if min == node, then min = successor = node (swapped), thus idle */
-		/* if min == target, then min = successor, which is not the minimal, thus impossible */
-		#endif
+/*
+ * unlink node from the tree and rebalance, node is not freed
+ * if node has two children, its in-order successor takes its place, node handles stay valid
+ * (only compaction moves nodes)
+ */
+void unlink_node(avltree *avlt, avlnode *node)
+{
+	avlnode *current, *parent;
+	avlnode *target;
+	unsigned long depth;
+
+	/* an incremental compaction resumes after the cursor, keep it on a surviving node */
+	if (avlt->cursor == node)
+		avlt->cursor = predecessor(avlt, node);
+
+	#ifdef AVL_MIN
+	/* the minimal may have two children: tombstones on its left under AVL_LAZY */
+	if (avlt->min == node)
+		avlt->min = avl_successor(avlt, node); /* deleted, thus min = successor */
+	#endif
+
+	/* if node has two children, its in-order successor takes its place and node moves down */
+
+	if (node->left != AVL_NIL(avlt) && node->right != AVL_NIL(avlt))
+		swap_successor(avlt, node, successor(avlt, node)); /* node->right must not be NIL, thus move down */
+	target = node; /* at most one child now */
+
+	if (WAVL(avlt)) {
+		/* unlink first, then rebalance from the parent up */
+		current = (target->left == AVL_NIL(avlt)) ? target->right : target->left;
+		parent = target->parent;
+		if (current != AVL_NIL(avlt))
+			current->parent = parent;
+		if (target == parent->left)
+			parent->left = current;
+		else
+			parent->right = current;
+		AUGMENT_PATH(avlt, parent);
+		wavl_delete(avlt, parent, current);
+		return;
 	}
 
 	/*
 	 * After deletion it is necessary to update the balance factors of all nodes, 
 	 * observe that all nodes requiring correction must be on the path from the root to the target node,
-	 * which is either the subject node or the replacement node.
+	 * which is the subject node, in the former position of its replacement if it had two children.
 	 * 
 	 * Backtracking the top-down path from the root to the target node:
 	 * 1. update the balance factor of parent node;
@@ -318,7 +2310,9 @@ void *avl_delete(avltree *avlt, avlnode *node, int keep)
 	current = target;
 	parent = current->parent;
 
+	depth = 0;
 	while (current != AVL_FIRST(avlt)) { /* Loop (possibly up to the root) */
+		depth++;
 		if (current == parent->left) { /* The height of left subtree of parent subtree decreases */
 			if (parent->bf == -1) { /* parent subtree is left-heavy */
 				/*
@@ -374,6 +2368,8 @@ void *avl_delete(avltree *avlt, avlnode *node, int keep)
 		parent = current->parent;
 	}
 
+	STAT_BACKTRACK(avlt, delete, depth);
+
 	/* replace the target node with its child (may be NIL) */
 
 	avlnode *child; /* child of target */
@@ -388,266 +2384,868 @@ void *avl_delete(avltree *avlt, avlnode *node, int keep)
 	else
 		target->parent->right = child;
 
-	free(target);
+	/* the path above target covers its successor, which may have taken the place of node */
+	AUGMENT_PATH(avlt, target->parent);
+}
+
+/*
+ * rebalance by ranks after the new leaf x (rank 0) was linked: promote up the path
+ * while x ranks with its parent, then at most one single or double rotation
+ */
+void wavl_insert(avltree *avlt, avlnode *x)
+{
+	avlnode *p, *s, *y;
+	unsigned long depth;
+	int r;
+
+	depth = 0;
+	for (p = x->parent; p != AVL_ROOT(avlt) && (r = RANK(avlt, p)) == RANK(avlt, x); x = p, p = x->parent) {
+		depth++;
+		s = (x == p->left) ? p->right : p->left;
+		if (r - RANK(avlt, s) == 1) { /* the sibling is a 1-child, promote p */
+			SET_RANK(p, r + 1);
+			continue;
+		}
+
+		/* the sibling is a 2-child, rotate x up */
+		y = (x == p->left) ? x->right : x->left; /* inner child of x */
+		if (r - RANK(avlt, y) == 2) {
+			STAT_INC(avlt, insert_single_rotations);
+			if (x == p->left)
+				rotate_right(avlt, p);
+			else
+				rotate_left(avlt, p);
+			SET_RANK(p, r - 1);
+		} else {
+			STAT_INC(avlt, insert_double_rotations);
+			if (x == p->left) {
+				rotate_left(avlt, x);
+				rotate_right(avlt, p);
+			} else {
+				rotate_right(avlt, x);
+				rotate_left(avlt, p);
+			}
+			SET_RANK(y, r);
+			SET_RANK(x, r - 1);
+			SET_RANK(p, r - 1);
+		}
+		break;
+	}
+
+	STAT_BACKTRACK(avlt, insert, depth);
+}
+
+/*
+ * rebalance by ranks after a node was unlinked from below p and replaced by x, which may be NIL:
+ * demote up the path while x is a 3-child, then at most one single or double rotation
+ */
+void wavl_delete(avltree *avlt, avlnode *p, avlnode *x)
+{
+	avlnode *s, *t, *u;
+	unsigned long depth;
+	int r, rs, rt;
+
+	if (p == AVL_ROOT(avlt))
+		return;
+
+	depth = 0;
+	if (p->left == AVL_NIL(avlt) && p->right == AVL_NIL(avlt) && RANK(avlt, p) == 1) {
+		SET_RANK(p, 0); /* a leaf of rank 1 lost its only child */
+		x = p;
+		p = x->parent;
+		depth++;
+	}
+
+	while (p != AVL_ROOT(avlt) && (r = RANK(avlt, p)) - RANK(avlt, x) == 3) {
+		depth++;
+		/* x may be NIL, but then its sibling is not */
+		s = (x == p->left && (x != AVL_NIL(avlt) || p->right != AVL_NIL(avlt))) ? p->right : p->left;
+		rs = RANK(avlt, s);
+		if (r - rs == 2) { /* the sibling is a 2-child, demote p */
+			SET_RANK(p, r - 1);
+			x = p;
+			p = x->parent;
+			continue;
+		}
+		if (rs - RANK(avlt, s->left) == 2 && rs - RANK(avlt, s->right) == 2) { /* demote p and s */
+			SET_RANK(p, r - 1);
+			SET_RANK(s, rs - 1);
+			x = p;
+			p = x->parent;
+			continue;
+		}
+
+		/* rotate s up */
+		t = (s == p->right) ? s->left : s->right; /* inner child of s */
+		u = (s == p->right) ? s->right : s->left;
+		if (rs - RANK(avlt, u) == 1) {
+			STAT_INC(avlt, delete_single_rotations);
+			if (s == p->right)
+				rotate_left(avlt, p);
+			else
+				rotate_right(avlt, p);
+			SET_RANK(s, rs + 1);
+			SET_RANK(p, (p->left == AVL_NIL(avlt) && p->right == AVL_NIL(avlt)) ? 0 : r - 1);
+		} else {
+			STAT_INC(avlt, delete_double_rotations);
+			rt = RANK(avlt, t);
+			if (s == p->right) {
+				rotate_right(avlt, s);
+				rotate_left(avlt, p);
+			} else {
+				rotate_left(avlt, s);
+				rotate_right(avlt, p);
+			}
+			SET_RANK(t, rt + 2);
+			SET_RANK(p, r - 2);
+			SET_RANK(s, rs - 1);
+		}
+		break;
+	}
+
+	STAT_BACKTRACK(avlt, delete, depth);
+}
+
+/*
+ * set the rank of each node of subtree n to its height - 1, which makes an AVL tree a weak AVL tree
+ * return the height of n
+ */
+int rank_all(avltree *avlt, avlnode *n)
+{
+	int lh, rh;
+
+	if (n == AVL_NIL(avlt))
+		return 0;
+
+	lh = rank_all(avlt, n->left);
+	rh = rank_all(avlt, n->right);
+	SET_RANK(n, (lh > rh) ? lh : rh);
+
+	return 1 + ((lh > rh) ? lh : rh);
+}
+
+/*
+ * delete the nodes with lo <= key < hi one by one, tombstones included, as range does
+ * return the number of values
+ */
+unsigned long delete_range(avltree *avlt, void *lo, void *hi, void (*func)(void *, void *), void *cookie)
+{
+	avlnode *n, *p, *next;
+	unsigned long count;
+
+	/* the first node not below lo */
+	n = NULL;
+	for (p = AVL_FIRST(avlt); p != AVL_NIL(avlt); ) {
+		if (lo == NULL || COMPARE(avlt, p->data, lo) >= 0) {
+			n = p;
+			p = p->left;
+		} else {
+			p = p->right;
+		}
+	}
+
+	for (count = 0; n != NULL && (hi == NULL || COMPARE(avlt, n->data, hi) < 0); n = next) {
+		next = successor(avlt, n); /* stays valid, handles are stable */
+		unlink_node(avlt, n);
+		n->left = n->right = AVL_NIL(avlt);
+		count += erase(avlt, n, func, cookie);
+	}
+
+	BLOOM_STALE(avlt, count);
+
+	return count;
+}
+
+/*
+ * height of subtree n, following the higher child
+ */
+int height(avltree *avlt, avlnode *n)
+{
+	int h;
+
+	for (h = 0; n != AVL_NIL(avlt); h++)
+		n = (n->bf == LEFTHEAVY) ? n->left : n->right;
+
+	return h;
+}
+
+/*
+ * rebalance after the height of subtree current increased by one, up to top
+ * child balance factors of 0 occur when joining, thus the rotations of deletion which handle them
+ * return 1 if the height of the child of top increased
+ */
+int grow(avltree *avlt, avlnode *current, avlnode *top)
+{
+	avlnode *parent;
+
+	for (parent = current->parent; parent != top; parent = current->parent) {
+		if (current == parent->left) {
+			if (parent->bf == RIGHTHEAVY) {
+				parent->bf = BALANCED;
+				return 0;
+			} else if (parent->bf == BALANCED) {
+				parent->bf = LEFTHEAVY;
+			} else {
+				parent = fix_delete_leftimbalance(avlt, parent);
+				if (parent->bf == BALANCED)
+					return 0; /* height as before the increase */
+			}
+		} else {
+			if (parent->bf == LEFTHEAVY) {
+				parent->bf = BALANCED;
+				return 0;
+			} else if (parent->bf == BALANCED) {
+				parent->bf = RIGHTHEAVY;
+			} else {
+				parent = fix_delete_rightimbalance(avlt, parent);
+				if (parent->bf == BALANCED)
+					return 0; /* height as before the increase */
+			}
+		}
+		current = parent;
+	}
+
+	return 1;
+}
+
+/*
+ * join l, k and r, all of l before k and all of r after it, heights hl and hr
+ * k goes down the spine of the higher tree to the first subtree of about the height of the other one
+ * return the root, its height in *h; its parent is to be set by the caller
+ */
+avlnode *join(avltree *avlt, avlnode *l, int hl, avlnode *k, avlnode *r, int hr, int *h)
+{
+	avlnode holder, *c, *p;
+	int hc;
+
+	if (hl <= hr + 1 && hr <= hl + 1) {
+		k->left = l;
+		k->right = r;
+		if (l != AVL_NIL(avlt))
+			l->parent = k;
+		if (r != AVL_NIL(avlt))
+			r->parent = k;
+		k->bf = hr - hl;
+		*h = ((hl > hr) ? hl : hr) + 1;
+		AUGMENT_NODE(avlt, k);
+		return k;
+	}
+
+	/* a detached root needs a parent for the rotations */
+	holder.right = AVL_NIL(avlt);
+
+	if (hl > hr) {
+		holder.left = l;
+		l->parent = &holder;
+		for (p = &holder, c = l, hc = hl; hc > hr + 1; p = c, c = c->right)
+			hc -= (c->bf == LEFTHEAVY) ? 2 : 1;
+		k->left = c;
+		k->right = r;
+		k->bf = hr - hc;
+		p->right = k;
+	} else {
+		holder.left = r;
+		r->parent = &holder;
+		for (p = &holder, c = r, hc = hr; hc > hl + 1; p = c, c = c->left)
+			hc -= (c->bf == RIGHTHEAVY) ? 2 : 1;
+		k->left = l;
+		k->right = c;
+		k->bf = hc - hl;
+		p->left = k;
+	}
+	k->parent = p;
+	if (k->left != AVL_NIL(avlt))
+		k->left->parent = k;
+	if (k->right != AVL_NIL(avlt))
+		k->right->parent = k;
+
+	AUGMENT_UP(avlt, k, &holder);
+	*h = ((hl > hr) ? hl : hr) + grow(avlt, k, &holder);
+
+	return holder.left;
+}
+
+/*
+ * split subtree n of height hn into the nodes before bound and the others
+ */
+void split(avltree *avlt, avlnode *n, int hn, void *bound, avlnode **l, int *hl, avlnode **r, int *hr)
+{
+	avlnode *left, *right, *sub;
+	int hleft, hright, hsub;
+
+	if (n == AVL_NIL(avlt)) {
+		*l = *r = AVL_NIL(avlt);
+		*hl = *hr = 0;
+		return;
+	}
+
+	left = n->left;
+	right = n->right;
+	hleft = hn - ((n->bf == RIGHTHEAVY) ? 2 : 1);
+	hright = hn - ((n->bf == LEFTHEAVY) ? 2 : 1);
+
+	if (COMPARE(avlt, n->data, bound) < 0) {
+		split(avlt, right, hright, bound, &sub, &hsub, r, hr);
+		*l = join(avlt, left, hleft, n, sub, hsub, hl);
+	} else {
+		split(avlt, left, hleft, bound, l, hl, &sub, &hsub);
+		*r = join(avlt, sub, hsub, n, right, hright, hr);
+	}
+}
+
+/*
+ * split the last node off subtree n of height hn
+ * return the last node, the others in *rest
+ */
+avlnode *split_last(avltree *avlt, avlnode *n, int hn, avlnode **rest, int *hrest)
+{
+	avlnode *k, *sub;
+	int hsub;
+
+	if (n->right == AVL_NIL(avlt)) {
+		*rest = n->left;
+		*hrest = hn - 1;
+		return n;
+	}
+
+	k = split_last(avlt, n->right, hn - ((n->bf == LEFTHEAVY) ? 2 : 1), &sub, &hsub);
+	*rest = join(avlt, n->left, hn - ((n->bf == RIGHTHEAVY) ? 2 : 1), n, sub, hsub, hrest);
+
+	return k;
+}
+
+/*
+ * split off the nodes with lo <= key < hi, join the rest, then free them
+ * their data is passed to func, or destroyed if func is NULL
+ * return the number of values
+ */
+unsigned long range(avltree *avlt, void *lo, void *hi, void (*func)(void *, void *), void *cookie)
+{
+	avlnode *a, *m, *b, *k;
+	int h, ha, hm, hb;
+	unsigned long count;
+
+	if (WAVL(avlt))
+		return delete_range(avlt, lo, hi, func, cookie); /* no join or split by ranks */
+
+	a = AVL_NIL(avlt);
+	m = AVL_FIRST(avlt);
+	h = ha = 0;
+	hm = height(avlt, m);
+
+	if (lo != NULL)
+		split(avlt, m, hm, lo, &a, &ha, &m, &hm);
+	b = AVL_NIL(avlt);
+	hb = 0;
+	if (hi != NULL)
+		split(avlt, m, hm, hi, &m, &hm, &b, &hb);
+
+	/* an incremental compaction resumes after the last node before the range */
+	if (avlt->cursor != NULL && (lo == NULL || COMPARE(avlt, avlt->cursor->data, lo) >= 0) && \
+		(hi == NULL || COMPARE(avlt, avlt->cursor->data, hi) < 0)) {
+		for (k = a; k != AVL_NIL(avlt) && k->right != AVL_NIL(avlt); k = k->right) ;
+		avlt->cursor = (k == AVL_NIL(avlt)) ? NULL : k;
+	}
+
+	if (a == AVL_NIL(avlt)) {
+		a = b;
+	} else if (b != AVL_NIL(avlt)) {
+		k = split_last(avlt, a, ha, &a, &ha);
+		a = join(avlt, a, ha, k, b, hb, &h);
+	}
+
+	AVL_FIRST(avlt) = a;
+	if (a != AVL_NIL(avlt))
+		a->parent = AVL_ROOT(avlt);
+
+	#ifdef AVL_MIN
+	for (k = a; k != AVL_NIL(avlt) && k->left != AVL_NIL(avlt); k = k->left) ;
+	avlt->min = (k == AVL_NIL(avlt)) ? NULL : k;
+	if (avlt->min != NULL && AVL_DEAD(avlt->min))
+		avlt->min = avl_successor(avlt, avlt->min);
+	#endif
+
+	count = erase(avlt, m, func, cookie);
+	BLOOM_STALE(avlt, count);
+
+	return count;
+}
+
+/*
+ * free subtree n, which is detached, in key order
+ * its data is passed to func, or destroyed if func is NULL
+ * return the number of values
+ */
+unsigned long erase(avltree *avlt, avlnode *n, void (*func)(void *, void *), void *cookie)
+{
+	avlnode *right;
+	unsigned long count;
+
+	if (n == AVL_NIL(avlt))
+		return 0;
+
+	count = erase(avlt, n->left, func, cookie);
+	right = n->right;
+
+	if (AVL_DEAD(n)) {
+		#ifdef AVL_LAZY
+		avlt->tombstones--; /* deleted before, not counted */
+		#endif
+		avlt->destroy(n->data);
+	} else if (func == NULL) {
+		count++;
+		#ifdef AVL_MULTISET
+		count += n->bucket ? n->bucket->count : 0;
+		#endif
+		avlt->destroy(n->data);
+		#ifdef AVL_MULTISET
+		bucket_destroy(avlt, n);
+		#endif
+	} else {
+		count++;
+		func(n->data, cookie);
+		#ifdef AVL_MULTISET
+		if (n->bucket != NULL) {
+			unsigned long i;
+			count += n->bucket->count;
+			for (i = 0; i < n->bucket->count; i++)
+				func(n->bucket->data[i], cookie);
+			bucket_free(avlt, n);
+		}
+		#endif
+	}
+
+	avlt->count--;
+	free_node(avlt, n);
+
+	return count + erase(avlt, right, func, cookie);
+}
+
+/*
+ * next larger, tombstones included
+ * return NULL if not found
+ */
+avlnode *successor(avltree *avlt, avlnode *node)
+{
+	avlnode *p;
+
+	p = node->right;
+
+	if (p != AVL_NIL(avlt)) {
+		/* move down until we find it */
+		for ( ; p->left != AVL_NIL(avlt); p = p->left) ;
+	} else {
+		/* move up until we find it or hit the root */
+		for (p = node->parent; node == p->right; node = p, p = p->parent) ;
+
+		if (p == AVL_ROOT(avlt))
+			p = NULL; /* not found */
+	}
+
+	return p;
+}
+
+/*
+ * next smaller
+ * return NULL if not found
+ */
+avlnode *predecessor(avltree *avlt, avlnode *node)
+{
+	avlnode *p;
+
+	p = node->left;
+
+	if (p != AVL_NIL(avlt)) {
+		/* move down until we find it */
+		for ( ; p->right != AVL_NIL(avlt); p = p->right) ;
+	} else {
+		/* move up until we find it or hit the root */
+		for (p = node->parent; p != AVL_ROOT(avlt) && node == p->left; node = p, p = p->parent) ;
+
+		if (p == AVL_ROOT(avlt))
+			p = NULL; /* not found */
+	}
+
+	return p;
+}
+
+#ifdef AVL_MULTISET
+/*
+ * append data to the bucket of n, growing it from the allocator of avlt, within its limit if limited
+ * return 0 if out of memory or over the limit
+ */
+int bucket_push(avltree *avlt, avlnode *n, void *data, int limited)
+{
+	avlbucket *b;
+	unsigned long size;
+
+	b = n->bucket;
+	if (b == NULL || b->count == b->size) {
+		size = (b == NULL) ? 2 : 2 * b->size;
+		if (limited && avlt->limit != 0 && \
+			avlt->bytes + AVL_BUCKET_BYTES(size) - (b ? AVL_BUCKET_BYTES(b->size) : 0) > avlt->limit)
+			return 0; /* over the limit */
+		if ((b = (avlbucket *) avl_alloc(avlt, AVL_BUCKET_BYTES(size))) == NULL)
+			return 0; /* out of memory, n->bucket untouched */
+		b->count = 0;
+		if (n->bucket != NULL) {
+			b->count = n->bucket->count;
+			memcpy(b->data, n->bucket->data, b->count * sizeof(void *));
+			bucket_free(avlt, n);
+		}
+		b->size = size;
+		n->bucket = b;
+	}
+
+	b->data[b->count++] = data;
+	return 1;
+}
+
+/*
+ * free the bucket of n, not the values in it
+ */
+void bucket_free(avltree *avlt, avlnode *n)
+{
+	avl_free(avlt, n->bucket, AVL_BUCKET_BYTES(n->bucket->size));
+	n->bucket = NULL;
+}
 
-	/* keep or discard data */
+/*
+ * destroy the bucket of n and the values in it
+ */
+void bucket_destroy(avltree *avlt, avlnode *n)
+{
+	unsigned long i;
 
-	if (keep == 0) {
-		avlt->destroy(data);
-		data = NULL; /* freed */
+	if (n->bucket != NULL) {
+		for (i = 0; i < n->bucket->count; i++)
+			avlt->destroy(n->bucket->data[i]);
+		bucket_free(avlt, n);
 	}
-
-	return data;
 }
+#endif
 
+#ifdef AVL_PREFIX
 /*
- * rotate left about x
- * return the new root
+ * recompute prefixes recursively
  */
-avlnode *rotate_left(avltree *avlt, avlnode *x)
+void renormalize(avltree *avlt, avlnode *n)
 {
-	avlnode *y;
-
-	y = x->right; /* child */
+	if (n != AVL_NIL(avlt)) {
+		n->prefix = PREFIX(avlt, n->data);
+		renormalize(avlt, n->left);
+		renormalize(avlt, n->right);
+	}
+}
+#endif
 
-	/* tree x */
-	x->right = y->left;
-	if (x->right != AVL_NIL(avlt))
-		x->right->parent = x;
+#ifdef AVL_AUGMENT
+/*
+ * recompute aggregates from n up to, but excluding, top
+ */
+void augment_path(avltree *avlt, avlnode *n, avlnode *top)
+{
+	for (; n != top; n = n->parent)
+		AUGMENT(avlt, n);
+}
 
-	/* tree y */
-	y->parent = x->parent;
-	if (x == x->parent->left)
-		x->parent->left = y;
-	else
-		x->parent->right = y;
+/*
+ * recompute aggregates recursively, in postorder
+ */
+void augment_all(avltree *avlt, avlnode *n)
+{
+	if (n != AVL_NIL(avlt)) {
+		augment_all(avlt, n->left);
+		augment_all(avlt, n->right);
+		AUGMENT(avlt, n);
+	}
+}
 
-	/* assemble tree x and tree y */
-	y->left = x;
-	x->parent = y;
+/*
+ * aggregate of the range recursively
+ * below the node where the bounds split, one side is always a whole subtree
+ */
+void aggregate(avltree *avlt, avlnode *n, void *lo, void *hi, avlaux *result)
+{
+	avlaux left, right;
+
+	if (n == AVL_NIL(avlt)) {
+		*result = n->aux;
+	} else if (lo != NULL && COMPARE(avlt, n->data, lo) < 0) {
+		aggregate(avlt, n->right, lo, hi, result);
+	} else if (hi != NULL && COMPARE(avlt, n->data, hi) >= 0) {
+		aggregate(avlt, n->left, lo, hi, result);
+	} else {
+		if (lo != NULL)
+			aggregate(avlt, n->left, lo, NULL, &left);
+		else
+			left = n->left->aux;
+		if (hi != NULL)
+			aggregate(avlt, n->right, NULL, hi, &right);
+		else
+			right = n->right->aux;
+		avlt->combine(result, &left, n, &right);
+	}
+}
+#endif
 
-	return y;
+#ifdef AVL_INTERVAL
+/*
+ * maximal end of a subtree
+ */
+void interval_combine(avlaux *aux, const avlaux *left, const avlnode *node, const avlaux *right)
+{
+	long long max;
+
+	max = ((const avlinterval *) node->data)->hi;
+	if (left->i[0] > max)
+		max = left->i[0];
+	if (right->i[0] > max)
+		max = right->i[0];
+	aux->i[0] = max;
 }
 
 /*
- * rotate right about x
- * return the new root
+ * overlap recursively
+ * a subtree ending before lo is skipped, and so is the right subtree of a node starting after hi
  */
-avlnode *rotate_right(avltree *avlt, avlnode *x)
+int overlap(avltree *avlt, avlnode *n, long long lo, long long hi, int (*func)(void *, void *), void *cookie)
 {
-	avlnode *y;
+	const avlinterval *iv;
+	int err;
 
-	y = x->left; /* child */
+	if (n == AVL_NIL(avlt) || n->aux.i[0] < lo)
+		return 0;
 
-	/* tree x */
-	x->left = y->right;
-	if (x->left != AVL_NIL(avlt))
-		x->left->parent = x;
+	if ((err = overlap(avlt, n->left, lo, hi, func, cookie)) != 0)
+		return err;
 
-	/* tree y */
-	y->parent = x->parent;
-	if (x == x->parent->left)
-		x->parent->left = y;
-	else
-		x->parent->right = y;
+	iv = (const avlinterval *) n->data;
+	if (iv->lo > hi)
+		return 0;
 
-	/* assemble tree x and tree y */
-	y->right = x;
-	x->parent = y;
+	if (iv->hi >= lo) {
+		if ((err = func(n->data, cookie)) != 0)
+			return err;
+		#ifdef AVL_MULTISET
+		if (n->bucket != NULL) {
+			unsigned long i;
+			for (i = 0; i < n->bucket->count; i++)
+				if ((err = func(n->bucket->data[i], cookie)) != 0)
+					return err;
+		}
+		#endif
+	}
 
-	return y;
+	return overlap(avlt, n->right, lo, hi, func, cookie);
 }
+#endif
 
+#ifdef AVL_LAZY
+#ifndef AVL_DUP
 /*
- * fix left imbalance after insertion
- * return the new root
+ * count the node of a tombstone again, when an equal key is inserted
  */
-avlnode *fix_insert_leftimbalance(avltree *avlt, avlnode *p)
+void revive(avltree *avlt, avlnode *n)
 {
-	/* p->left->bf updated here */
+	n->flags &= ~AVL_TOMBSTONE;
+	avlt->tombstones--;
 
-	if (p->left->bf == p->bf) { /* -1, -1 */
-		p = rotate_right(avlt, p);
-		p->bf = p->right->bf = 0;
-	} else { /* 1, -1 */
-		int oldbf;
-		oldbf = p->left->right->bf;
-		rotate_left(avlt, p->left);
-		p = rotate_right(avlt, p);
-		p->bf = 0;
-		if (oldbf == -1) {
-			p->left->bf = 0;
-			p->right->bf = 1;
-		} else if (oldbf == 1) {
-			p->left->bf = -1;
-			p->right->bf = 0;
-		} else if (oldbf == 0) {
-			p->left->bf = p->right->bf = 0;
-		}
-	}
-	return p;
+	#ifdef AVL_MIN
+	if (avlt->min == NULL || NODE_COMPARE(avlt, n->data, n->prefix, avlt->min) < 0)
+		avlt->min = n;
+	#endif
 }
+#endif
 
 /*
- * fix right imbalance after insertion
- * return the new root
+ * store the live nodes of n in order from nodes[i], free the tombstones
+ * return the next free index
  */
-avlnode *fix_insert_rightimbalance(avltree *avlt, avlnode *p)
+unsigned long gather(avltree *avlt, avlnode *n, avlnode **nodes, unsigned long i)
 {
-	if (p->right->bf == p->bf) { /* 1, 1 */
-		p = rotate_left(avlt, p);
-		p->bf = p->left->bf = 0;
-	} else { /* -1, 1 */
-		int oldbf;
-		oldbf = p->right->left->bf;
-		rotate_right(avlt, p->right);
-		p = rotate_left(avlt, p);
-		p->bf = 0;
-		if (oldbf == -1) {
-			p->left->bf = 0;
-			p->right->bf = 1;
-		} else if (oldbf == 1) {
-			p->left->bf = -1;
-			p->right->bf = 0;
-		} else if (oldbf == 0) {
-			p->left->bf = p->right->bf = 0;
-		}
+	avlnode *right;
+
+	if (n == AVL_NIL(avlt))
+		return i;
+
+	i = gather(avlt, n->left, nodes, i);
+	right = n->right;
+
+	if (!AVL_DEAD(n)) {
+		nodes[i++] = n;
+	} else {
+		/* an incremental compaction resumes after the last live node before n */
+		if (avlt->cursor == n)
+			avlt->cursor = (i > 0) ? nodes[i - 1] : NULL;
+		avlt->destroy(n->data);
+		free_node(avlt, n);
 	}
-	return p;
+
+	return gather(avlt, right, nodes, i);
 }
 
 /*
- * fix left imbalance after deletion
- * return the new root
+ * link n nodes, in order, into a balanced subtree below parent
+ * return its root, NIL if n is zero, and its height in *h
  */
-avlnode *fix_delete_leftimbalance(avltree *avlt, avlnode *p)
+avlnode *rebuild(avltree *avlt, avlnode **nodes, unsigned long n, avlnode *parent, int *h)
 {
-	if (p->left->bf == -1) {
-		p = rotate_right(avlt, p);
-		p->bf = p->right->bf = 0;
-	} else if (p->left->bf == 0) {
-		p = rotate_right(avlt, p);
-		p->bf = 1;
-		p->right->bf = -1;
-	} else if (p->left->bf == 1) {
-		int oldbf;
-		oldbf = p->left->right->bf;
-		rotate_left(avlt, p->left);
-		p = rotate_right(avlt, p);
-		p->bf = 0;
-		if (oldbf == -1) {
-			p->left->bf = 0;
-			p->right->bf = 1;
-		} else if (oldbf == 1) {
-			p->left->bf = -1;
-			p->right->bf = 0;
-		} else if (oldbf == 0) {
-			p->left->bf = p->right->bf = 0;
-		}
+	avlnode *m;
+	int hl, hr;
+
+	if (n == 0) {
+		*h = 0;
+		return AVL_NIL(avlt);
 	}
-	return p;
+
+	m = nodes[n / 2];
+	m->parent = parent;
+	m->left = rebuild(avlt, nodes, n / 2, m, &hl);
+	m->right = rebuild(avlt, nodes + n / 2 + 1, n - n / 2 - 1, m, &hr);
+	m->bf = WAVL(avlt) ? (hl > hr ? hl : hr) : hr - hl; /* the rank is the height - 1 */
+	AUGMENT_NODE(avlt, m);
+
+	*h = 1 + (hl > hr ? hl : hr);
+	return m;
 }
+#endif
 
 /*
- * fix right imbalance after deletion
- * return the new root
+ * answer a lookup without searching the tree: a Bloom filter miss or a cache hit
+ * h is set to the hash of data for filling the cache after a search
+ * return 1 if answered, *out set to the node or NULL
  */
-avlnode *fix_delete_rightimbalance(avltree *avlt, avlnode *p)
+int find_shortcut(avltree *avlt, void *data, avlnode **out, unsigned long long *h)
 {
-	if (p->right->bf == 1) {
-		p = rotate_left(avlt, p);
-		p->bf = p->left->bf = 0;
-	} else if (p->right->bf == 0) {
-		p = rotate_left(avlt, p);
-		p->bf = -1;
-		p->left->bf = 1;
-	} else if (p->right->bf == -1) {
-		int oldbf;
-		oldbf = p->right->left->bf;
-		rotate_right(avlt, p->right);
-		p = rotate_left(avlt, p);
-		p->bf = 0;
-		if (oldbf == -1) {
-			p->left->bf = 0;
-			p->right->bf = 1;
-		} else if (oldbf == 1) {
-			p->left->bf = -1;
-			p->right->bf = 0;
-		} else if (oldbf == 0) {
-			p->left->bf = p->right->bf = 0;
+	*h = 0;
+
+	#ifdef AVL_BLOOM
+	if (avlt->bloom != NULL && !bloom_test(avlt, avlt->bloom_hash(data))) {
+		*out = NULL;
+		return 1; /* definitely not present */
+	}
+	#endif
+
+	#ifdef AVL_CACHE
+	if (avlt->cache != NULL) {
+		*h = avlt->hash(data);
+		if ((*out = cache_lookup(avlt, data, *h)) != NULL) {
+			avlt->cache_hits++;
+			return 1;
 		}
+		avlt->cache_misses++;
 	}
-	return p;
+	#else
+	(void) avlt;
+	(void) data;
+	(void) out;
+	#endif
+
+	return 0;
 }
 
+#ifdef AVL_CACHE
 /*
- * check order recursively
+ * cached node with a key equal to data, whose hash is h
+ * return NULL if not cached
  */
-int check_order(avltree *avlt, avlnode *n, void *min, void *max)
+avlnode *cache_lookup(avltree *avlt, void *data, unsigned long long h)
 {
-	if (n == AVL_NIL(avlt))
-		return 1;
+	avlcacheset *set;
+	int i;
 
-	#ifdef AVL_DUP
-	if (avlt->compare(n->data, min) < 0 || avlt->compare(n->data, max) > 0)
-	#else
-	if (avlt->compare(n->data, min) <= 0 || avlt->compare(n->data, max) >= 0)
-	#endif
-		return 0;
+	set = &avlt->cache[h & avlt->cache_mask];
+	for (i = 0; i < AVL_CACHE_WAYS; i++) {
+		if (set->node[i] != NULL && set->tag[i] == h && COMPARE(avlt, data, set->node[i]->data) == 0)
+			return set->node[i];
+	}
 
-	return check_order(avlt, n->left, min, n->data) && check_order(avlt, n->right, n->data, max);
+	return NULL;
 }
 
 /*
- * check height recursively
+ * cache n, found by a key whose hash is h, in front of its set; the last entry is evicted
  */
-int check_height(avltree *avlt, avlnode *n)
+void cache_fill(avltree *avlt, avlnode *n, unsigned long long h)
 {
-	int lh, rh, cmp;
-
-	if (n == AVL_NIL(avlt))
-		return 0;
-
-	lh = check_height(avlt, n->left);
-	if (lh < 0)
-		return lh;
-	
-	rh = check_height(avlt, n->right);
-	if (rh < 0)
-		return rh;
-	
-	cmp = rh - lh;
-	if (cmp < -1 || cmp > 1 || cmp != n->bf) /* check recomputed/cached balance factor */
-		return -1;
-	
-	return 1 + ((lh > rh) ? lh : rh);
+	avlcacheset *set;
+	int i;
+
+	if (n->cached != 0)
+		cache_replace(avlt, n, NULL); /* cached under a key changed since */
+
+	set = &avlt->cache[h & avlt->cache_mask];
+	if (set->node[AVL_CACHE_WAYS - 1] != NULL)
+		set->node[AVL_CACHE_WAYS - 1]->cached = 0;
+	for (i = AVL_CACHE_WAYS - 1; i > 0; i--) {
+		set->tag[i] = set->tag[i - 1];
+		set->node[i] = set->node[i - 1];
+	}
+	set->tag[0] = h;
+	set->node[0] = n;
+	n->cached = (unsigned int) (h & avlt->cache_mask) + 1;
 }
 
 /*
- * print node recursively
+ * replace the cache entry of n, if any, with m, or drop it if m is NULL
+ * the set is found from n, not from its key, which may be destroyed or changed already
  */
-void print(avltree *avlt, avlnode *n, void (*print_func)(void *), int depth, char *label)
+void cache_replace(avltree *avlt, avlnode *n, avlnode *m)
 {
-	if (n != AVL_NIL(avlt)) {
-		print(avlt, n->right, print_func, depth + 1, "R");
-		printf("%*s", 8 * depth, "");
-		if (label)
-			printf("%s: ", label);
-		print_func(n->data);
-		printf(" (%s%d)\n", (n->bf >= 0) ? "+" : "", n->bf);
-		print(avlt, n->left, print_func, depth + 1, "L");
+	avlcacheset *set;
+	int i;
+
+	if (n->cached == 0 || avlt->cache == NULL)
+		return;
+
+	set = &avlt->cache[(n->cached - 1) & avlt->cache_mask];
+	for (i = 0; i < AVL_CACHE_WAYS && set->node[i] != n; i++) ;
+	if (i < AVL_CACHE_WAYS) {
+		if (m == NULL) { /* close the gap, free entries stay last */
+			for ( ; i < AVL_CACHE_WAYS - 1; i++) {
+				set->tag[i] = set->tag[i + 1];
+				set->node[i] = set->node[i + 1];
+			}
+			set->node[i] = NULL;
+		} else {
+			set->node[i] = m;
+		}
 	}
+	n->cached = 0;
 }
+#endif
 
+#ifdef AVL_BLOOM
 /*
- * destroy node recursively
+ * set the bits of hash h: the block from its low half, the bits from 9-bit slices of a remix
  */
-void destroy(avltree *avlt, avlnode *n)
+void bloom_add(avltree *avlt, unsigned long long h)
 {
-	if (n != AVL_NIL(avlt)) {
-		destroy(avlt, n->left);
-		destroy(avlt, n->right);
-		avlt->destroy(n->data);
-		free(n);
+	unsigned long long *block, x;
+	int i;
+
+	block = avlt->bloom + ((h ^ (h >> 32)) & avlt->bloom_mask) * BLOOM_WORDS;
+	x = h * 0x9E3779B97F4A7C15ULL;
+	for (i = 0; i < BLOOM_PROBES; i++, x >>= 9)
+		block[(x >> 6) & 7] |= 1ULL << (x & 63);
+}
+
+/*
+ * return 0 if hash h is definitely not in the filter
+ */
+int bloom_test(avltree *avlt, unsigned long long h)
+{
+	unsigned long long *block, x;
+	int i;
+
+	block = avlt->bloom + ((h ^ (h >> 32)) & avlt->bloom_mask) * BLOOM_WORDS;
+	x = h * 0x9E3779B97F4A7C15ULL;
+	for (i = 0; i < BLOOM_PROBES; i++, x >>= 9) {
+		if (!(block[(x >> 6) & 7] & (1ULL << (x & 63))))
+			return 0;
 	}
+
+	return 1;
 }
+#endif
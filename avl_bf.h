@@ -6,8 +6,43 @@
 #ifndef _AVL_BF_HEADER
 #define _AVL_BF_HEADER
 
+#include <stddef.h>
+
 #define AVL_DUP 1
 #define AVL_MIN 1
+/* #define AVL_STATS 1 */
+/* #define AVL_HIST 1 */
+/* #define AVL_MULTISET 1 */
+/* #define AVL_PREFIX 1 */
+/* #define AVL_AUGMENT 1 */
+/* #define AVL_INTERVAL 1 */
+/* #define AVL_LAZY 1 */
+/* #define AVL_CACHE 1 */
+/* #define AVL_BLOOM 1 */
+
+#ifndef AVL_AUX_WORDS
+#define AVL_AUX_WORDS 2 /* size of the per-node aggregate if AVL_AUGMENT is defined */
+#endif
+
+#ifndef AVL_CACHE_WAYS
+#define AVL_CACHE_WAYS 4 /* entries per set of the lookup cache if AVL_CACHE is defined, one cache line */
+#endif
+
+#ifndef AVL_BLOOM_BITS
+#define AVL_BLOOM_BITS 10 /* filter bits per key if AVL_BLOOM is defined, about 1% false positives */
+#endif
+
+#ifdef AVL_MULTISET
+#undef AVL_DUP /* equal keys share one node */
+#endif
+
+#ifdef AVL_INTERVAL
+#define AVL_AUGMENT 1 /* the maximal end of a subtree is its aggregate */
+#endif
+
+#ifdef AVL_HIST
+#include "avl_hist.h"
+#endif
 
 /*
  * node->bf = height(node->right) - height(node->left)
@@ -21,20 +56,157 @@ enum avlbf {
 	RIGHTHEAVY = 1
 };
 
+/*
+ * rebalancing of a tree, see avl_set_engine()
+ * with AVL_WAVL node->bf holds the rank of the node as an unsigned byte instead (weak AVL):
+ * a child ranks 1 or 2 below its parent, NIL ranks -1 and a leaf 0, so a delete rotates at most twice
+ */
+enum avlengine {
+	AVL_BF,
+	AVL_WAVL
+};
+
+/*
+ * operations timed into latency histograms if AVL_HIST is defined
+ */
+enum avlop {
+	AVL_OP_INSERT,
+	AVL_OP_FIND,
+	AVL_OP_DELETE,
+	AVL_OP_DESTROY,
+	AVL_NOPS
+};
+
 enum avltraversal {
 	PREORDER,
 	INORDER,
 	POSTORDER
 };
 
+/* node->flags */
+#define AVL_POOLED 1 /* node lives in a slab, not in its own allocation */
+#define AVL_TOMBSTONE 2 /* node deleted lazily, unlinked and destroyed by the next purge */
+
+/*
+ * values sharing the key of a node in multiset mode, in insertion order
+ */
+typedef struct {
+	unsigned long count;
+	unsigned long size;
+	void *data[];
+} avlbucket;
+
+/* bytes of a bucket of size values, drawn from the allocator of the tree and counted in its bytes */
+#define AVL_BUCKET_BYTES(size) (sizeof(avlbucket) + (size) * sizeof(void *))
+
+/*
+ * aggregate of a subtree, maintained by the combine function set with avl_set_augment
+ */
+typedef union {
+	long long i[AVL_AUX_WORDS];
+	double d[AVL_AUX_WORDS];
+	void *p[AVL_AUX_WORDS];
+} avlaux;
+
+/*
+ * closed interval [lo, hi], the first member of data in interval mode
+ */
+typedef struct {
+	long long lo;
+	long long hi;
+} avlinterval;
+
 typedef struct avlnode {
 	struct avlnode *left;
 	struct avlnode *right;
 	struct avlnode *parent;
 	char bf;
+	char flags;
+	#ifdef AVL_CACHE
+	unsigned int cached; /* set + 1 of its lookup cache entry, 0 if not cached; fits in the padding */
+	#endif
 	void *data;
+	#ifdef AVL_MULTISET
+	avlbucket *bucket; /* values inserted after data with an equal key, NULL if none */
+	#endif
+	#ifdef AVL_PREFIX
+	unsigned long long prefix; /* normalized key of data */
+	#endif
+	#ifdef AVL_AUGMENT
+	avlaux aux; /* aggregate of the subtree rooted at this node, the identity in nil */
+	#endif
 } avlnode;
 
+/*
+ * set of the lookup cache, a node is cached in the set given by the hash of its key
+ */
+typedef struct {
+	unsigned long long tag[AVL_CACHE_WAYS]; /* hash of the key */
+	avlnode *node[AVL_CACHE_WAYS]; /* NULL if free, most recently filled first */
+} avlcacheset;
+
+/*
+ * contiguous block of nodes, released when its last live node is freed
+ */
+typedef struct avlslab {
+	struct avlslab *next;
+	unsigned long size; /* capacity in nodes */
+	unsigned long used;
+	unsigned long live;
+	avlnode nodes[];
+} avlslab;
+
+/*
+ * source of the memory of a tree: the tree itself, its nodes and slabs, its lookup cache and filter;
+ * alloc returns memory aligned as by malloc, NULL if out of memory, and free is given the size allocated.
+ * a tree freed by a background reclaimer is freed from its thread
+ */
+typedef struct {
+	void *(*alloc)(size_t size, void *ctx);
+	void (*free)(void *p, size_t size, void *ctx);
+	void *ctx;
+} avlallocator;
+
+/*
+ * nodes carved from chunks and recycled through a free list, shared by the trees set to it;
+ * trees sharing an arena must be used from one thread
+ */
+typedef struct {
+	avlnode *free; /* linked through left */
+	avlslab *chunks; /* the first one is carved from */
+	unsigned long chunk; /* nodes per chunk */
+	unsigned long live; /* nodes handed out */
+} avlarena;
+
+/*
+ * operation counters, maintained only if AVL_STATS is defined
+ * backtrack counts the levels climbed by the rebalancing loops
+ */
+typedef struct {
+	unsigned long compares;
+	unsigned long insert_single_rotations;
+	unsigned long insert_double_rotations;
+	unsigned long delete_single_rotations;
+	unsigned long delete_double_rotations;
+	unsigned long insert_backtrack;
+	unsigned long insert_backtrack_max;
+	unsigned long delete_backtrack;
+	unsigned long delete_backtrack_max;
+	unsigned long allocs;
+	unsigned long frees;
+} avlcounters;
+
+typedef struct {
+	int height;
+	unsigned long count; /* number of nodes */
+	unsigned long leaves;
+	double avg_leaf_depth; /* depth of the root is 1 */
+	unsigned long memory; /* bytes used by the tree itself, excluding data */
+	avlcounters counters; /* all zero if AVL_STATS is not defined */
+	unsigned long cache_hits; /* lookups served by the cache, zero if AVL_CACHE is not defined */
+	unsigned long cache_misses;
+} avlstats;
+
 typedef struct {
 	int (*compare)(const void *, const void *);
 	void (*print)(void *);
@@ -46,20 +218,112 @@ typedef struct {
 	#ifdef AVL_MIN
 	avlnode *min;
 	#endif
+
+	unsigned long count;
+	enum avlengine engine;
+
+	avlslab *slabs;
+	avlslab *compact; /* target of an incremental compaction, NULL if none */
+	avlnode *cursor; /* last node visited by the incremental compaction */
+	void (*relocate)(void *, avlnode *); /* told the new node of data moved by compaction, NULL if not set */
+	avlarena *arena; /* source of the nodes not in slabs, NULL for the allocator */
+	const avlallocator *allocator; /* NULL for malloc */
+	unsigned long bytes; /* held by the nodes, slabs and buckets */
+	unsigned long limit; /* on bytes for inserts, 0 if none */
+
+	#ifdef AVL_STATS
+	avlcounters counters;
+	#endif
+
+	#ifdef AVL_HIST
+	avlhist *hist; /* AVL_NOPS histograms (cycles), NULL if not timed */
+	#endif
+
+	#ifdef AVL_PREFIX
+	unsigned long long (*normalize)(const void *); /* NULL if not set */
+	#endif
+
+	#ifdef AVL_AUGMENT
+	void (*combine)(avlaux *, const avlaux *, const avlnode *, const avlaux *); /* NULL if not set */
+	#endif
+
+	#ifdef AVL_LAZY
+	double lazy; /* purge when tombstones exceed this fraction of the nodes, 0 if deletion is not lazy */
+	unsigned long tombstones; /* nodes marked by a lazy deletion, included in count */
+	#endif
+
+	#ifdef AVL_CACHE
+	unsigned long long (*hash)(const void *); /* NULL if not cached */
+	avlcacheset *cache;
+	unsigned long cache_mask; /* number of sets - 1 */
+	unsigned long cache_hits;
+	unsigned long cache_misses;
+	#endif
+
+	#ifdef AVL_BLOOM
+	unsigned long long (*bloom_hash)(const void *); /* NULL if not filtered */
+	unsigned long long *bloom; /* blocks of 512 bits, one cache line each */
+	unsigned long bloom_mask; /* number of blocks - 1 */
+	unsigned long bloom_stale; /* keys deleted since the filter was built, still in it */
+	#endif
 } avltree;
 
+/*
+ * nodes of a detached tree, freed a few at a time by avl_reclaim
+ */
+typedef struct avlreclaim {
+	void (*destroy)(void *);
+	avlnode *nil; /* sentinel of the tree detached from, compared but never read */
+	avlnode *next; /* node to continue from, NULL if none left */
+	avlslab *slabs;
+	avlarena *arena; /* of the tree detached from */
+	const avlallocator *allocator;
+	unsigned long count; /* nodes left */
+	struct avlreclaim *queue; /* next in the queue of a background reclaimer */
+} avlreclaim;
+
+/* lookups kept in flight by avl_find_batch */
+#define AVL_BATCH 8
+
 #define AVL_ROOT(avlt) (&(avlt)->root)
 #define AVL_NIL(avlt) (&(avlt)->nil)
 #define AVL_FIRST(avlt) ((avlt)->root.left)
 #define AVL_MINIMAL(avlt) ((avlt)->min)
+#ifdef AVL_BLOOM
+#define AVL_BLOOM_CAPACITY(avlt) (((avlt)->bloom_mask + 1) * 512 / AVL_BLOOM_BITS) /* keys the filter is sized for */
+#endif
+#define AVL_BYTES(avlt) ((avlt)->bytes)
+#ifdef AVL_LAZY
+#define AVL_COUNT(avlt) ((avlt)->count - (avlt)->tombstones)
+#define AVL_DEAD(n) ((n)->flags & AVL_TOMBSTONE)
+#else
+#define AVL_COUNT(avlt) ((avlt)->count)
+#define AVL_DEAD(n) 0
+#endif
 
 #define AVL_ISEMPTY(avlt) ((avlt)->root.left == &(avlt)->nil && (avlt)->root.right == &(avlt)->nil)
 #define AVL_APPLY(avlt, func, cookie, order) avl_apply((avlt), (avlt)->root.left, (func), (cookie), (order))
+#define AVL_STAB(avlt, point, func, cookie) avl_overlap((avlt), (point), (point), (func), (cookie))
 
 avltree *avl_create(int (*compare_func)(const void *, const void *), void (*destroy_func)(void *));
+avltree *avl_create_with(int (*compare_func)(const void *, const void *), void (*destroy_func)(void *), \
+	const avlallocator *allocator);
 void avl_destroy(avltree *avlt);
+avltree *avl_clone(avltree *avlt, void *(*copy_func)(void *));
+avlreclaim *avl_detach(avltree *avlt);
+int avl_reclaim(avlreclaim *r, unsigned long budget);
+
+avlarena *avl_arena_create(unsigned long chunk);
+void avl_arena_destroy(avlarena *arena);
+int avl_set_arena(avltree *avlt, avlarena *arena);
+void avl_set_limit(avltree *avlt, unsigned long bytes);
+void avl_set_relocate(avltree *avlt, void (*relocate_func)(void *, avlnode *));
+int avl_set_engine(avltree *avlt, enum avlengine engine);
+void *avl_alloc(avltree *avlt, size_t size);
+void avl_free(avltree *avlt, void *p, size_t size);
 
 avlnode *avl_find(avltree *avlt, void *data);
+int avl_find_batch(avltree *avlt, void **data, int n, avlnode **out);
 avlnode *avl_successor(avltree *avlt, avlnode *node);
 
 int avl_apply(avltree *avlt, avlnode *node, int (*func)(void *, void *), void *cookie, enum avltraversal order);
@@ -67,6 +331,55 @@ void avl_print(avltree *avlt, void (*print_func)(void *));
 
 avlnode *avl_insert(avltree *avlt, void *data);
 void *avl_delete(avltree *avlt, avlnode *node, int keep);
+void avl_reposition(avltree *avlt, avlnode *node);
+int avl_erase(avltree *avlt, void *data);
+unsigned long avl_erase_range(avltree *avlt, void *lo, void *hi);
+unsigned long avl_take_range(avltree *avlt, void *lo, void *hi, void (*func)(void *, void *), void *cookie);
+
+#ifdef AVL_MULTISET
+unsigned long avl_count(avltree *avlt, void *data);
+int avl_erase_one(avltree *avlt, void *data);
+unsigned long avl_erase_all(avltree *avlt, void *data);
+#endif
+
+int avl_compact(avltree *avlt);
+int avl_compact_step(avltree *avlt, unsigned long budget);
+
+void avl_stats(avltree *avlt, avlstats *stats);
+void avl_reset_counters(avltree *avlt);
+#ifdef AVL_HIST
+void avl_set_hist(avltree *avlt, avlhist *hist);
+#endif
+
+#ifdef AVL_PREFIX
+void avl_set_normalizer(avltree *avlt, unsigned long long (*normalize_func)(const void *));
+unsigned long long avl_prefix(const void *key, unsigned long len);
+#endif
+
+#ifdef AVL_AUGMENT
+void avl_set_augment(avltree *avlt, void (*combine_func)(avlaux *, const avlaux *, const avlnode *, const avlaux *), \
+	const avlaux *identity);
+void avl_aggregate(avltree *avlt, void *lo, void *hi, avlaux *result);
+#endif
+
+#ifdef AVL_INTERVAL
+int avl_interval_compare(const void *d1, const void *d2);
+void avl_set_interval(avltree *avlt);
+int avl_overlap(avltree *avlt, long long lo, long long hi, int (*func)(void *, void *), void *cookie);
+#endif
+
+#ifdef AVL_CACHE
+int avl_set_cache(avltree *avlt, unsigned long long (*hash_func)(const void *), unsigned long sets);
+#endif
+
+#ifdef AVL_BLOOM
+int avl_set_bloom(avltree *avlt, unsigned long long (*hash_func)(const void *), unsigned long capacity);
+#endif
+
+#ifdef AVL_LAZY
+void avl_set_lazy(avltree *avlt, double fraction);
+void avl_purge(avltree *avlt);
+#endif
 
 int avl_check_order(avltree *avlt, void *min, void *max);
 int avl_check_heigt(avltree *avlt);
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+#include "avl_frozen.h"
+
+#define CACHE_LINE 64
+
+#if defined(__GNUC__)
+#define PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define PREFETCH(addr) ((void) 0)
+#endif
+
+static size_t collect(avltree *avlt, avlnode *n, avlfrozen *f, size_t i, long long (*key_func)(const void *));
+static size_t eytzinger(avlfrozen *f, size_t i, size_t k);
+static int count_less(const long long *block, long long key);
+
+/*
+ * build a snapshot of avlt, key_func must order keys like avlt->compare
+ * return NULL if out of memory
+ */
+avlfrozen *avl_freeze(avltree *avlt, long long (*key_func)(const void *))
+{
+	avlfrozen *f;
+	size_t i, n;
+
+	if ((f = (avlfrozen *) calloc(1, sizeof(avlfrozen))) == NULL)
+		return NULL; /* out of memory */
+
+	n = AVL_COUNT(avlt);
+	f->n = n;
+	f->nblocks = (n + AVL_FROZEN_BLOCK - 1) / AVL_FROZEN_BLOCK;
+	if (f->nblocks == 0)
+		f->nblocks = 1; /* keep lookups free of special cases */
+
+	if (posix_memalign((void **) &f->keys, CACHE_LINE, f->nblocks * AVL_FROZEN_BLOCK * sizeof(long long)) != 0)
+		f->keys = NULL;
+	if (posix_memalign((void **) &f->index, CACHE_LINE, (f->nblocks + 1) * sizeof(long long)) != 0)
+		f->index = NULL;
+	f->data = (void **) malloc((n ? n : 1) * sizeof(void *));
+	f->block = (unsigned int *) malloc((f->nblocks + 1) * sizeof(unsigned int));
+
+	if (f->keys == NULL || f->index == NULL || f->data == NULL || f->block == NULL) {
+		avl_frozen_destroy(f);
+		return NULL; /* out of memory */
+	}
+
+	collect(avlt, AVL_FIRST(avlt), f, 0, key_func);
+	for (i = n; i < f->nblocks * AVL_FROZEN_BLOCK; i++)
+		f->keys[i] = LLONG_MAX;
+
+	eytzinger(f, 0, 1);
+
+	return f;
+}
+
+/*
+ * destruction, data is not touched
+ */
+void avl_frozen_destroy(avlfrozen *f)
+{
+	free(f->keys);
+	free(f->data);
+	free(f->index);
+	free(f->block);
+	free(f);
+}
+
+/*
+ * index of the first key not less than key
+ * return AVL_FROZEN_SIZE(f) if there is none
+ */
+size_t avl_frozen_lower_bound(const avlfrozen *f, long long key)
+{
+	size_t k, b, i;
+
+	/* find the first block whose largest key is not less than key */
+	k = 1;
+	while (k <= f->nblocks) {
+		PREFETCH(f->index + k * AVL_FROZEN_BLOCK); /* three levels ahead, one cache line */
+		k = 2 * k + (f->index[k] < key);
+	}
+	k >>= __builtin_ffsll(~k); /* undo the right turns taken after the last left turn */
+
+	if (k == 0)
+		return f->n; /* all keys are smaller */
+
+	b = f->block[k];
+	i = b * AVL_FROZEN_BLOCK + count_less(f->keys + b * AVL_FROZEN_BLOCK, key);
+
+	return (i < f->n) ? i : f->n;
+}
+
+/*
+ * look up
+ * return NULL if not found
+ */
+void *avl_frozen_find(const avlfrozen *f, long long key)
+{
+	size_t i;
+
+	i = avl_frozen_lower_bound(f, key);
+	return (i < f->n && f->keys[i] == key) ? f->data[i] : NULL;
+}
+
+/*
+ * apply func to the data of every key in [lo, hi), in order
+ * return non-zero if error
+ */
+int avl_frozen_range(const avlfrozen *f, long long lo, long long hi, int (*func)(void *, void *), void *cookie)
+{
+	size_t i;
+	int err;
+
+	for (i = avl_frozen_lower_bound(f, lo); i < f->n && f->keys[i] < hi; i++)
+		if ((err = func(f->data[i], cookie)) != 0)
+			return err;
+
+	return 0;
+}
+
+/*
+ * copy keys and data in order
+ * return the next free index
+ */
+size_t collect(avltree *avlt, avlnode *n, avlfrozen *f, size_t i, long long (*key_func)(const void *))
+{
+	if (n != AVL_NIL(avlt)) {
+		i = collect(avlt, n->left, f, i, key_func);
+		if (!AVL_DEAD(n)) {
+			f->keys[i] = key_func(n->data);
+			f->data[i++] = n->data;
+		}
+		i = collect(avlt, n->right, f, i, key_func);
+	}
+	return i;
+}
+
+/*
+ * lay out block maxima in BFS order by an in-order walk of the implicit tree
+ * return the next block number
+ */
+size_t eytzinger(avlfrozen *f, size_t i, size_t k)
+{
+	if (k <= f->nblocks) {
+		i = eytzinger(f, i, 2 * k);
+		f->index[k] = f->keys[i * AVL_FROZEN_BLOCK + AVL_FROZEN_BLOCK - 1];
+		f->block[k] = (unsigned int) i;
+		i = eytzinger(f, i + 1, 2 * k + 1);
+	}
+	return i;
+}
+
+/*
+ * number of keys in a block less than key
+ */
+int count_less(const long long *block, long long key)
+{
+	#if defined(__AVX2__)
+	__m256i k = _mm256_set1_epi64x(key);
+	__m256i lo = _mm256_cmpgt_epi64(k, _mm256_load_si256((const __m256i *) block));
+	__m256i hi = _mm256_cmpgt_epi64(k, _mm256_load_si256((const __m256i *) (block + 4)));
+	return __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lo))) +
+		__builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(hi)));
+	#elif defined(__SSE4_2__)
+	__m128i k = _mm_set1_epi64x(key);
+	int i, count = 0;
+	for (i = 0; i < AVL_FROZEN_BLOCK; i += 2) {
+		__m128i m = _mm_cmpgt_epi64(k, _mm_load_si128((const __m128i *) (block + i)));
+		count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(m)));
+	}
+	return count;
+	#else
+	int i, count = 0;
+	for (i = 0; i < AVL_FROZEN_BLOCK; i++)
+		count += (block[i] < key);
+	return count;
+	#endif
+}
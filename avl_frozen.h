@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#ifndef _AVL_FROZEN_HEADER
+#define _AVL_FROZEN_HEADER
+
+#include <stddef.h>
+#include "avl_bf.h"
+
+/*
+ * frozen snapshot: an immutable search structure built from an AVL tree in O(n)
+ *
+ * keys are extracted with a user callback into one sorted array, split into blocks of
+ * AVL_FROZEN_BLOCK keys (one cache line); the largest key of every block is kept in an
+ * Eytzinger (BFS order) array. a lookup descends the Eytzinger array without branches on
+ * the comparison result, then counts the smaller keys of a single block with SIMD compares.
+ *
+ * the snapshot references node->data but does not own it
+ */
+
+#define AVL_FROZEN_BLOCK 8
+
+typedef struct {
+	size_t n; /* number of keys */
+	size_t nblocks;
+	long long *keys; /* sorted, nblocks * AVL_FROZEN_BLOCK, padded with LLONG_MAX */
+	void **data; /* data[i] belongs to keys[i] */
+	long long *index; /* Eytzinger array of block maxima, 1-based */
+	unsigned int *block; /* block number of index[k] */
+} avlfrozen;
+
+#define AVL_FROZEN_SIZE(f) ((f)->n)
+#define AVL_FROZEN_KEY(f, i) ((f)->keys[i])
+#define AVL_FROZEN_DATA(f, i) ((f)->data[i])
+
+avlfrozen *avl_freeze(avltree *avlt, long long (*key_func)(const void *));
+void avl_frozen_destroy(avlfrozen *f);
+
+size_t avl_frozen_lower_bound(const avlfrozen *f, long long key);
+void *avl_frozen_find(const avlfrozen *f, long long key);
+int avl_frozen_range(const avlfrozen *f, long long lo, long long hi, int (*func)(void *, void *), void *cookie);
+
+#endif /* _AVL_FROZEN_HEADER */
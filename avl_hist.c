@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "avl_hist.h"
+
+#define SUB_COUNT (1ULL << AVL_HIST_SUB_BITS)
+
+static int bucket_index(unsigned long long value);
+static unsigned long long bucket_value(int index);
+
+/*
+ * reset
+ */
+void avl_hist_init(avlhist *h)
+{
+	memset(h, 0, sizeof(avlhist));
+	h->min = ~0ULL;
+}
+
+/*
+ * record one value
+ */
+void avl_hist_record(avlhist *h, unsigned long long value)
+{
+	h->buckets[bucket_index(value)]++;
+	h->count++;
+	h->sum += value;
+	if (value < h->min)
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+}
+
+/*
+ * add src to dst, e.g. to combine per-thread histograms
+ */
+void avl_hist_merge(avlhist *dst, const avlhist *src)
+{
+	int i;
+
+	for (i = 0; i < AVL_HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/*
+ * value at or below which a fraction p (0..1) of the recorded values lie
+ * return the upper bound of the bucket, never more than max
+ * return 0 if empty
+ */
+unsigned long long avl_hist_percentile(const avlhist *h, double p)
+{
+	unsigned long long rank, seen;
+	int i;
+
+	if (h->count == 0)
+		return 0;
+
+	if (p >= 1.0)
+		return h->max;
+	rank = (unsigned long long) (p * h->count);
+	if (rank >= h->count)
+		rank = h->count - 1;
+
+	for (i = 0, seen = 0; i < AVL_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > rank) {
+			unsigned long long v = bucket_value(i);
+			return (v > h->max) ? h->max : v;
+		}
+	}
+
+	return h->max;
+}
+
+/*
+ * print p50/p99/p999/max
+ */
+void avl_hist_print(const avlhist *h, const char *label)
+{
+	printf("%-10s count=%llu mean=%.1f p50=%llu p99=%llu p999=%llu max=%llu\n", label, h->count,
+		h->count ? (double) h->sum / h->count : 0.0,
+		avl_hist_percentile(h, 0.50), avl_hist_percentile(h, 0.99), avl_hist_percentile(h, 0.999), h->max);
+}
+
+/*
+ * map value to bucket
+ */
+int bucket_index(unsigned long long value)
+{
+	int e;
+
+	if (value < SUB_COUNT)
+		return (int) value;
+
+	e = 63 - __builtin_clzll(value); /* e >= AVL_HIST_SUB_BITS */
+	return (int) (((e - AVL_HIST_SUB_BITS + 1) << AVL_HIST_SUB_BITS) + ((value >> (e - AVL_HIST_SUB_BITS)) & (SUB_COUNT - 1)));
+}
+
+/*
+ * largest value mapped to bucket
+ */
+unsigned long long bucket_value(int index)
+{
+	int e;
+	unsigned long long m;
+
+	if ((unsigned long long) index < SUB_COUNT)
+		return (unsigned long long) index;
+
+	e = (index >> AVL_HIST_SUB_BITS) + AVL_HIST_SUB_BITS - 1;
+	m = index & (SUB_COUNT - 1);
+	return ((SUB_COUNT + m) << (e - AVL_HIST_SUB_BITS)) + (1ULL << (e - AVL_HIST_SUB_BITS)) - 1;
+}
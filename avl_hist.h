@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#ifndef _AVL_HIST_HEADER
+#define _AVL_HIST_HEADER
+
+/*
+ * log-bucketed latency histogram
+ * values below 2^AVL_HIST_SUB_BITS are exact, larger values fall into one of
+ * 2^AVL_HIST_SUB_BITS buckets per power of two (relative error below 1/16)
+ */
+
+#define AVL_HIST_SUB_BITS 4
+#define AVL_HIST_BUCKETS ((64 - AVL_HIST_SUB_BITS + 1) << AVL_HIST_SUB_BITS)
+
+typedef struct {
+	unsigned long long count;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned long long sum;
+	unsigned long long buckets[AVL_HIST_BUCKETS];
+} avlhist;
+
+void avl_hist_init(avlhist *h);
+void avl_hist_record(avlhist *h, unsigned long long value);
+void avl_hist_merge(avlhist *dst, const avlhist *src);
+unsigned long long avl_hist_percentile(const avlhist *h, double p);
+void avl_hist_print(const avlhist *h, const char *label);
+
+/*
+ * cycle counter
+ * falls back to nanoseconds where no cycle counter is readable from user space
+ */
+#if defined(__x86_64__) || defined(__i386__)
+static inline unsigned long long avl_cycles(void)
+{
+	unsigned int lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long) hi << 32) | lo;
+}
+#elif defined(__aarch64__)
+static inline unsigned long long avl_cycles(void)
+{
+	unsigned long long v;
+	__asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (v));
+	return v;
+}
+#else
+#include <time.h>
+static inline unsigned long long avl_cycles(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#endif /* _AVL_HIST_HEADER */
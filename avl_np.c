@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#include <stdlib.h>
+#include "avl_np.h"
+
+static avlnpnode **link_of(avlnptree *t, avlnpnode **path, signed char *dir, int depth);
+static avlnpnode *rotate_left(avlnpnode *x);
+static avlnpnode *rotate_right(avlnpnode *x);
+static avlnpnode *fix_imbalance(avlnpnode *p);
+static void push_left(avlnpcursor *c, avlnpnode *n);
+static int check(avlnptree *t, avlnpnode *n, avlnpnode **prev);
+static void destroy(avlnptree *t, avlnpnode *n);
+
+/*
+ * construction
+ * return NULL if out of memory
+ */
+avlnptree *avlnp_create(int (*compare_func)(const void *, const void *), void (*destroy_func)(void *))
+{
+	avlnptree *t;
+
+	if ((t = (avlnptree *) malloc(sizeof(avlnptree))) == NULL)
+		return NULL; /* out of memory */
+
+	t->compare = compare_func;
+	t->destroy = destroy_func;
+	t->top = NULL;
+	t->count = 0;
+
+	return t;
+}
+
+/*
+ * destruction
+ */
+void avlnp_destroy(avlnptree *t)
+{
+	destroy(t, t->top);
+	free(t);
+}
+
+/*
+ * look up
+ * return NULL if not found
+ */
+avlnpnode *avlnp_find(avlnptree *t, void *data)
+{
+	avlnpnode *p;
+	int cmp;
+
+	for (p = t->top; p != NULL; p = (cmp < 0) ? p->left : p->right) {
+		if ((cmp = t->compare(data, p->data)) == 0)
+			return p;
+	}
+
+	return NULL;
+}
+
+/*
+ * insert, replacing the data of an equal key unless AVL_DUP is defined
+ * return NULL if out of memory
+ */
+avlnpnode *avlnp_insert(avlnptree *t, void *data)
+{
+	avlnpnode *path[AVLNP_MAX_HEIGHT];
+	signed char dir[AVLNP_MAX_HEIGHT];
+	avlnpnode **link, *p, *n;
+	int depth, cmp;
+
+	/* search, recording the path */
+
+	depth = 0;
+	for (link = &t->top; (p = *link) != NULL; link = (cmp < 0) ? &p->left : &p->right) {
+		cmp = t->compare(data, p->data);
+		#ifndef AVL_DUP
+		if (cmp == 0) {
+			t->destroy(p->data);
+			p->data = data;
+			return p; /* updated */
+		}
+		#endif
+		path[depth] = p;
+		dir[depth++] = (cmp < 0) ? -1 : 1;
+	}
+
+	if ((n = (avlnpnode *) malloc(sizeof(avlnpnode))) == NULL)
+		return NULL; /* out of memory */
+
+	n->left = n->right = NULL;
+	n->bf = 0;
+	n->data = data;
+	*link = n;
+	t->count++;
+
+	/* back up the path until a subtree keeps its height, at most one rotation */
+
+	while (depth-- > 0) {
+		p = path[depth];
+		p->bf += dir[depth];
+		if (p->bf == 0)
+			break; /* height unchanged */
+		if (p->bf == 2 || p->bf == -2) {
+			*link_of(t, path, dir, depth) = fix_imbalance(p);
+			break; /* height restored */
+		}
+	}
+
+	return n;
+}
+
+/*
+ * delete a node with the key of data and destroy its data
+ * return 1 if found, 0 if not
+ */
+int avlnp_erase(avlnptree *t, void *data)
+{
+	avlnpnode *path[AVLNP_MAX_HEIGHT];
+	signed char dir[AVLNP_MAX_HEIGHT];
+	avlnpnode *p, *n, *q;
+	void *old;
+	int depth, cmp;
+
+	depth = 0;
+	for (n = t->top; n != NULL; n = (cmp < 0) ? n->left : n->right) {
+		if ((cmp = t->compare(data, n->data)) == 0)
+			break;
+		path[depth] = n;
+		dir[depth++] = (cmp < 0) ? -1 : 1;
+	}
+	if (n == NULL)
+		return 0; /* not found */
+
+	/* with two children, the successor gives its data to n and is unlinked instead */
+
+	old = n->data;
+	if (n->left != NULL && n->right != NULL) {
+		path[depth] = n;
+		dir[depth++] = 1;
+		for (p = n->right; p->left != NULL; p = p->left) {
+			path[depth] = p;
+			dir[depth++] = -1;
+		}
+		n->data = p->data;
+		n = p;
+	}
+
+	*link_of(t, path, dir, depth) = (n->left != NULL) ? n->left : n->right;
+	t->destroy(old);
+	free(n);
+	t->count--;
+
+	/* back up the path while subtrees lose height, rotating where they go out of balance */
+
+	while (depth-- > 0) {
+		p = path[depth];
+		p->bf -= dir[depth];
+		if (p->bf == 1 || p->bf == -1)
+			break; /* height unchanged */
+		if (p->bf == 2 || p->bf == -2) {
+			q = fix_imbalance(p);
+			*link_of(t, path, dir, depth) = q;
+			if (q->bf != 0)
+				break; /* height unchanged */
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * position c on the minimal node
+ * return NULL if the tree is empty
+ */
+avlnpnode *avlnp_first(avlnptree *t, avlnpcursor *c)
+{
+	c->depth = 0;
+	push_left(c, t->top);
+
+	return (c->depth > 0) ? c->stack[c->depth - 1] : NULL;
+}
+
+/*
+ * position c on the first node not smaller than data
+ * return NULL if none
+ */
+avlnpnode *avlnp_seek(avlnptree *t, avlnpcursor *c, void *data)
+{
+	avlnpnode *p;
+
+	c->depth = 0;
+	for (p = t->top; p != NULL; ) {
+		if (t->compare(data, p->data) <= 0) {
+			c->stack[c->depth++] = p; /* p is a candidate, smaller ones are left */
+			p = p->left;
+		} else {
+			p = p->right;
+		}
+	}
+
+	return (c->depth > 0) ? c->stack[c->depth - 1] : NULL;
+}
+
+/*
+ * move c to the next larger node
+ * return NULL if none
+ */
+avlnpnode *avlnp_next(avlnpcursor *c)
+{
+	avlnpnode *n;
+
+	if (c->depth == 0)
+		return NULL;
+
+	n = c->stack[--c->depth];
+	push_left(c, n->right);
+
+	return (c->depth > 0) ? c->stack[c->depth - 1] : NULL;
+}
+
+/*
+ * check order, balance factors and heights
+ * return 1 if valid
+ */
+int avlnp_check(avlnptree *t)
+{
+	avlnpnode *prev = NULL;
+
+	return check(t, t->top, &prev) >= 0;
+}
+
+/*
+ * return the link to the node at depth on path: the top, or a child of the node above
+ */
+avlnpnode **link_of(avlnptree *t, avlnpnode **path, signed char *dir, int depth)
+{
+	if (depth == 0)
+		return &t->top;
+
+	return (dir[depth - 1] < 0) ? &path[depth - 1]->left : &path[depth - 1]->right;
+}
+
+/*
+ * rotate left, the caller relinks the new root
+ * return the new root
+ */
+avlnpnode *rotate_left(avlnpnode *x)
+{
+	avlnpnode *y = x->right;
+
+	x->right = y->left;
+	y->left = x;
+
+	return y;
+}
+
+/*
+ * rotate right, the caller relinks the new root
+ * return the new root
+ */
+avlnpnode *rotate_right(avlnpnode *x)
+{
+	avlnpnode *y = x->left;
+
+	x->left = y->right;
+	y->right = x;
+
+	return y;
+}
+
+/*
+ * fix a balance factor of 2 or -2 by a single or double rotation, after insert or delete;
+ * after a delete, the height of the subtree is unchanged if the new root is not balanced
+ * return the new root
+ */
+avlnpnode *fix_imbalance(avlnpnode *p)
+{
+	avlnpnode *c, *g;
+
+	if (p->bf == 2) {
+		c = p->right;
+		if (c->bf >= 0) { /* 1, 1 or 0, 1 */
+			p = rotate_left(p);
+			if (c->bf == 0) {
+				p->bf = -1;
+				p->left->bf = 1;
+			} else {
+				p->bf = p->left->bf = 0;
+			}
+			return p;
+		}
+		g = c->left; /* -1, 1 */
+		p->right = rotate_right(c);
+		p = rotate_left(p);
+	} else {
+		c = p->left;
+		if (c->bf <= 0) { /* -1, -1 or 0, -1 */
+			p = rotate_right(p);
+			if (c->bf == 0) {
+				p->bf = 1;
+				p->right->bf = -1;
+			} else {
+				p->bf = p->right->bf = 0;
+			}
+			return p;
+		}
+		g = c->right; /* 1, -1 */
+		p->left = rotate_left(c);
+		p = rotate_right(p);
+	}
+
+	p->left->bf = (g->bf == 1) ? -1 : 0;
+	p->right->bf = (g->bf == -1) ? 1 : 0;
+	p->bf = 0;
+
+	return p;
+}
+
+/*
+ * push n and its left descendants on c
+ */
+void push_left(avlnpcursor *c, avlnpnode *n)
+{
+	for ( ; n != NULL; n = n->left)
+		c->stack[c->depth++] = n;
+}
+
+/*
+ * return the height of n, -1 if invalid; prev is the last node visited in order
+ */
+int check(avlnptree *t, avlnpnode *n, avlnpnode **prev)
+{
+	int hl, hr;
+
+	if (n == NULL)
+		return 0;
+
+	if ((hl = check(t, n->left, prev)) < 0)
+		return -1;
+	if (*prev != NULL && t->compare((*prev)->data, n->data) > 0)
+		return -1;
+	*prev = n;
+	if ((hr = check(t, n->right, prev)) < 0)
+		return -1;
+
+	if (hr - hl != n->bf || n->bf < -1 || n->bf > 1)
+		return -1;
+
+	return (hl > hr ? hl : hr) + 1;
+}
+
+/*
+ * destroy n and its subtrees
+ */
+void destroy(avlnptree *t, avlnpnode *n)
+{
+	if (n != NULL) {
+		destroy(t, n->left);
+		destroy(t, n->right);
+		t->destroy(n->data);
+		free(n);
+	}
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#ifndef _AVL_NP_HEADER
+#define _AVL_NP_HEADER
+
+#include "avl_bf.h"
+
+/*
+ * AVL tree without parent pointers
+ *
+ * insert and erase record the search path in a stack, AVL height being bounded, and rebalance
+ * back up it; iteration uses a cursor carrying its own stack. a node is three words and a byte,
+ * and a rotation writes two links instead of up to six, at the cost of iterating by cursor.
+ * AVL_DUP is honoured, other build options are not. a cursor is invalidated by any change
+ * to the tree, and erase may move data between nodes, so node handles are not stable
+ */
+
+#define AVLNP_MAX_HEIGHT 96 /* height bound of any AVL tree with fewer than 2^64 nodes */
+
+typedef struct avlnpnode {
+	struct avlnpnode *left; /* NULL if none */
+	struct avlnpnode *right;
+	signed char bf;
+	void *data;
+} avlnpnode;
+
+typedef struct {
+	int (*compare)(const void *, const void *);
+	void (*destroy)(void *);
+	avlnpnode *top; /* NULL if empty */
+	unsigned long count;
+} avlnptree;
+
+typedef struct {
+	avlnpnode *stack[AVLNP_MAX_HEIGHT]; /* path to the current node, on top */
+	int depth;
+} avlnpcursor;
+
+#define AVLNP_COUNT(t) ((t)->count)
+#define AVLNP_ISEMPTY(t) ((t)->top == NULL)
+
+avlnptree *avlnp_create(int (*compare_func)(const void *, const void *), void (*destroy_func)(void *));
+void avlnp_destroy(avlnptree *t);
+
+avlnpnode *avlnp_find(avlnptree *t, void *data);
+avlnpnode *avlnp_insert(avlnptree *t, void *data);
+int avlnp_erase(avlnptree *t, void *data);
+
+avlnpnode *avlnp_first(avlnptree *t, avlnpcursor *c);
+avlnpnode *avlnp_seek(avlnptree *t, avlnpcursor *c, void *data);
+avlnpnode *avlnp_next(avlnpcursor *c);
+
+int avlnp_check(avlnptree *t);
+
+#endif /* _AVL_NP_HEADER */
@@ -0,0 +1,1018 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "avl_parallel.h"
+
+#define MAX_THREADS 256
+#define INSERTION_SORT 16 /* runs sorted by insertion before merging */
+
+/*
+ * tasks 0 .. ntasks - 1 of a job, taken by threads from a shared counter
+ */
+typedef struct {
+	void (*run)(void *, int);
+	void *job;
+	int ntasks;
+	int next; /* first task not taken */
+	pthread_mutex_t lock;
+} avlpool;
+
+/*
+ * a whole subtree, or a single node above the split depth
+ */
+typedef struct {
+	avlnode *node;
+	int whole;
+	void *local;
+	int err;
+} avltask;
+
+typedef struct {
+	avltree *avlt;
+	avltask *tasks;
+	int stop; /* set on error, no more tasks are run */
+	pthread_mutex_t lock;
+
+	enum avlmerge merge;
+	void *(*init)(void *);
+	int (*func)(void *, void *);
+	int (*reduce)(void *, void *);
+	void *cookie;
+} avlapplyjob;
+
+/*
+ * sort: chunks sorted separately, then merged pairwise round by round
+ * link: the subtrees at the split depth, each over a range of the sorted nodes
+ */
+typedef struct {
+	avltree *avlt;
+	void **src;
+	void **dst;
+	unsigned long *bounds; /* chunk i is [bounds[i], bounds[i + 1]) */
+	int width; /* chunks per run in this merge round */
+	int nchunks;
+
+	avlnode *nodes;
+	unsigned long (*ranges)[2]; /* subtree ranges */
+} avlbuildjob;
+
+/*
+ * clone: the subtrees at the split depth, counted first to place each one in the slab
+ */
+typedef struct {
+	avltree *avlt;
+	avltree *copy;
+	void *(*copy_func)(void *);
+	avlnode *nodes;
+	unsigned long used; /* slots taken by the nodes above the split depth */
+	unsigned long live; /* nodes copied above the split depth */
+	unsigned long top_bytes; /* of the buckets copied above the split depth */
+
+	avlnode **roots; /* subtrees to copy */
+	avlnode **links; /* where to link their copies */
+	unsigned long *offsets; /* size of a subtree, then its first slot */
+	unsigned long *copied;
+	unsigned long *bytes; /* of the buckets copied by a task */
+} avlclonejob;
+
+struct avlreclaimer {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	avlreclaim *head; /* queue of detached trees */
+	avlreclaim *tail;
+	int stop; /* set by avl_reclaimer_destroy, the queue is drained first */
+};
+
+static int threads(int nthreads);
+static void run_tasks(int nthreads, int ntasks, void (*run)(void *, int), void *job);
+static void *pool_worker(void *arg);
+
+static void split(avltree *avlt, avlnode *n, int depth, avltask *tasks, int *k);
+static void apply_task(void *arg, int i);
+
+static void sort_task(void *arg, int i);
+static void merge_task(void *arg, int i);
+static void merge(avltree *avlt, void **a, unsigned long na, void **b, unsigned long nb, void **out);
+static unsigned long group(avltree *avlt, void **data, unsigned long n, unsigned long i);
+static int height(unsigned long size);
+static avlnode *link_top(avltree *avlt, avlbuildjob *job, unsigned long lo, unsigned long hi, avlnode *parent, \
+	int depth, int *k);
+static void link_task(void *arg, int i);
+static avlnode *link_range(avltree *avlt, avlnode *nodes, unsigned long lo, unsigned long hi, avlnode *parent);
+#ifdef AVL_AUGMENT
+static void augment_top(avltree *avlt, avlnode *n, int depth);
+#endif
+
+static avlnode *clone_node(avlclonejob *job, avlnode *n, avlnode *m, avlnode *parent, unsigned long *bytes);
+static avlnode *clone_top(avlclonejob *job, avlnode *n, avlnode *parent, int depth, int *k);
+static void size_task(void *arg, int i);
+static unsigned long size(avltree *avlt, avlnode *n);
+static void clone_task(void *arg, int i);
+static avlnode *clone_range(avlclonejob *job, avlnode *n, avlnode *parent, unsigned long *slot, unsigned long *copied, \
+	unsigned long *bytes);
+#ifdef AVL_MULTISET
+static void *bucket_alloc(const avlallocator *allocator, size_t size);
+static void bucket_free(const avlallocator *allocator, void *p, size_t size);
+#endif
+
+static void *reclaimer(void *arg);
+
+static void adopt_slab(avltree *avlt, avlslab *slab, unsigned long size, unsigned long used, unsigned long live);
+
+/*
+ * apply func to the data of every node on nthreads threads (0 for one per processor),
+ * in key order within a task; init_func (may be NULL, then every task shares cookie) creates
+ * the local state of a task, reduce_func (may be NULL) merges it into cookie and releases it
+ * a task stops at the first non-zero return of func, and no further tasks are started
+ * return the first error in key order, -1 if init_func returns NULL or out of memory
+ */
+int avl_apply_parallel(avltree *avlt, int nthreads, enum avlmerge merge, void *(*init_func)(void *), \
+	int (*func)(void *, void *), int (*reduce_func)(void *, void *), void *cookie)
+{
+	avlapplyjob job;
+	int depth, ntasks, i, err;
+
+	nthreads = threads(nthreads);
+
+	for (depth = 0; (1 << depth) < nthreads * AVL_TASKS_PER_THREAD; depth++) ;
+
+	job.tasks = (avltask *) malloc(((size_t) 2 << depth) * sizeof(avltask));
+	if (job.tasks == NULL)
+		return -1; /* out of memory */
+
+	ntasks = 0;
+	split(avlt, AVL_FIRST(avlt), depth, job.tasks, &ntasks);
+
+	job.avlt = avlt;
+	job.stop = 0;
+	job.merge = merge;
+	job.init = init_func;
+	job.func = func;
+	job.reduce = reduce_func;
+	job.cookie = cookie;
+	pthread_mutex_init(&job.lock, NULL);
+
+	run_tasks(nthreads, ntasks, apply_task, &job);
+
+	pthread_mutex_destroy(&job.lock);
+
+	err = 0;
+	for (i = 0; i < ntasks; i++) {
+		if (merge == AVL_ORDERED && init_func != NULL && job.tasks[i].local != NULL && reduce_func != NULL) {
+			int rc = reduce_func(cookie, job.tasks[i].local);
+			if (job.tasks[i].err == 0)
+				job.tasks[i].err = rc;
+		}
+		if (err == 0)
+			err = job.tasks[i].err;
+	}
+
+	free(job.tasks);
+
+	return err;
+}
+
+/*
+ * build avlt, which must be empty, from n values in any order on nthreads threads (0 for one per processor)
+ * the values are sorted with a parallel merge sort into one slab and the balanced subtrees are linked in parallel;
+ * equal keys are kept in input order if AVL_DUP is defined, share a node in multiset mode, and otherwise the last
+ * one is kept and the others are destroyed, as if inserted one by one
+ * data is reordered
+ * return non-zero if out of memory or avlt is not empty (the tree is unchanged)
+ */
+int avl_build_parallel(avltree *avlt, void **data, unsigned long n, int nthreads)
+{
+	avlbuildjob job;
+	avlslab *slab;
+	void **tmp, **sorted;
+	unsigned long u, i, j;
+	int depth, ntasks, k;
+
+	if (!AVL_ISEMPTY(avlt))
+		return -1;
+	if (n == 0)
+		return 0;
+
+	nthreads = threads(nthreads);
+
+	job.nchunks = (n < (unsigned long) nthreads * INSERTION_SORT) ? 1 : nthreads;
+	for (depth = 0; (1 << depth) < nthreads * AVL_TASKS_PER_THREAD; depth++) ;
+
+	tmp = (void **) malloc(n * sizeof(void *));
+	job.bounds = (unsigned long *) malloc((job.nchunks + 1) * sizeof(unsigned long));
+	job.ranges = (unsigned long (*)[2]) malloc(((size_t) 1 << depth) * sizeof(job.ranges[0]));
+	if (tmp == NULL || job.bounds == NULL || job.ranges == NULL)
+		goto err; /* out of memory */
+
+	/* sort chunks in place, then merge pairs of runs until one is left */
+
+	job.avlt = avlt;
+	for (k = 0; k <= job.nchunks; k++)
+		job.bounds[k] = n * k / job.nchunks;
+	job.src = data;
+	job.dst = tmp;
+	run_tasks(nthreads, job.nchunks, sort_task, &job);
+
+	for (job.width = 1; job.width < job.nchunks; job.width *= 2) {
+		void **swap;
+		run_tasks(nthreads, (job.nchunks + 2 * job.width - 1) / (2 * job.width), merge_task, &job);
+		swap = job.src;
+		job.src = job.dst;
+		job.dst = swap;
+	}
+	sorted = job.src;
+
+	/* one node per group of equal keys */
+
+	u = 0;
+	for (i = 0; i < n; i = group(avlt, sorted, n, i))
+		u++;
+
+	slab = (avlslab *) avl_alloc(avlt, sizeof(avlslab) + u * sizeof(avlnode));
+	if (slab == NULL)
+		goto err; /* out of memory */
+
+	job.nodes = slab->nodes;
+	for (i = j = 0; i < n; j++) {
+		unsigned long end = group(avlt, sorted, n, i);
+
+		#ifdef AVL_MULTISET
+		job.nodes[j].data = sorted[i];
+		job.nodes[j].bucket = NULL;
+		if (end - i > 1) {
+			avlbucket *b = (avlbucket *) avl_alloc(avlt, AVL_BUCKET_BYTES(end - i - 1));
+			if (b == NULL) {
+				while (j-- > 0)
+					if (job.nodes[j].bucket != NULL)
+						avl_free(avlt, job.nodes[j].bucket, AVL_BUCKET_BYTES(job.nodes[j].bucket->size));
+				avl_free(avlt, slab, sizeof(avlslab) + u * sizeof(avlnode));
+				goto err; /* out of memory */
+			}
+			b->count = b->size = end - i - 1;
+			memcpy(b->data, sorted + i + 1, b->count * sizeof(void *));
+			job.nodes[j].bucket = b;
+		}
+		#else
+		job.nodes[j].data = sorted[end - 1];
+		#endif
+
+		i = end;
+	}
+
+	#if !defined(AVL_DUP) && !defined(AVL_MULTISET)
+	/* replaced values, destroyed only once nothing can fail */
+	for (i = 0; i < n; i = j) {
+		for (j = group(avlt, sorted, n, i); i < j - 1; i++)
+			avlt->destroy(sorted[i]);
+	}
+	#endif
+
+	/* link the top levels here, the subtrees below them in parallel */
+
+	ntasks = 0;
+	AVL_FIRST(avlt) = link_top(avlt, &job, 0, u, AVL_ROOT(avlt), depth, &ntasks);
+	run_tasks(nthreads, ntasks, link_task, &job);
+
+	#ifdef AVL_AUGMENT
+	if (avlt->combine != NULL)
+		augment_top(avlt, AVL_FIRST(avlt), depth);
+	#endif
+
+	adopt_slab(avlt, slab, u, u, u);
+
+	#ifdef AVL_MIN
+	avlt->min = &job.nodes[0];
+	#endif
+	avlt->count = u;
+
+	if (avlt->engine == AVL_WAVL) { /* linked with balance factors, ranked from them */
+		avlt->engine = AVL_BF;
+		avl_set_engine(avlt, AVL_WAVL);
+	}
+
+	#ifdef AVL_BLOOM
+	/* refilled for the new keys; left unfiltered, which is still correct, if out of memory */
+	if (avlt->bloom != NULL)
+		avl_set_bloom(avlt, avlt->bloom_hash, 0);
+	#endif
+
+	free(tmp);
+	free(job.bounds);
+	free(job.ranges);
+	return 0;
+
+err:
+	free(tmp);
+	free(job.bounds);
+	free(job.ranges);
+	return -1;
+}
+
+/*
+ * avl_clone on nthreads threads (0 for one per processor), copy_func must be thread-safe,
+ * as must the allocator of avlt in multiset mode, the buckets are allocated by the threads
+ * the subtrees below the top levels are counted, then copied in parallel into one slab
+ * return NULL if out of memory or copy_func returns NULL
+ */
+avltree *avl_clone_parallel(avltree *avlt, void *(*copy_func)(void *), int nthreads)
+{
+	avlclonejob job;
+	avlslab *slab;
+	unsigned long total, live;
+	int depth, ntasks, i;
+
+	nthreads = threads(nthreads);
+	if (nthreads == 1 || avlt->count == 0)
+		return avl_clone(avlt, copy_func);
+
+	for (depth = 0; (1 << depth) < nthreads * AVL_TASKS_PER_THREAD; depth++) ;
+
+	slab = NULL;
+	job.roots = (avlnode **) malloc(((size_t) 1 << depth) * sizeof(avlnode *));
+	job.links = (avlnode **) malloc(((size_t) 1 << depth) * sizeof(avlnode *));
+	job.offsets = (unsigned long *) malloc(((size_t) 1 << depth) * sizeof(unsigned long));
+	job.copied = (unsigned long *) calloc((size_t) 1 << depth, sizeof(unsigned long));
+	job.bytes = (unsigned long *) calloc((size_t) 1 << depth, sizeof(unsigned long));
+	job.copy = avl_create_with(avlt->compare, avlt->destroy, avlt->allocator);
+	if (job.copy != NULL)
+		slab = (avlslab *) avl_alloc(job.copy, sizeof(avlslab) + avlt->count * sizeof(avlnode));
+	if (job.roots == NULL || job.links == NULL || job.offsets == NULL || job.copied == NULL || job.bytes == NULL || \
+		job.copy == NULL || \
+		slab == NULL)
+		goto err; /* out of memory */
+
+	job.copy->arena = avlt->arena;
+	job.copy->limit = avlt->limit;
+	job.copy->engine = avlt->engine;
+
+	#ifdef AVL_PREFIX
+	job.copy->normalize = avlt->normalize;
+	#endif
+
+	#ifdef AVL_AUGMENT
+	job.copy->combine = avlt->combine;
+	job.copy->nil.aux = avlt->nil.aux;
+	#endif
+
+	#ifdef AVL_LAZY
+	job.copy->lazy = avlt->lazy;
+	#endif
+
+	#ifdef AVL_CACHE
+	if (avlt->hash != NULL && avl_set_cache(job.copy, avlt->hash, avlt->cache_mask + 1) != 0)
+		goto err; /* out of memory */
+	#endif
+
+	/* copy the top levels, then count the subtrees below them to lay them out one after another */
+
+	job.avlt = avlt;
+	job.copy_func = copy_func;
+	job.nodes = slab->nodes;
+	job.used = job.live = job.top_bytes = 0;
+	ntasks = 0;
+	AVL_FIRST(job.copy) = clone_top(&job, AVL_FIRST(avlt), AVL_ROOT(job.copy), depth, &ntasks);
+
+	run_tasks(nthreads, ntasks, size_task, &job);
+	for (total = job.used, i = 0; i < ntasks; i++) {
+		unsigned long n = job.offsets[i];
+		job.offsets[i] = total;
+		total += n;
+	}
+
+	run_tasks(nthreads, ntasks, clone_task, &job);
+
+	for (live = job.live, i = 0; i < ntasks; i++)
+		live += job.copied[i];
+	for (job.copy->bytes += job.top_bytes, i = 0; i < ntasks; i++)
+		job.copy->bytes += job.bytes[i]; /* the buckets are freed through the copy from now on */
+	adopt_slab(job.copy, slab, avlt->count, total, live); /* fewer used if copy_func failed */
+	slab = NULL;
+	if (live != avlt->count)
+		goto err; /* copy_func failed, the nodes copied so far are destroyed */
+
+	job.copy->count = avlt->count;
+	#ifdef AVL_LAZY
+	job.copy->tombstones = avlt->tombstones; /* copied as they are */
+	#endif
+
+	#ifdef AVL_BLOOM
+	if (avlt->bloom != NULL && avl_set_bloom(job.copy, avlt->bloom_hash, AVL_BLOOM_CAPACITY(avlt)) != 0)
+		goto err; /* out of memory */
+	#endif
+
+	free(job.roots);
+	free(job.links);
+	free(job.offsets);
+	free(job.copied);
+	free(job.bytes);
+	return job.copy;
+
+err:
+	if (slab != NULL)
+		avl_free(job.copy, slab, sizeof(avlslab) + avlt->count * sizeof(avlnode));
+	if (job.copy != NULL)
+		avl_destroy(job.copy);
+	free(job.roots);
+	free(job.links);
+	free(job.offsets);
+	free(job.copied);
+	free(job.bytes);
+	return NULL;
+}
+
+/*
+ * start a background reclaimer
+ * return NULL if out of memory or the thread cannot be started
+ */
+avlreclaimer *avl_reclaimer_create(void)
+{
+	avlreclaimer *rc;
+
+	if ((rc = (avlreclaimer *) malloc(sizeof(avlreclaimer))) == NULL)
+		return NULL; /* out of memory */
+
+	rc->head = rc->tail = NULL;
+	rc->stop = 0;
+	pthread_mutex_init(&rc->lock, NULL);
+	pthread_cond_init(&rc->wake, NULL);
+
+	if (pthread_create(&rc->thread, NULL, reclaimer, rc) != 0) {
+		pthread_cond_destroy(&rc->wake);
+		pthread_mutex_destroy(&rc->lock);
+		free(rc);
+		return NULL;
+	}
+
+	return rc;
+}
+
+/*
+ * hand r, from avl_detach, over to the reclaimer, in O(1)
+ * nodes from an arena are refused: the arena is single-threaded and the owner may still
+ * take nodes from it, so r is left to avl_reclaim on the thread using the arena
+ * return non-zero if refused
+ */
+int avl_reclaimer_push(avlreclaimer *rc, avlreclaim *r)
+{
+	if (r->arena != NULL)
+		return -1; /* would race with the owner of the arena */
+
+	r->queue = NULL;
+
+	pthread_mutex_lock(&rc->lock);
+	if (rc->tail != NULL)
+		rc->tail->queue = r;
+	else
+		rc->head = r;
+	rc->tail = r;
+	pthread_cond_signal(&rc->wake);
+	pthread_mutex_unlock(&rc->lock);
+
+	return 0;
+}
+
+/*
+ * free the trees still queued, then stop the reclaimer
+ */
+void avl_reclaimer_destroy(avlreclaimer *rc)
+{
+	pthread_mutex_lock(&rc->lock);
+	rc->stop = 1;
+	pthread_cond_signal(&rc->wake);
+	pthread_mutex_unlock(&rc->lock);
+
+	pthread_join(rc->thread, NULL);
+
+	pthread_cond_destroy(&rc->wake);
+	pthread_mutex_destroy(&rc->lock);
+	free(rc);
+}
+
+/*
+ * number of threads to run, at least 1
+ */
+int threads(int nthreads)
+{
+	if (nthreads <= 0)
+		nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+
+	return nthreads;
+}
+
+/*
+ * run tasks 0 .. ntasks - 1 of job on up to nthreads threads, the calling thread is one of them
+ */
+void run_tasks(int nthreads, int ntasks, void (*run)(void *, int), void *job)
+{
+	avlpool pool;
+	pthread_t tid[MAX_THREADS];
+	int started, i;
+
+	pool.run = run;
+	pool.job = job;
+	pool.ntasks = ntasks;
+	pool.next = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	if (nthreads > ntasks)
+		nthreads = ntasks;
+	for (started = 0; started < nthreads - 1; started++)
+		if (pthread_create(&tid[started], NULL, pool_worker, &pool) != 0)
+			break; /* go on with fewer threads */
+	pool_worker(&pool);
+	for (i = 0; i < started; i++)
+		pthread_join(tid[i], NULL);
+
+	pthread_mutex_destroy(&pool.lock);
+}
+
+/*
+ * take and run tasks until none is left
+ */
+void *pool_worker(void *arg)
+{
+	avlpool *pool = (avlpool *) arg;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		i = (pool->next == pool->ntasks) ? -1 : pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (i < 0)
+			break;
+		pool->run(pool->job, i);
+	}
+
+	return NULL;
+}
+
+/*
+ * tasks in key order: subtrees at depth, single nodes above
+ */
+void split(avltree *avlt, avlnode *n, int depth, avltask *tasks, int *k)
+{
+	if (n == AVL_NIL(avlt))
+		return;
+
+	if (depth == 0) {
+		tasks[*k].node = n;
+		tasks[*k].whole = 1;
+		tasks[*k].local = NULL;
+		tasks[*k].err = 0;
+		(*k)++;
+		return;
+	}
+
+	split(avlt, n->left, depth - 1, tasks, k);
+	tasks[*k].node = n;
+	tasks[*k].whole = 0;
+	tasks[*k].local = NULL;
+	tasks[*k].err = 0;
+	(*k)++;
+	split(avlt, n->right, depth - 1, tasks, k);
+}
+
+/*
+ * run an apply task, unless an error stopped the job
+ */
+void apply_task(void *arg, int i)
+{
+	avlapplyjob *job = (avlapplyjob *) arg;
+	avltask *t = &job->tasks[i];
+	int stop;
+
+	pthread_mutex_lock(&job->lock);
+	stop = job->stop;
+	pthread_mutex_unlock(&job->lock);
+	if (stop)
+		return;
+
+	if (job->init == NULL)
+		t->local = job->cookie;
+	else if ((t->local = job->init(job->cookie)) == NULL)
+		t->err = -1;
+
+	if (t->err == 0) {
+		if (t->whole)
+			t->err = avl_apply(job->avlt, t->node, job->func, t->local, INORDER);
+		else if (!AVL_DEAD(t->node))
+			t->err = job->func(t->node->data, t->local);
+	}
+
+	pthread_mutex_lock(&job->lock);
+	if (job->merge == AVL_UNORDERED && job->init != NULL && t->local != NULL && job->reduce != NULL) {
+		int rc = job->reduce(job->cookie, t->local);
+		if (t->err == 0)
+			t->err = rc;
+	}
+	if (t->err != 0)
+		job->stop = 1;
+	pthread_mutex_unlock(&job->lock);
+}
+
+/*
+ * stable merge sort of chunk i of src in place, dst is scratch space
+ */
+void sort_task(void *arg, int i)
+{
+	avlbuildjob *job = (avlbuildjob *) arg;
+	avltree *avlt = job->avlt;
+	void **a, **b, **swap;
+	unsigned long n, lo, width, j, k;
+
+	a = job->src + job->bounds[i];
+	b = job->dst + job->bounds[i];
+	n = job->bounds[i + 1] - job->bounds[i];
+
+	for (lo = 0; lo < n; lo += INSERTION_SORT) {
+		unsigned long hi = (lo + INSERTION_SORT < n) ? lo + INSERTION_SORT : n;
+		for (j = lo + 1; j < hi; j++) {
+			void *x = a[j];
+			for (k = j; k > lo && avlt->compare(x, a[k - 1]) < 0; k--)
+				a[k] = a[k - 1];
+			a[k] = x;
+		}
+	}
+
+	for (width = INSERTION_SORT; width < n; width *= 2) {
+		for (lo = 0; lo < n; lo += 2 * width) {
+			unsigned long mid = (lo + width < n) ? lo + width : n;
+			unsigned long hi = (lo + 2 * width < n) ? lo + 2 * width : n;
+			merge(avlt, a + lo, mid - lo, a + mid, hi - mid, b + lo);
+		}
+		swap = a;
+		a = b;
+		b = swap;
+	}
+
+	if (a != job->src + job->bounds[i])
+		memcpy(job->src + job->bounds[i], a, n * sizeof(void *));
+}
+
+/*
+ * merge the runs 2i and 2i + 1 of this round from src into dst
+ */
+void merge_task(void *arg, int i)
+{
+	avlbuildjob *job = (avlbuildjob *) arg;
+	int first, mid, last;
+
+	first = 2 * i * job->width;
+	mid = (first + job->width < job->nchunks) ? first + job->width : job->nchunks;
+	last = (first + 2 * job->width < job->nchunks) ? first + 2 * job->width : job->nchunks;
+
+	merge(job->avlt, job->src + job->bounds[first], job->bounds[mid] - job->bounds[first], \
+		job->src + job->bounds[mid], job->bounds[last] - job->bounds[mid], job->dst + job->bounds[first]);
+}
+
+/*
+ * stable merge of a and b into out
+ */
+void merge(avltree *avlt, void **a, unsigned long na, void **b, unsigned long nb, void **out)
+{
+	unsigned long i, j, k;
+
+	for (i = j = k = 0; i < na && j < nb; k++)
+		out[k] = (avlt->compare(b[j], a[i]) < 0) ? b[j++] : a[i++];
+	while (i < na)
+		out[k++] = a[i++];
+	while (j < nb)
+		out[k++] = b[j++];
+}
+
+/*
+ * end of the group of values sharing a node starting at i
+ */
+unsigned long group(avltree *avlt, void **data, unsigned long n, unsigned long i)
+{
+	#ifdef AVL_DUP
+	(void) avlt;
+	(void) data;
+	(void) n;
+	return i + 1;
+	#else
+	unsigned long j;
+
+	for (j = i + 1; j < n && avlt->compare(data[i], data[j]) == 0; j++) ;
+	return j;
+	#endif
+}
+
+/*
+ * height of a subtree of size nodes built by link_range
+ */
+int height(unsigned long size)
+{
+	int h;
+
+	for (h = 0; size != 0; size >>= 1)
+		h++;
+
+	return h;
+}
+
+/*
+ * link the nodes above depth, record the ranges below as tasks
+ * return the root of [lo, hi)
+ */
+avlnode *link_top(avltree *avlt, avlbuildjob *job, unsigned long lo, unsigned long hi, avlnode *parent, \
+	int depth, int *k)
+{
+	avlnode *n;
+	unsigned long mid;
+
+	if (lo == hi)
+		return AVL_NIL(avlt);
+
+	if (depth == 0) {
+		job->ranges[*k][0] = lo;
+		job->ranges[*k][1] = hi;
+		(*k)++;
+		n = &job->nodes[lo + (hi - lo) / 2]; /* root of the task, linked by link_range */
+		n->parent = parent;
+		return n;
+	}
+
+	mid = lo + (hi - lo) / 2;
+	n = &job->nodes[mid];
+	n->parent = parent;
+	n->left = link_top(avlt, job, lo, mid, n, depth - 1, k);
+	n->right = link_top(avlt, job, mid + 1, hi, n, depth - 1, k);
+	n->bf = height(hi - mid - 1) - height(mid - lo);
+	n->flags = AVL_POOLED;
+	#ifdef AVL_CACHE
+	n->cached = 0;
+	#endif
+	#ifdef AVL_PREFIX
+	n->prefix = avlt->normalize ? avlt->normalize(n->data) : 0;
+	#endif
+
+	return n;
+}
+
+/*
+ * link the subtree of task i
+ */
+void link_task(void *arg, int i)
+{
+	avlbuildjob *job = (avlbuildjob *) arg;
+	unsigned long lo = job->ranges[i][0], hi = job->ranges[i][1];
+	avlnode *n = &job->nodes[lo + (hi - lo) / 2];
+
+	link_range(job->avlt, job->nodes, lo, hi, n->parent);
+}
+
+/*
+ * link nodes [lo, hi) into a balanced subtree, the middle one at the root
+ * return the root
+ */
+avlnode *link_range(avltree *avlt, avlnode *nodes, unsigned long lo, unsigned long hi, avlnode *parent)
+{
+	avlnode *n;
+	unsigned long mid;
+
+	if (lo == hi)
+		return AVL_NIL(avlt);
+
+	mid = lo + (hi - lo) / 2;
+	n = &nodes[mid];
+	n->parent = parent;
+	n->left = link_range(avlt, nodes, lo, mid, n);
+	n->right = link_range(avlt, nodes, mid + 1, hi, n);
+	n->bf = height(hi - mid - 1) - height(mid - lo);
+	n->flags = AVL_POOLED;
+	#ifdef AVL_CACHE
+	n->cached = 0;
+	#endif
+	#ifdef AVL_PREFIX
+	n->prefix = avlt->normalize ? avlt->normalize(n->data) : 0;
+	#endif
+	#ifdef AVL_AUGMENT
+	if (avlt->combine != NULL)
+		avlt->combine(&n->aux, &n->left->aux, n, &n->right->aux);
+	#endif
+
+	return n;
+}
+
+#ifdef AVL_AUGMENT
+/*
+ * aggregates of the nodes above depth, once the subtrees below are done
+ */
+void augment_top(avltree *avlt, avlnode *n, int depth)
+{
+	if (n == AVL_NIL(avlt) || depth == 0)
+		return;
+
+	augment_top(avlt, n->left, depth - 1);
+	augment_top(avlt, n->right, depth - 1);
+	avlt->combine(&n->aux, &n->left->aux, n, &n->right->aux);
+}
+#endif
+
+/*
+ * copy the fields and data of n into m, add the bytes of its bucket to *bytes
+ * return m, NIL of the copy if copy_func fails (m is not linked then)
+ */
+avlnode *clone_node(avlclonejob *job, avlnode *n, avlnode *m, avlnode *parent, unsigned long *bytes)
+{
+	*m = *n; /* bf, flags, prefix and aux */
+	m->flags |= AVL_POOLED;
+	#ifdef AVL_CACHE
+	m->cached = 0; /* not in the cache of the copy */
+	#endif
+	m->parent = parent;
+	m->left = m->right = AVL_NIL(job->copy);
+	if ((m->data = job->copy_func(n->data)) == NULL)
+		return AVL_NIL(job->copy);
+
+	#ifdef AVL_MULTISET
+	if (n->bucket != NULL) {
+		unsigned long i;
+		m->bucket = (avlbucket *) bucket_alloc(job->copy->allocator, AVL_BUCKET_BYTES(n->bucket->count));
+		for (i = 0; m->bucket != NULL && i < n->bucket->count; i++) {
+			if ((m->bucket->data[i] = job->copy_func(n->bucket->data[i])) == NULL)
+				break;
+		}
+		if (m->bucket == NULL || i < n->bucket->count) {
+			if (m->bucket != NULL) {
+				while (i-- > 0)
+					job->copy->destroy(m->bucket->data[i]);
+				bucket_free(job->copy->allocator, m->bucket, AVL_BUCKET_BYTES(n->bucket->count));
+			}
+			job->copy->destroy(m->data);
+			return AVL_NIL(job->copy);
+		}
+		m->bucket->count = m->bucket->size = n->bucket->count;
+		*bytes += AVL_BUCKET_BYTES(m->bucket->size);
+	}
+	#else
+	(void) bytes;
+	#endif
+
+	#ifdef AVL_MIN
+	if (job->avlt->min == n)
+		job->copy->min = m;
+	#endif
+
+	return m;
+}
+
+/*
+ * copy the nodes above depth, record the subtrees at depth as tasks
+ * return the copy of n
+ */
+avlnode *clone_top(avlclonejob *job, avlnode *n, avlnode *parent, int depth, int *k)
+{
+	avlnode *m;
+
+	if (n == AVL_NIL(job->avlt))
+		return AVL_NIL(job->copy);
+
+	if (depth == 0) {
+		job->roots[*k] = n;
+		job->links[*k] = parent;
+		(*k)++;
+		return AVL_NIL(job->copy); /* linked by clone_task */
+	}
+
+	m = clone_node(job, n, &job->nodes[job->used++], parent, &job->top_bytes);
+	if (m == AVL_NIL(job->copy))
+		return m;
+	job->live++;
+
+	m->left = clone_top(job, n->left, m, depth - 1, k);
+	m->right = clone_top(job, n->right, m, depth - 1, k);
+
+	return m;
+}
+
+/*
+ * count the subtree of task i
+ */
+void size_task(void *arg, int i)
+{
+	avlclonejob *job = (avlclonejob *) arg;
+
+	job->offsets[i] = size(job->avlt, job->roots[i]);
+}
+
+/*
+ * number of nodes of a subtree
+ */
+unsigned long size(avltree *avlt, avlnode *n)
+{
+	return (n == AVL_NIL(avlt)) ? 0 : 1 + size(avlt, n->left) + size(avlt, n->right);
+}
+
+/*
+ * copy the subtree of task i into its slots, link it to the copy of its parent
+ */
+void clone_task(void *arg, int i)
+{
+	avlclonejob *job = (avlclonejob *) arg;
+	avlnode *n = job->roots[i], *parent = job->links[i], *m;
+	unsigned long slot = job->offsets[i];
+
+	m = clone_range(job, n, parent, &slot, &job->copied[i], &job->bytes[i]);
+	if (n == n->parent->left)
+		parent->left = m;
+	else
+		parent->right = m;
+}
+
+/*
+ * copy n and its subtrees in preorder from *slot on
+ * return the copy
+ */
+avlnode *clone_range(avlclonejob *job, avlnode *n, avlnode *parent, unsigned long *slot, unsigned long *copied, \
+	unsigned long *bytes)
+{
+	avlnode *m;
+
+	if (n == AVL_NIL(job->avlt))
+		return AVL_NIL(job->copy);
+
+	m = clone_node(job, n, &job->nodes[(*slot)++], parent, bytes);
+	if (m == AVL_NIL(job->copy))
+		return m;
+	(*copied)++;
+
+	m->left = clone_range(job, n->left, m, slot, copied, bytes);
+	m->right = clone_range(job, n->right, m, slot, copied, bytes);
+
+	return m;
+}
+
+#ifdef AVL_MULTISET
+/*
+ * allocate size bytes from allocator, or from malloc if it is NULL, without counting them in a tree,
+ * for the threads copying buckets
+ * return NULL if out of memory
+ */
+void *bucket_alloc(const avlallocator *allocator, size_t size)
+{
+	return (allocator != NULL) ? allocator->alloc(size, allocator->ctx) : malloc(size);
+}
+
+/*
+ * free size bytes allocated by bucket_alloc
+ */
+void bucket_free(const avlallocator *allocator, void *p, size_t size)
+{
+	if (allocator != NULL)
+		allocator->free(p, size, allocator->ctx);
+	else
+		free(p);
+}
+#endif
+
+/*
+ * free the queued trees, wait for more until stopped
+ */
+void *reclaimer(void *arg)
+{
+	avlreclaimer *rc = (avlreclaimer *) arg;
+	avlreclaim *r;
+
+	for (;;) {
+		pthread_mutex_lock(&rc->lock);
+		while (rc->head == NULL && !rc->stop)
+			pthread_cond_wait(&rc->wake, &rc->lock);
+		if ((r = rc->head) != NULL && (rc->head = r->queue) == NULL)
+			rc->tail = NULL;
+		pthread_mutex_unlock(&rc->lock);
+		if (r == NULL)
+			break; /* stopped, queue empty */
+		avl_reclaim(r, ULONG_MAX);
+	}
+
+	return NULL;
+}
+
+/*
+ * hand a slab of size nodes over to avlt
+ */
+void adopt_slab(avltree *avlt, avlslab *slab, unsigned long size, unsigned long used, unsigned long live)
+{
+	slab->size = size;
+	slab->used = used;
+	slab->live = live;
+	slab->next = avlt->slabs;
+	avlt->slabs = slab;
+	#ifdef AVL_STATS
+	avlt->counters.allocs++;
+	#endif
+}
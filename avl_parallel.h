@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#ifndef _AVL_PARALLEL_HEADER
+#define _AVL_PARALLEL_HEADER
+
+#include "avl_bf.h"
+
+/*
+ * multi-threaded operations on whole trees (link with -pthread)
+ *
+ * the tree is split into tasks in key order: the subtrees at a fixed depth and the single
+ * nodes above it; the height of an AVL tree is bounded, so the subtrees are of similar size.
+ * threads take tasks from a shared counter, each task runs on its own local state created
+ * by init_func, and the local states are merged into cookie by reduce_func.
+ *
+ * the tree must not be modified while an operation is running
+ */
+
+enum avlmerge {
+	AVL_UNORDERED, /* reduce as tasks finish, in any order */
+	AVL_ORDERED /* reduce after all tasks, in key order */
+};
+
+/* tasks per thread, for load balance */
+#define AVL_TASKS_PER_THREAD 8
+
+/*
+ * a thread freeing detached trees in the order they are pushed,
+ * so that the destroy function of a tree runs on it; trees taking nodes from an arena are not taken
+ */
+typedef struct avlreclaimer avlreclaimer;
+
+int avl_apply_parallel(avltree *avlt, int nthreads, enum avlmerge merge, void *(*init_func)(void *), \
+	int (*func)(void *, void *), int (*reduce_func)(void *, void *), void *cookie);
+int avl_build_parallel(avltree *avlt, void **data, unsigned long n, int nthreads);
+avltree *avl_clone_parallel(avltree *avlt, void *(*copy_func)(void *), int nthreads);
+
+avlreclaimer *avl_reclaimer_create(void);
+int avl_reclaimer_push(avlreclaimer *rc, avlreclaim *r);
+void avl_reclaimer_destroy(avlreclaimer *rc);
+
+#endif /* _AVL_PARALLEL_HEADER */
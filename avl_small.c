@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#include <stdlib.h>
+#include "avl_small.h"
+
+static void load(avltype *type, avlsmall *s, int min);
+static void store(avltype *type, avlsmall *s);
+
+/*
+ * construction, the nodes of the trees are allocated chunk at a time
+ * return NULL if out of memory
+ */
+avltype *avl_type_create(int (*compare_func)(const void *, const void *), void (*destroy_func)(void *), \
+	unsigned long chunk)
+{
+	avltype *type;
+
+	if ((type = (avltype *) malloc(sizeof(avltype))) == NULL)
+		return NULL; /* out of memory */
+
+	type->avlt = avl_create(compare_func, destroy_func);
+	type->arena = avl_arena_create(chunk);
+	if (type->avlt == NULL || type->arena == NULL) {
+		if (type->avlt != NULL)
+			avl_destroy(type->avlt);
+		if (type->arena != NULL)
+			avl_arena_destroy(type->arena);
+		free(type);
+		return NULL; /* out of memory */
+	}
+
+	avl_set_arena(type->avlt, type->arena);
+
+	return type;
+}
+
+/*
+ * destruction; the nodes of trees not cleared are freed without destroying their data
+ */
+void avl_type_destroy(avltype *type)
+{
+	avl_destroy(type->avlt);
+	avl_arena_destroy(type->arena);
+	free(type);
+}
+
+/*
+ * find data in s
+ * return NULL if not found
+ */
+avlnode *avl_small_find(avltype *type, avlsmall *s, void *data)
+{
+	avlnode *node;
+
+	load(type, s, 0); /* lookups do not use the minimal */
+	node = avl_find(type->avlt, data);
+	store(type, s);
+
+	return node;
+}
+
+/*
+ * insert data into s, as avl_insert
+ * return NULL if out of memory
+ */
+avlnode *avl_small_insert(avltype *type, avlsmall *s, void *data)
+{
+	avlnode *node;
+
+	load(type, s, 1);
+	node = avl_insert(type->avlt, data);
+	store(type, s);
+
+	return node;
+}
+
+/*
+ * delete node from s, as avl_delete
+ * return NULL if keep is zero (already freed)
+ */
+void *avl_small_delete(avltype *type, avlsmall *s, avlnode *node, int keep)
+{
+	void *data;
+
+	load(type, s, 1);
+	data = avl_delete(type->avlt, node, keep);
+	store(type, s);
+
+	return data;
+}
+
+/*
+ * minimal node of s
+ * return NULL if s is empty
+ */
+avlnode *avl_small_first(avltype *type, avlsmall *s)
+{
+	avlnode *p;
+
+	if ((p = s->top) == NULL)
+		return NULL;
+
+	for ( ; p->left != AVL_NIL(type->avlt); p = p->left) ;
+
+	return p;
+}
+
+/*
+ * next larger, the tree of node need not be loaded
+ * return NULL if not found
+ */
+avlnode *avl_small_successor(avltype *type, avlnode *node)
+{
+	return avl_successor(type->avlt, node);
+}
+
+/*
+ * destroy the data of all nodes of s and return the nodes to the arena
+ */
+void avl_small_clear(avltype *type, avlsmall *s)
+{
+	load(type, s, 1);
+	avl_erase_range(type->avlt, NULL, NULL);
+	store(type, s);
+}
+
+/*
+ * make s the tree of type, finding its minimal only if min is non-zero
+ */
+void load(avltype *type, avlsmall *s, int min)
+{
+	avltree *avlt = type->avlt;
+
+	AVL_FIRST(avlt) = (s->top != NULL) ? s->top : AVL_NIL(avlt);
+	avlt->count = s->count;
+
+	#ifdef AVL_MIN
+	avlt->min = min ? avl_small_first(type, s) : NULL;
+	#else
+	(void) min;
+	#endif
+}
+
+/*
+ * save the tree of type into s and leave the tree of type empty
+ */
+void store(avltype *type, avlsmall *s)
+{
+	avltree *avlt = type->avlt;
+
+	s->top = (AVL_FIRST(avlt) != AVL_NIL(avlt)) ? AVL_FIRST(avlt) : NULL;
+	s->count = avlt->count;
+
+	AVL_FIRST(avlt) = AVL_NIL(avlt);
+	avlt->count = 0;
+
+	#ifdef AVL_MIN
+	avlt->min = NULL;
+	#endif
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#ifndef _AVL_SMALL_HEADER
+#define _AVL_SMALL_HEADER
+
+#include "avl_bf.h"
+
+/*
+ * small trees: a tree is a two-word handle, everything else is shared by the trees of a type
+ *
+ * a type holds the compare and destroy functions, the sentinels and an arena all the nodes of
+ * its trees are drawn from. an operation loads the handle into the tree of the type, runs
+ * the avl_ function on it and stores the handle back, so nodes are the same avlnode and
+ * handles to them stay valid as in an avltree. the minimal node is not kept in the handle
+ * and is found again, in O(log n), by the operations that need it.
+ *
+ * a type and its trees must be used from one thread
+ */
+
+typedef struct {
+	avltree *avlt; /* empty between operations */
+	avlarena *arena;
+} avltype;
+
+typedef struct {
+	avlnode *top; /* NULL if empty */
+	unsigned long count;
+} avlsmall;
+
+#define AVL_SMALL_INIT {NULL, 0}
+#define AVL_SMALL_COUNT(s) ((s)->count)
+#define AVL_SMALL_ISEMPTY(s) ((s)->top == NULL)
+
+avltype *avl_type_create(int (*compare_func)(const void *, const void *), void (*destroy_func)(void *), \
+	unsigned long chunk);
+void avl_type_destroy(avltype *type);
+
+avlnode *avl_small_find(avltype *type, avlsmall *s, void *data);
+avlnode *avl_small_insert(avltype *type, avlsmall *s, void *data);
+void *avl_small_delete(avltype *type, avlsmall *s, avlnode *node, int keep);
+avlnode *avl_small_first(avltype *type, avlsmall *s);
+avlnode *avl_small_successor(avltype *type, avlnode *node);
+void avl_small_clear(avltype *type, avlsmall *s);
+
+#endif /* _AVL_SMALL_HEADER */
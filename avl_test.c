@@ -10,6 +10,12 @@
 #include <limits.h>
 #include "avl_bf.h"
 #include "avl_data.h"
+#include "avl_hist.h"
+#include "avl_frozen.h"
+#include "avl_parallel.h"
+#include "avl_timer.h"
+#include "avl_small.h"
+#include "avl_np.h"
 #include "minunit.h"
 
 #define MIN INT_MIN
@@ -34,6 +40,7 @@ static void permutation_delete(char *a);
 
 static int unit_test_create();
 static int unit_test_find();
+static int unit_test_find_batch();
 static int unit_test_successor();
 static int unit_test_atomic_insertion();
 static int unit_test_atomic_deletion();
@@ -42,11 +49,49 @@ static int unit_test_chain_deletion();
 static int unit_test_permutation_insertion();
 static int unit_test_permutation_deletion();
 static int unit_test_random_insertion_deletion();
+static int unit_test_stable_handles();
+static int unit_test_erase();
+static int unit_test_erase_range();
 
 static int unit_test_dup();
 #ifdef AVL_MIN
 static int unit_test_min();
 #endif
+static int unit_test_stats();
+static int unit_test_hist();
+static int unit_test_freeze();
+static int unit_test_compact();
+static int unit_test_apply_parallel();
+static int unit_test_build_parallel();
+static int unit_test_clone();
+static int unit_test_reclaim();
+static int unit_test_timers();
+static int unit_test_timers_rearm();
+static int unit_test_small();
+static int unit_test_allocator();
+static int unit_test_np();
+static int unit_test_wavl();
+#ifdef AVL_MULTISET
+static int unit_test_multiset();
+#endif
+#ifdef AVL_PREFIX
+static int unit_test_prefix();
+#endif
+#ifdef AVL_AUGMENT
+static int unit_test_augment();
+#endif
+#ifdef AVL_INTERVAL
+static int unit_test_interval();
+#endif
+#ifdef AVL_LAZY
+static int unit_test_lazy();
+#endif
+#ifdef AVL_CACHE
+static int unit_test_cache();
+#endif
+#ifdef AVL_BLOOM
+static int unit_test_bloom();
+#endif
 
 void all_tests()
 {
@@ -54,6 +99,8 @@ void all_tests()
 
 	mu_test("unit_test_find", unit_test_find());
 
+	mu_test("unit_test_find_batch", unit_test_find_batch());
+
 	mu_test("unit_test_successor", unit_test_successor());
 
 	mu_test("unit_test_atomic_insertion", unit_test_atomic_insertion());
@@ -67,11 +114,68 @@ void all_tests()
 
 	mu_test("unit_test_random_insertion_deletion", unit_test_random_insertion_deletion());
 
+	mu_test("unit_test_stable_handles", unit_test_stable_handles());
+
+	mu_test("unit_test_erase", unit_test_erase());
+
+	mu_test("unit_test_erase_range", unit_test_erase_range());
+
 	mu_test("unit_test_dup", unit_test_dup());
 
 	#ifdef AVL_MIN
 	mu_test("unit_test_min", unit_test_min());
 	#endif
+
+	mu_test("unit_test_stats", unit_test_stats());
+
+	mu_test("unit_test_hist", unit_test_hist());
+
+	mu_test("unit_test_freeze", unit_test_freeze());
+
+	mu_test("unit_test_compact", unit_test_compact());
+
+	mu_test("unit_test_apply_parallel", unit_test_apply_parallel());
+
+	mu_test("unit_test_build_parallel", unit_test_build_parallel());
+
+	mu_test("unit_test_clone", unit_test_clone());
+
+	mu_test("unit_test_reclaim", unit_test_reclaim());
+
+	mu_test("unit_test_timers", unit_test_timers());
+	mu_test("unit_test_timers_rearm", unit_test_timers_rearm());
+	mu_test("unit_test_small", unit_test_small());
+	mu_test("unit_test_allocator", unit_test_allocator());
+	mu_test("unit_test_np", unit_test_np());
+	mu_test("unit_test_wavl", unit_test_wavl());
+
+	#ifdef AVL_MULTISET
+	mu_test("unit_test_multiset", unit_test_multiset());
+	#endif
+
+	#ifdef AVL_PREFIX
+	mu_test("unit_test_prefix", unit_test_prefix());
+	#endif
+
+	#ifdef AVL_AUGMENT
+	mu_test("unit_test_augment", unit_test_augment());
+	#endif
+
+	#ifdef AVL_INTERVAL
+	mu_test("unit_test_interval", unit_test_interval());
+	#endif
+
+	#ifdef AVL_LAZY
+	mu_test("unit_test_lazy", unit_test_lazy());
+	#endif
+
+	#ifdef AVL_CACHE
+	mu_test("unit_test_cache", unit_test_cache());
+	#endif
+
+	#ifdef AVL_BLOOM
+	mu_test("unit_test_bloom", unit_test_bloom());
+	#endif
 }
 
 int main(int argc, char **argv)
@@ -321,6 +425,59 @@ err0:
 	return 0;
 }
 
+int unit_test_find_batch()
+{
+	avltree *avlt;
+	mydata keys[300];
+	void *data[300];
+	avlnode *out[300];
+	char present[600];
+	int i, found;
+
+	memset(present, 0, sizeof(present));
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	for (i = 0; i < 200; i++) {
+		if (tree_insert(avlt, (i * 37) % 400) == NULL) {
+			fprintf(stdout, "init failed\n");
+			goto err;
+		}
+		present[(i * 37) % 400] = 1;
+	}
+
+	for (i = 0; i < 300; i++) {
+		keys[i].key = (i * 7) % 600;
+		data[i] = &keys[i];
+	}
+
+	found = avl_find_batch(avlt, data, 300, out);
+
+	for (i = 0; i < 300; i++) {
+		if (out[i] != avl_find(avlt, data[i]) || (out[i] != NULL) != present[keys[i].key]) {
+			fprintf(stdout, "batch lookup %d failed\n", keys[i].key);
+			goto err;
+		}
+		found -= (out[i] != NULL);
+	}
+
+	if (found != 0 || avl_find_batch(avlt, data, 0, out) != 0 || avl_find_batch(avlt, data, 3, out) != 3) {
+		fprintf(stdout, "invalid found count\n");
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
 int unit_test_successor()
 {
 	avltree *avlt;
@@ -766,6 +923,184 @@ err0:
 	return 0;
 }
 
+int unit_test_stable_handles()
+{
+	avltree *avlt;
+	avlnode *handle[1000];
+	int i, k;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	for (i = 0; i < 1000; i++) {
+		if ((handle[i] = tree_insert(avlt, i)) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+
+	/* delete through handles, inner nodes with two children included */
+	srand(2019);
+	for (i = 0; i < 500; i++) {
+		do {
+			k = rand() % 1000;
+		} while (handle[k] == NULL);
+		avl_delete(avlt, handle[k], 0);
+		handle[k] = NULL;
+	}
+
+	if (tree_check(avlt) != 1 || AVL_COUNT(avlt) != 500) {
+		fprintf(stdout, "invalid tree\n");
+		goto err;
+	}
+
+	for (k = 0; k < 1000; k++) {
+		if (handle[k] != NULL && (((mydata *) handle[k]->data)->key != k || tree_find(avlt, k) != handle[k])) {
+			fprintf(stdout, "handle of %d moved\n", k);
+			goto err;
+		}
+		if (handle[k] == NULL && tree_find(avlt, k) != NULL) {
+			fprintf(stdout, "%d not deleted\n", k);
+			goto err;
+		}
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
+int unit_test_erase()
+{
+	avltree *avlt;
+	mydata query;
+	int i;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	for (i = 0; i < 100; i++) {
+		if (tree_insert(avlt, i) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+
+	for (i = 0; i < 100; i += 3) {
+		query.key = i;
+		if (avl_erase(avlt, &query) != 1) {
+			fprintf(stdout, "erase %d failed\n", i);
+			goto err;
+		}
+	}
+	query.key = 0;
+	if (avl_erase(avlt, &query) != 0 || tree_find(avlt, 3) != NULL || tree_find(avlt, 4) == NULL || \
+		AVL_COUNT(avlt) != 66 || tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid tree after erase\n");
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
+int unit_test_erase_range()
+{
+	avltree *avlt;
+	avlnode *node;
+	mydata lo, hi;
+	int present[600];
+	unsigned long count, expected;
+	int i, j, k, round;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	srand(2019);
+	for (round = 0; round < 200; round++) {
+		/* refill to a random size, then erase a random range, bounded or not */
+		memset(present, 0, sizeof(present));
+		avl_erase_range(avlt, NULL, NULL);
+		if (!AVL_ISEMPTY(avlt) || AVL_COUNT(avlt) != 0) {
+			fprintf(stdout, "erase all failed\n");
+			goto err;
+		}
+		for (i = rand() % 600; i > 0; i--) {
+			k = rand() % 600;
+			if (!present[k]) {
+				if (tree_insert(avlt, k) == NULL) {
+					fprintf(stdout, "insert failed\n");
+					goto err;
+				}
+				present[k] = 1;
+			}
+		}
+
+		lo.key = rand() % 640 - 20;
+		hi.key = lo.key + rand() % ((round % 10 == 0) ? 640 : 40);
+		for (expected = 0, j = 0; j < 600; j++) {
+			if ((round % 7 == 1 || j >= lo.key) && (round % 7 == 2 || j < hi.key) && present[j]) {
+				present[j] = 0;
+				expected++;
+			}
+		}
+		count = avl_erase_range(avlt, (round % 7 == 1) ? NULL : &lo, (round % 7 == 2) ? NULL : &hi);
+
+		if (count != expected || tree_check(avlt) != 1) {
+			fprintf(stdout, "invalid erase range [%d, %d): %lu, expected %lu\n", lo.key, hi.key, count, expected);
+			goto err;
+		}
+		for (j = 0, k = -1; j < 600; j++) {
+			if ((tree_find(avlt, j) != NULL) != present[j]) {
+				fprintf(stdout, "%d erased wrongly\n", j);
+				goto err;
+			}
+			if (k < 0 && present[j])
+				k = j;
+		}
+		/* parents relinked, walking with them visits every node */
+		for (node = AVL_FIRST(avlt); node != AVL_NIL(avlt) && node->left != AVL_NIL(avlt); node = node->left) ;
+		for (count = 0; node != AVL_NIL(avlt) && node != NULL; node = avl_successor(avlt, node))
+			count++;
+		for (expected = 0, j = 0; j < 600; j++)
+			expected += present[j];
+		if (count != expected || AVL_COUNT(avlt) != expected) {
+			fprintf(stdout, "invalid count\n");
+			goto err;
+		}
+
+		#ifdef AVL_MIN
+		if ((k < 0) ? AVL_MINIMAL(avlt) != NULL : AVL_MINIMAL(avlt) != tree_find(avlt, k)) {
+			fprintf(stdout, "invalid min\n");
+			goto err;
+		}
+		#endif
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
 #ifdef AVL_MIN
 int unit_test_min()
 {
@@ -828,4 +1163,2307 @@ err:
 	avl_destroy(avlt);
 err0:
 	return 0;
-}
\ No newline at end of file
+}
+
+int unit_test_stats()
+{
+	avltree *avlt;
+	avlstats stats;
+	int i;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	/* ascending keys A-J make a tree of height 4 with 5 leaves */
+	for (i = 0; i < 10; i++) {
+		if (tree_insert(avlt, 'A' + i) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+
+	avl_stats(avlt, &stats);
+	if (stats.count != 10 || AVL_COUNT(avlt) != 10 || stats.height != 4 || \
+		stats.leaves != 5 || stats.memory != sizeof(avltree) + 10 * sizeof(avlnode)) {
+		fprintf(stdout, "invalid shape\n");
+		goto err;
+	}
+
+	#ifdef AVL_STATS
+	if (stats.counters.allocs != 10 || stats.counters.compares == 0 || \
+		stats.counters.insert_single_rotations != 6 || stats.counters.insert_double_rotations != 0 || \
+		stats.counters.insert_backtrack_max == 0) {
+		fprintf(stdout, "invalid counters\n");
+		goto err;
+	}
+	#endif
+
+	if (tree_delete(avlt, 'A') != 1 || AVL_COUNT(avlt) != 9) {
+		fprintf(stdout, "invalid count\n");
+		goto err;
+	}
+
+	#ifdef AVL_STATS
+	avl_stats(avlt, &stats);
+	if (stats.counters.frees != 1 || stats.counters.delete_backtrack == 0) {
+		fprintf(stdout, "invalid counters\n");
+		goto err;
+	}
+
+	/* nodes from an arena are counted one by one, not by chunk */
+	avlarena *arena;
+	avl_destroy(avlt);
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+	if ((arena = avl_arena_create(4)) == NULL) {
+		fprintf(stdout, "create arena failed\n");
+		goto err;
+	}
+	avl_set_arena(avlt, arena);
+	for (i = 0; i < 10; i++)
+		tree_insert(avlt, 'A' + i);
+	tree_delete(avlt, 'A');
+	avl_stats(avlt, &stats);
+	avl_destroy(avlt);
+	avl_arena_destroy(arena);
+	if (stats.counters.allocs != 10 || stats.counters.frees != 1) {
+		fprintf(stdout, "invalid arena counters\n");
+		goto err0;
+	}
+	return 1;
+	#endif
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
+int unit_test_hist()
+{
+	avlhist h1, h2;
+	unsigned long long i, p50, p999;
+
+	avl_hist_init(&h1);
+	avl_hist_init(&h2);
+
+	for (i = 1; i <= 1000; i++)
+		avl_hist_record(&h1, i);
+	for (i = 0; i < 10; i++)
+		avl_hist_record(&h2, 100000);
+
+	p50 = avl_hist_percentile(&h1, 0.50);
+	if (h1.count != 1000 || h1.min != 1 || h1.max != 1000 || \
+		p50 < 500 || p50 > 500 + 500 / 16 || avl_hist_percentile(&h1, 1.0) != 1000 || \
+		avl_hist_percentile(&h1, 0.0) != 1) {
+		fprintf(stdout, "invalid percentile\n");
+		return 0;
+	}
+
+	avl_hist_merge(&h1, &h2);
+	p999 = avl_hist_percentile(&h1, 0.999);
+	if (h1.count != 1010 || h1.max != 100000 || p999 < 100000 - 100000 / 16 || p999 > 100000) {
+		fprintf(stdout, "invalid merge\n");
+		return 0;
+	}
+
+	#ifdef AVL_HIST
+	avltree *avlt;
+	avlhist hist[AVL_NOPS];
+
+	for (i = 0; i < AVL_NOPS; i++)
+		avl_hist_init(&hist[i]);
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		return 0;
+	}
+	avl_set_hist(avlt, hist);
+
+	if (tree_insert(avlt, 'A') == NULL || tree_insert(avlt, 'B') == NULL || tree_delete(avlt, 'A') != 1) {
+		fprintf(stdout, "init failed\n");
+		avl_destroy(avlt);
+		return 0;
+	}
+	/* a failed insert is recorded too */
+	avl_set_limit(avlt, AVL_BYTES(avlt));
+	if (tree_insert(avlt, 'C') != NULL) {
+		fprintf(stdout, "insert over the limit succeeded\n");
+		avl_destroy(avlt);
+		return 0;
+	}
+	avl_destroy(avlt);
+
+	/* tree_delete looks up the key before and after deleting it */
+	if (hist[AVL_OP_INSERT].count != 3 || hist[AVL_OP_FIND].count != 2 || \
+		hist[AVL_OP_DELETE].count != 1 || hist[AVL_OP_DESTROY].count != 1) {
+		fprintf(stdout, "invalid operation histograms\n");
+		return 0;
+	}
+	#endif
+
+	return 1;
+}
+
+static long long key_func(const void *d)
+{
+	return ((mydata *) d)->key;
+}
+
+static int count_func(void *d, void *cookie)
+{
+	(void) d;
+	(*(int *) cookie)++;
+	return 0;
+}
+
+int unit_test_freeze()
+{
+	avltree *avlt;
+	avlfrozen *f;
+	int i, q, count;
+	size_t lb;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	/* an empty snapshot */
+	if ((f = avl_freeze(avlt, key_func)) == NULL || avl_frozen_lower_bound(f, 0) != 0 || avl_frozen_find(f, 0) != NULL) {
+		fprintf(stdout, "invalid empty snapshot\n");
+		goto err;
+	}
+	avl_frozen_destroy(f);
+
+	/* keys 0, 3, 6, ..., 2997 inserted in scrambled order */
+	for (i = 0; i < 1000; i++) {
+		if (tree_insert(avlt, 3 * ((i * 389) % 1000)) == NULL) {
+			fprintf(stdout, "init failed\n");
+			goto err;
+		}
+	}
+
+	if ((f = avl_freeze(avlt, key_func)) == NULL || AVL_FROZEN_SIZE(f) != 1000) {
+		fprintf(stdout, "freeze failed\n");
+		goto err;
+	}
+
+	for (q = -2; q <= 3002; q++) {
+		lb = (q <= 0) ? 0 : (q > 2997) ? 1000 : (size_t) ((q + 2) / 3);
+		if (avl_frozen_lower_bound(f, q) != lb || \
+			(avl_frozen_find(f, q) != NULL) != (q >= 0 && q <= 2997 && q % 3 == 0) || \
+			(lb < 1000 && ((mydata *) AVL_FROZEN_DATA(f, lb))->key != AVL_FROZEN_KEY(f, lb))) {
+			fprintf(stdout, "lookup %d failed\n", q);
+			avl_frozen_destroy(f);
+			goto err;
+		}
+	}
+
+	count = 0;
+	avl_frozen_range(f, 10, 100, count_func, &count); /* 12, 15, ..., 99 */
+	if (count != 30) {
+		fprintf(stdout, "invalid range\n");
+		avl_frozen_destroy(f);
+		goto err;
+	}
+
+	avl_frozen_destroy(f);
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
+int unit_test_compact()
+{
+	avltree *avlt;
+	avlnode *node;
+	int i, rc, steps;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	/* keys 0-999, then every third one deleted */
+	for (i = 0; i < 1000; i++) {
+		if (tree_insert(avlt, (i * 389) % 1000) == NULL) {
+			fprintf(stdout, "init failed\n");
+			goto err;
+		}
+	}
+	for (i = 0; i < 1000; i += 3) {
+		if (tree_delete(avlt, i) != 1) {
+			fprintf(stdout, "init failed\n");
+			goto err;
+		}
+	}
+
+	if (avl_compact(avlt) != 0 || tree_check(avlt) != 1 || avlt->slabs == NULL || avlt->slabs->next != NULL || \
+		avlt->slabs->live != AVL_COUNT(avlt) || AVL_FIRST(avlt) != &avlt->slabs->nodes[0]) {
+		fprintf(stdout, "compact failed\n");
+		goto err;
+	}
+
+	for (i = 0; i < 1000; i++) {
+		node = tree_find(avlt, i);
+		if ((node != NULL) != (i % 3 != 0) || (node != NULL && !(node->flags & AVL_POOLED))) {
+			fprintf(stdout, "find %d failed\n", i);
+			goto err;
+		}
+	}
+
+	#ifdef AVL_MIN
+	if (AVL_MINIMAL(avlt) != tree_find(avlt, 1)) {
+		fprintf(stdout, "invalid min\n");
+		goto err;
+	}
+	#endif
+
+	/* incremental compaction interleaved with updates */
+	steps = 0;
+	i = 0;
+	while ((rc = avl_compact_step(avlt, 16)) == 1) {
+		steps++;
+		if (tree_delete(avlt, 3 * i + 1) != 1 || tree_insert(avlt, 3 * i) == NULL || tree_check(avlt) != 1) {
+			fprintf(stdout, "update during compaction failed\n");
+			goto err;
+		}
+		i++;
+	}
+
+	if (rc != 0 || steps == 0 || avlt->compact != NULL || AVL_COUNT(avlt) != 666 || tree_check(avlt) != 1) {
+		fprintf(stdout, "incremental compaction failed\n");
+		goto err;
+	}
+
+	/* the slab of the first compaction is emptied and released */
+	if (avlt->slabs == NULL || avlt->slabs->next != NULL) {
+		fprintf(stdout, "slab not released\n");
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
+/* count, sum, first and last key of a task or of the total */
+typedef struct {
+	long long count;
+	long long sum;
+	int first;
+	int last;
+	int ordered; /* total only, merges must come in key order */
+} mysum;
+
+static void *sum_init_func(void *cookie)
+{
+	mysum *local;
+
+	(void) cookie;
+	if ((local = (mysum *) malloc(sizeof(mysum))) != NULL) {
+		local->count = local->sum = 0;
+		local->first = local->last = MIN;
+	}
+	return local;
+}
+
+static int sum_apply_func(void *d, void *cookie)
+{
+	mysum *local = (mysum *) cookie;
+	int key = ((mydata *) d)->key;
+
+	if (key == 12345)
+		return 7; /* error injected */
+	if (local->count > 0 && key < local->last)
+		return -1;
+	if (local->count++ == 0)
+		local->first = key;
+	local->last = key;
+	local->sum += key;
+	return 0;
+}
+
+static int sum_reduce_func(void *cookie, void *d)
+{
+	mysum *total = (mysum *) cookie, *local = (mysum *) d;
+	int err = 0;
+
+	if (total->ordered && total->count > 0 && local->count > 0 && local->first < total->last)
+		err = -2; /* merged out of order */
+	if (local->count > 0) {
+		if (total->count == 0)
+			total->first = local->first;
+		total->last = local->last;
+	}
+	total->count += local->count;
+	total->sum += local->sum;
+	free(local);
+	return err;
+}
+
+int unit_test_apply_parallel()
+{
+	avltree *avlt;
+	mysum total;
+	int i, nthreads;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	/* an empty tree has no tasks */
+	total.count = total.sum = 0;
+	total.ordered = 1;
+	if (avl_apply_parallel(avlt, 4, AVL_ORDERED, sum_init_func, sum_apply_func, sum_reduce_func, &total) != 0 || total.count != 0) {
+		fprintf(stdout, "apply on empty tree failed\n");
+		goto err;
+	}
+
+	for (i = 0; i < 20000; i++) {
+		if (tree_insert(avlt, (i * 7919) % 20000) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+
+	for (nthreads = 1; nthreads <= 8; nthreads *= 2) {
+		total.count = total.sum = 0;
+		total.ordered = 1;
+		if (avl_apply_parallel(avlt, nthreads, AVL_ORDERED, sum_init_func, sum_apply_func, sum_reduce_func, &total) != 7) {
+			fprintf(stdout, "error not returned\n");
+			goto err;
+		}
+	}
+
+	/* stop before the key of the injected error */
+	if (tree_delete(avlt, 12345) != 1) {
+		fprintf(stdout, "delete failed\n");
+		goto err;
+	}
+
+	for (nthreads = 1; nthreads <= 8; nthreads *= 2) {
+		total.count = total.sum = 0;
+		total.ordered = 1;
+		if (avl_apply_parallel(avlt, nthreads, AVL_ORDERED, sum_init_func, sum_apply_func, sum_reduce_func, &total) != 0 || \
+			total.count != 19999 || total.sum != 19999LL * 20000 / 2 - 12345 || total.first != 0 || total.last != 19999) {
+			fprintf(stdout, "ordered apply on %d threads failed\n", nthreads);
+			goto err;
+		}
+
+		total.count = total.sum = 0;
+		total.ordered = 0;
+		if (avl_apply_parallel(avlt, nthreads, AVL_UNORDERED, sum_init_func, sum_apply_func, sum_reduce_func, &total) != 0 || \
+			total.count != 19999 || total.sum != 19999LL * 20000 / 2 - 12345) {
+			fprintf(stdout, "unordered apply on %d threads failed\n", nthreads);
+			goto err;
+		}
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
+/* a value with its position in the input */
+typedef struct {
+	mydata base;
+	int tag;
+} mytagged;
+
+int unit_test_build_parallel()
+{
+	avltree *avlt;
+	avlnode *node;
+	mytagged **data;
+	int i, n, nthreads;
+
+	avlt = NULL;
+	n = 30000;
+	if ((data = (mytagged **) malloc(n * sizeof(mytagged *))) == NULL) {
+		fprintf(stdout, "out of memory\n");
+		goto err0;
+	}
+
+	for (nthreads = 1; nthreads <= 8; nthreads *= 2) {
+		if ((avlt = tree_create()) == NULL) {
+			fprintf(stdout, "create AVL tree failed\n");
+			goto err;
+		}
+
+		/* every key twice, the id of a value in its tag */
+		for (i = 0; i < n; i++) {
+			if ((data[i] = (mytagged *) malloc(sizeof(mytagged))) == NULL) {
+				fprintf(stdout, "out of memory\n");
+				goto err;
+			}
+			data[i]->base.key = (i * 7919) % (n / 2);
+			data[i]->tag = i;
+		}
+		if (avl_build_parallel(avlt, (void **) data, n, nthreads) != 0) {
+			fprintf(stdout, "build on %d threads failed\n", nthreads);
+			goto err;
+		}
+
+		if (tree_check(avlt) != 1) {
+			fprintf(stdout, "invalid tree\n");
+			goto err;
+		}
+
+		#ifdef AVL_DUP
+		if (AVL_COUNT(avlt) != (unsigned long) n) {
+			fprintf(stdout, "invalid count\n");
+			goto err;
+		}
+		/* equal keys in input order */
+		for (node = AVL_MINIMAL(avlt); node != NULL && avl_successor(avlt, node) != NULL; node = avl_successor(avlt, node)) {
+			avlnode *next = avl_successor(avlt, node);
+			if (((mydata *) node->data)->key == ((mydata *) next->data)->key && \
+				((mytagged *) node->data)->tag > ((mytagged *) next->data)->tag)
+				break;
+		}
+		if (node == NULL || avl_successor(avlt, node) != NULL) {
+			fprintf(stdout, "duplicates out of order\n");
+			goto err;
+		}
+		#else
+		if (AVL_COUNT(avlt) != (unsigned long) n / 2 || (node = tree_find(avlt, 0)) == NULL) {
+			fprintf(stdout, "invalid count\n");
+			goto err;
+		}
+		#ifdef AVL_MULTISET
+		if (((mytagged *) node->data)->tag != 0 || node->bucket == NULL || node->bucket->count != 1 || \
+			((mytagged *) node->bucket->data[0])->tag != n / 2) {
+			fprintf(stdout, "invalid bucket\n");
+			goto err;
+		}
+		#else
+		if (((mytagged *) node->data)->tag != n / 2) {
+			fprintf(stdout, "last value not kept\n");
+			goto err;
+		}
+		#endif
+		#endif
+
+		#ifdef AVL_MIN
+		if (AVL_MINIMAL(avlt) == NULL || ((mydata *) AVL_MINIMAL(avlt)->data)->key != 0) {
+			fprintf(stdout, "invalid min\n");
+			goto err;
+		}
+		#endif
+
+		/* a built tree is an ordinary tree */
+		for (i = 0; i < n / 2; i += 3) {
+			if ((node = tree_find(avlt, i)) == NULL) {
+				fprintf(stdout, "find failed\n");
+				goto err;
+			}
+			avl_delete(avlt, node, 0);
+		}
+		if (tree_insert(avlt, -1) == NULL || tree_check(avlt) != 1) {
+			fprintf(stdout, "update failed\n");
+			goto err;
+		}
+
+		avl_destroy(avlt);
+		avlt = NULL;
+	}
+
+	/* not empty */
+	if ((avlt = tree_create()) == NULL || tree_insert(avlt, 1) == NULL || avl_build_parallel(avlt, (void **) data, 0, 1) == 0) {
+		fprintf(stdout, "build into non-empty tree\n");
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	free(data);
+	return 1;
+
+err:
+	if (avlt != NULL)
+		avl_destroy(avlt);
+	free(data);
+err0:
+	return 0;
+}
+
+static void *copy_func(void *d)
+{
+	return makedata(((mydata *) d)->key);
+}
+
+/* fails on one key */
+static void *copy_fail_func(void *d)
+{
+	return (((mydata *) d)->key == 777) ? NULL : makedata(((mydata *) d)->key);
+}
+
+/* same shape, balance factors and keys, no node shared */
+static int same_tree(avltree *t1, avlnode *n1, avltree *t2, avlnode *n2)
+{
+	if (n1 == AVL_NIL(t1) || n2 == AVL_NIL(t2))
+		return n1 == AVL_NIL(t1) && n2 == AVL_NIL(t2);
+
+	return n1 != n2 && n1->data != n2->data && n1->bf == n2->bf && \
+		((mydata *) n1->data)->key == ((mydata *) n2->data)->key && \
+		same_tree(t1, n1->left, t2, n2->left) && same_tree(t1, n1->right, t2, n2->right);
+}
+
+int unit_test_clone()
+{
+	avltree *avlt, *copy;
+	int i, nthreads;
+	#ifdef AVL_MULTISET
+	mydata query;
+	#endif
+
+	copy = NULL;
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	for (nthreads = 1; nthreads <= 4; nthreads *= 2) {
+		/* empty */
+		if ((copy = avl_clone_parallel(avlt, copy_func, nthreads)) == NULL || !AVL_ISEMPTY(copy)) {
+			fprintf(stdout, "clone of empty tree failed\n");
+			goto err;
+		}
+		avl_destroy(copy);
+		copy = NULL;
+	}
+
+	for (i = 0; i < 5000; i++) {
+		if (tree_insert(avlt, (i * 7919) % 5000) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	#ifdef AVL_MULTISET
+	if (tree_insert(avlt, 1) == NULL || tree_insert(avlt, 1) == NULL) {
+		fprintf(stdout, "insert failed\n");
+		goto err;
+	}
+	#endif
+
+	for (nthreads = 1; nthreads <= 4; nthreads *= 2) {
+		if ((copy = avl_clone_parallel(avlt, copy_func, nthreads)) == NULL) {
+			fprintf(stdout, "clone on %d threads failed\n", nthreads);
+			goto err;
+		}
+		if (AVL_COUNT(copy) != AVL_COUNT(avlt) || !same_tree(avlt, AVL_FIRST(avlt), copy, AVL_FIRST(copy)) || \
+			tree_check(copy) != 1 || AVL_FIRST(copy)->parent != AVL_ROOT(copy)) {
+			fprintf(stdout, "invalid clone\n");
+			goto err;
+		}
+		#ifdef AVL_MIN
+		if (AVL_MINIMAL(copy) == NULL || ((mydata *) AVL_MINIMAL(copy)->data)->key != 0) {
+			fprintf(stdout, "invalid min\n");
+			goto err;
+		}
+		#endif
+		#ifdef AVL_MULTISET
+		query.key = 1;
+		if (avl_count(copy, &query) != 3 || tree_find(copy, 1)->bucket == tree_find(avlt, 1)->bucket) {
+			fprintf(stdout, "invalid bucket\n");
+			goto err;
+		}
+		#endif
+
+		/* independent of the original */
+		for (i = 0; i < 5000; i += 2) {
+			if (tree_delete(copy, i) != 1) {
+				fprintf(stdout, "delete failed\n");
+				goto err;
+			}
+		}
+		if (tree_check(copy) != 1 || AVL_COUNT(copy) != 2500 || AVL_COUNT(avlt) != 5000 || tree_find(avlt, 0) == NULL) {
+			fprintf(stdout, "clone not independent\n");
+			goto err;
+		}
+		avl_destroy(copy);
+
+		/* the copies made before the failure are destroyed */
+		if ((copy = avl_clone_parallel(avlt, copy_fail_func, nthreads)) != NULL) {
+			fprintf(stdout, "failed copy not reported\n");
+			goto err;
+		}
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	if (copy != NULL)
+		avl_destroy(copy);
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
+int unit_test_reclaim()
+{
+	avltree *avlt, *copy;
+	avlreclaim *r;
+	avlreclaimer *rc;
+	avlarena *arena;
+	int i, calls;
+
+	copy = NULL;
+	rc = NULL;
+	arena = NULL;
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	for (i = 0; i < 10000; i++) {
+		if (tree_insert(avlt, (i * 7919) % 10000) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	if ((copy = avl_clone(avlt, copy_func)) == NULL) {
+		fprintf(stdout, "clone failed\n");
+		goto err;
+	}
+
+	/* detached in one step, freed 100 nodes per call */
+	if ((r = avl_detach(avlt)) == NULL) {
+		fprintf(stdout, "detach failed\n");
+		goto err;
+	}
+	if (!AVL_ISEMPTY(avlt) || AVL_COUNT(avlt) != 0 || tree_find(avlt, 1) != NULL || r->count != 10000) {
+		fprintf(stdout, "invalid tree after detach\n");
+		avl_reclaim(r, ULONG_MAX);
+		goto err;
+	}
+	for (calls = 1; avl_reclaim(r, 100); calls++) {
+		if (r->count != 10000 - 100 * (unsigned long) calls) {
+			fprintf(stdout, "invalid budget\n");
+			avl_reclaim(r, ULONG_MAX);
+			goto err;
+		}
+	}
+	if (calls != 100) {
+		fprintf(stdout, "reclaimed in %d calls\n", calls);
+		goto err;
+	}
+
+	/* the tree is reused, the clone in its slab goes to a background reclaimer */
+	for (i = 0; i < 100; i++) {
+		if (tree_insert(avlt, i) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	if ((rc = avl_reclaimer_create()) == NULL) {
+		fprintf(stdout, "create reclaimer failed\n");
+		goto err;
+	}
+	if ((r = avl_detach(copy)) == NULL) {
+		fprintf(stdout, "detach failed\n");
+		goto err;
+	}
+	if (avl_reclaimer_push(rc, r) != 0) {
+		fprintf(stdout, "push refused\n");
+		avl_reclaim(r, ULONG_MAX);
+		goto err;
+	}
+	if ((r = avl_detach(avlt)) == NULL) {
+		fprintf(stdout, "detach failed\n");
+		goto err;
+	}
+	if (avl_reclaimer_push(rc, r) != 0) {
+		fprintf(stdout, "push refused\n");
+		avl_reclaim(r, ULONG_MAX);
+		goto err;
+	}
+	avl_reclaimer_destroy(rc);
+	rc = NULL;
+
+	if (!AVL_ISEMPTY(copy) || !AVL_ISEMPTY(avlt) || tree_insert(avlt, 1) == NULL || tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid tree after reclaim\n");
+		goto err;
+	}
+
+	/* nodes from an arena are reclaimed on the thread using it */
+	if ((rc = avl_reclaimer_create()) == NULL || (arena = avl_arena_create(64)) == NULL) {
+		fprintf(stdout, "create reclaimer failed\n");
+		goto err;
+	}
+	avl_set_arena(copy, arena);
+	for (i = 0; i < 100; i++) {
+		if (tree_insert(copy, i) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	if ((r = avl_detach(copy)) == NULL) {
+		fprintf(stdout, "detach failed\n");
+		goto err;
+	}
+	if (avl_reclaimer_push(rc, r) == 0) {
+		fprintf(stdout, "arena nodes pushed\n");
+		goto err;
+	}
+	avl_reclaim(r, ULONG_MAX);
+	avl_reclaimer_destroy(rc);
+	rc = NULL;
+	if (arena->live != 0) {
+		fprintf(stdout, "arena nodes not reclaimed\n");
+		goto err;
+	}
+
+	avl_destroy(copy);
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	if (rc != NULL)
+		avl_reclaimer_destroy(rc);
+	if (copy != NULL)
+		avl_destroy(copy);
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
+typedef struct {
+	avltimers *t;
+	long long now;
+	long long last; /* deadline fired last */
+	unsigned long long seq;
+	int fired;
+	int errors;
+	avltimer *victim; /* cancelled when the first timer fires */
+} mytick;
+
+/* fire in deadline order, re-arm timers marked periodic once */
+static void fire_func(avltimer *timer, void *cookie)
+{
+	mytick *tick = (mytick *) cookie;
+
+	if (timer->deadline > tick->now || timer->deadline < tick->last || \
+		(timer->deadline == tick->last && timer->seq <= tick->seq) || timer->node != NULL)
+		tick->errors++;
+	tick->last = timer->deadline;
+	tick->seq = timer->seq;
+	tick->fired++;
+
+	if (tick->victim != NULL) {
+		if (avl_timer_cancel(tick->t, tick->victim) != 1)
+			tick->errors++;
+		tick->victim = NULL;
+	}
+	if (timer->item != NULL && avl_timer_schedule(tick->t, timer, NULL, tick->now + 50) != 0)
+		tick->errors++;
+}
+
+int unit_test_timers()
+{
+	avltimers *t;
+	avltimer *timers, *first;
+	avlnode *node;
+	mytick tick;
+	int i, n, cancelled, expected;
+
+	timers = NULL;
+	if ((t = avl_timers_create()) == NULL) {
+		fprintf(stdout, "create timers failed\n");
+		goto err0;
+	}
+	if ((timers = (avltimer *) malloc(2000 * sizeof(avltimer))) == NULL) {
+		fprintf(stdout, "out of memory\n");
+		goto err;
+	}
+
+	/* every tenth timer is periodic, fires twice */
+	srand(2019);
+	for (i = 0; i < 2000; i++) {
+		AVL_TIMER_INIT(&timers[i]);
+		if (avl_timer_schedule(t, &timers[i], (i % 10 == 0) ? &timers[i] : NULL, rand() % 1000) != 0) {
+			fprintf(stdout, "schedule failed\n");
+			goto err;
+		}
+	}
+
+	/* moved in place, or cancelled */
+	cancelled = 0;
+	for (i = 1; i < 2000; i += 3) {
+		node = timers[i].node;
+		if (avl_timer_reschedule(t, &timers[i], rand() % 1000) != 0 || timers[i].node != node) {
+			fprintf(stdout, "reschedule failed\n");
+			goto err;
+		}
+	}
+	for (i = 2; i < 2000; i += 7) {
+		if (avl_timer_cancel(t, &timers[i]) != 1 || avl_timer_cancel(t, &timers[i]) != 0) {
+			fprintf(stdout, "cancel failed\n");
+			goto err;
+		}
+		cancelled++;
+	}
+	if (AVL_TIMERS_COUNT(t) != (unsigned long) (2000 - cancelled) || avl_check_height(t->avlt) != 1) {
+		fprintf(stdout, "invalid timers\n");
+		goto err;
+	}
+
+	/* the timers follow their nodes through compaction */
+	if (avl_compact_step(t->avlt, 500) != 1 || avl_compact(t->avlt) != 0) {
+		fprintf(stdout, "compact failed\n");
+		goto err;
+	}
+	for (i = 0; i < 2000; i++) {
+		if (timers[i].node != NULL && avl_find(t->avlt, &timers[i]) != timers[i].node) {
+			fprintf(stdout, "timer %d lost its node\n", i);
+			goto err;
+		}
+	}
+
+	/* a timer expiring with the first one is cancelled by its callback */
+	first = avl_timer_first(t);
+	tick.victim = NULL;
+	for (i = 0; i < 2000 && tick.victim == NULL; i++)
+		if (&timers[i] != first && timers[i].node != NULL && timers[i].deadline == first->deadline)
+			tick.victim = &timers[i];
+	for (n = 0, i = 0; i < 2000; i++)
+		if (timers[i].node != NULL && &timers[i] != tick.victim)
+			n += (timers[i].item != NULL) ? 2 : 1;
+	expected = n;
+
+	tick.t = t;
+	tick.last = LLONG_MIN;
+	tick.seq = 0;
+	tick.fired = tick.errors = 0;
+	for (tick.now = 0; tick.now < 1100; tick.now += 10) {
+		n = tick.fired;
+		if (avl_timer_advance(t, tick.now, fire_func, &tick) != (unsigned long) (tick.fired - n) || \
+			(avl_timer_first(t) != NULL && avl_timer_first(t)->deadline <= tick.now)) {
+			fprintf(stdout, "invalid advance to %lld\n", tick.now);
+			goto err;
+		}
+	}
+
+	if (tick.errors != 0 || tick.fired != expected || AVL_TIMERS_COUNT(t) != 0) {
+		fprintf(stdout, "invalid firing: %d fired, %d errors\n", tick.fired, tick.errors);
+		goto err;
+	}
+
+	avl_timers_destroy(t);
+	free(timers);
+	return 1;
+
+err:
+	avl_timers_destroy(t);
+	free(timers);
+err0:
+	return 0;
+}
+
+/* all expired timers re-armed from the callback, in linear time */
+int unit_test_timers_rearm()
+{
+	avltimers *t;
+	avltimer *timers;
+	mytick tick;
+	int i;
+
+	timers = NULL;
+	if ((t = avl_timers_create()) == NULL) {
+		fprintf(stdout, "create timers failed\n");
+		goto err0;
+	}
+	if ((timers = (avltimer *) malloc(100000 * sizeof(avltimer))) == NULL) {
+		fprintf(stdout, "out of memory\n");
+		goto err;
+	}
+
+	for (i = 0; i < 100000; i++) {
+		AVL_TIMER_INIT(&timers[i]);
+		if (avl_timer_schedule(t, &timers[i], &timers[i], i % 10) != 0) {
+			fprintf(stdout, "schedule failed\n");
+			goto err;
+		}
+	}
+
+	tick.t = t;
+	tick.victim = NULL;
+	tick.last = LLONG_MIN;
+	tick.seq = 0;
+	tick.fired = tick.errors = 0;
+	tick.now = 10;
+	if (avl_timer_advance(t, tick.now, fire_func, &tick) != 100000 || AVL_TIMERS_COUNT(t) != 100000) {
+		fprintf(stdout, "invalid advance to %lld\n", tick.now);
+		goto err;
+	}
+	tick.now = 60;
+	if (avl_timer_advance(t, tick.now, fire_func, &tick) != 100000 || AVL_TIMERS_COUNT(t) != 0) {
+		fprintf(stdout, "invalid advance to %lld\n", tick.now);
+		goto err;
+	}
+	for (i = 0; i < 100000; i++) {
+		if (timers[i].pprev != NULL || timers[i].next != NULL || avl_timer_cancel(t, &timers[i]) != 0) {
+			fprintf(stdout, "timer left listed\n");
+			goto err;
+		}
+	}
+
+	if (tick.errors != 0 || tick.fired != 200000) {
+		fprintf(stdout, "invalid firing: %d fired, %d errors\n", tick.fired, tick.errors);
+		goto err;
+	}
+
+	avl_timers_destroy(t);
+	free(timers);
+	return 1;
+
+err:
+	avl_timers_destroy(t);
+	free(timers);
+err0:
+	return 0;
+}
+
+int unit_test_small()
+{
+	avltype *type;
+	avlsmall *trees;
+	avlnode *node;
+	mydata *data, query;
+	unsigned long chunks;
+	avlslab *chunk;
+	int i, j, k, prev;
+
+	if ((trees = (avlsmall *) malloc(1000 * sizeof(avlsmall))) == NULL)
+		goto err0;
+	if ((type = avl_type_create(compare_func, destroy_func, 256)) == NULL) {
+		fprintf(stdout, "create type failed\n");
+		free(trees);
+		goto err0;
+	}
+	for (i = 0; i < 1000; i++) {
+		avlsmall empty = AVL_SMALL_INIT;
+		trees[i] = empty;
+	}
+
+	/* tree i holds the keys j * 1000 + i for j < i % 20, inserted in shuffled order */
+	for (k = 0; k < 2; k++) {
+		for (i = 0; i < 1000; i++) {
+			for (j = 0; j < 20; j++) {
+				if ((j * 7) % 20 >= i % 20)
+					continue;
+				if ((data = makedata(((j * 7) % 20) * 1000 + i)) == NULL)
+					goto err;
+				if (avl_small_insert(type, &trees[i], data) == NULL) {
+					fprintf(stdout, "insert failed\n");
+					free(data);
+					goto err;
+				}
+			}
+		}
+
+		for (i = 0; i < 1000; i++) {
+			if (AVL_SMALL_COUNT(&trees[i]) != (unsigned long) (i % 20)) {
+				fprintf(stdout, "count of tree %d failed\n", i);
+				goto err;
+			}
+			prev = -1;
+			for (node = avl_small_first(type, &trees[i]); node != NULL; node = avl_small_successor(type, node)) {
+				if (((mydata *) node->data)->key <= prev || ((mydata *) node->data)->key % 1000 != i) {
+					fprintf(stdout, "order of tree %d failed\n", i);
+					goto err;
+				}
+				prev = ((mydata *) node->data)->key;
+			}
+			query.key = 1000 + i;
+			node = avl_small_find(type, &trees[i], &query);
+			if ((node != NULL) != (i % 20 > 1)) {
+				fprintf(stdout, "find in tree %d failed\n", i);
+				goto err;
+			}
+		}
+
+		/* delete the even keys, then clear */
+		for (i = 0; i < 1000; i++) {
+			for (j = 0; j < i % 20; j += 2) {
+				query.key = j * 1000 + i;
+				if ((node = avl_small_find(type, &trees[i], &query)) == NULL) {
+					fprintf(stdout, "find %d failed\n", query.key);
+					goto err;
+				}
+				avl_small_delete(type, &trees[i], node, 0);
+			}
+			if (AVL_SMALL_COUNT(&trees[i]) != (unsigned long) (i % 20 / 2)) {
+				fprintf(stdout, "delete in tree %d failed\n", i);
+				goto err;
+			}
+		}
+		for (i = 0; i < 1000; i++) {
+			avl_small_clear(type, &trees[i]);
+			if (!AVL_SMALL_ISEMPTY(&trees[i]) || AVL_SMALL_COUNT(&trees[i]) != 0) {
+				fprintf(stdout, "clear of tree %d failed\n", i);
+				goto err;
+			}
+		}
+		if (type->arena->live != 0 || !AVL_ISEMPTY(type->avlt)) {
+			fprintf(stdout, "arena not empty\n");
+			goto err;
+		}
+
+		/* the second round reuses the nodes of the first */
+		for (chunks = 0, chunk = type->arena->chunks; chunk != NULL; chunk = chunk->next)
+			chunks++;
+		if (chunks != (9500 + 255) / 256) {
+			fprintf(stdout, "arena chunks %lu\n", chunks);
+			goto err;
+		}
+	}
+
+	avl_type_destroy(type);
+	free(trees);
+	return 1;
+
+err:
+	for (i = 0; i < 1000; i++)
+		avl_small_clear(type, &trees[i]);
+	avl_type_destroy(type);
+	free(trees);
+err0:
+	return 0;
+}
+
+typedef struct {
+	long bytes;
+	long blocks;
+} myheap;
+
+static void *heap_alloc(size_t size, void *ctx)
+{
+	((myheap *) ctx)->bytes += size;
+	((myheap *) ctx)->blocks++;
+	return malloc(size);
+}
+
+static void heap_free(void *p, size_t size, void *ctx)
+{
+	((myheap *) ctx)->bytes -= size;
+	((myheap *) ctx)->blocks--;
+	free(p);
+}
+
+int unit_test_allocator()
+{
+	myheap heap = {0, 0};
+	avlallocator allocator = {heap_alloc, heap_free, &heap};
+	avltree *avlt, *copy;
+	avlreclaim *r;
+	mydata *data;
+	int i;
+
+	if ((avlt = avl_create_with(compare_func, destroy_func, &allocator)) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	for (i = 0; i < 1000; i++) {
+		if (tree_insert(avlt, i) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	if (AVL_BYTES(avlt) != 1000 * sizeof(avlnode) || heap.bytes != (long) (sizeof(avltree) + AVL_BYTES(avlt))) {
+		fprintf(stdout, "bytes %lu, heap %ld\n", AVL_BYTES(avlt), heap.bytes);
+		goto err;
+	}
+
+	/* room for ten more nodes */
+	avl_set_limit(avlt, AVL_BYTES(avlt) + 10 * sizeof(avlnode));
+	for (i = 1000; i < 1010; i++) {
+		if (tree_insert(avlt, i) == NULL) {
+			fprintf(stdout, "insert under the limit failed\n");
+			goto err;
+		}
+	}
+	if ((data = makedata(1010)) == NULL)
+		goto err;
+	if (avl_insert(avlt, data) != NULL || AVL_COUNT(avlt) != 1010) {
+		fprintf(stdout, "insert over the limit did not fail\n");
+		goto err; /* data is in the tree */
+	}
+	free(data);
+	if (tree_delete(avlt, 0) != 1 || tree_insert(avlt, 1010) == NULL || tree_check(avlt) != 1) {
+		fprintf(stdout, "insert after delete failed\n");
+		goto err;
+	}
+
+	/* slabs and clones come from the allocator too */
+	if (avl_compact(avlt) != 0 || AVL_BYTES(avlt) != sizeof(avlslab) + 1010 * sizeof(avlnode) || \
+		heap.bytes != (long) (sizeof(avltree) + AVL_BYTES(avlt))) {
+		fprintf(stdout, "compact bytes %lu, heap %ld\n", AVL_BYTES(avlt), heap.bytes);
+		goto err;
+	}
+	if ((copy = avl_clone(avlt, copy_func)) == NULL) {
+		fprintf(stdout, "clone failed\n");
+		goto err;
+	}
+	if (heap.bytes != (long) (2 * sizeof(avltree) + AVL_BYTES(avlt) + AVL_BYTES(copy))) {
+		fprintf(stdout, "clone heap %ld\n", heap.bytes);
+		avl_destroy(copy);
+		goto err;
+	}
+	avl_destroy(copy);
+
+	/* a failed parallel clone gives back the slab it allocated */
+	if (avl_clone_parallel(avlt, copy_fail_func, 4) != NULL || \
+		heap.bytes != (long) (sizeof(avltree) + AVL_BYTES(avlt)) || heap.blocks != 2) {
+		fprintf(stdout, "failed clone heap %ld\n", heap.bytes);
+		goto err;
+	}
+
+	r = avl_detach(avlt);
+	while (avl_reclaim(r, 100)) ;
+	if (AVL_BYTES(avlt) != 0 || heap.bytes != (long) sizeof(avltree) || heap.blocks != 1) {
+		fprintf(stdout, "reclaim heap %ld\n", heap.bytes);
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	if (heap.bytes != 0 || heap.blocks != 0) {
+		fprintf(stdout, "destroy heap %ld\n", heap.bytes);
+		goto err0;
+	}
+
+	#ifdef AVL_MULTISET
+	/* buckets come from the allocator and count against the limit */
+	if ((avlt = avl_create_with(compare_func, destroy_func, &allocator)) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+	for (i = 0; i < 100; i++) {
+		if (tree_insert(avlt, i) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	avl_set_limit(avlt, AVL_BYTES(avlt) + 4096);
+	for (i = 0; i < 100000; i++) {
+		if ((data = makedata(1)) == NULL)
+			goto err;
+		if (avl_insert(avlt, data) == NULL) {
+			free(data);
+			break;
+		}
+	}
+	if (i == 100000 || AVL_BYTES(avlt) > avlt->limit || heap.bytes != (long) (sizeof(avltree) + AVL_BYTES(avlt))) {
+		fprintf(stdout, "bucket bytes %lu, heap %ld after %d inserts\n", AVL_BYTES(avlt), heap.bytes, i);
+		goto err;
+	}
+	if ((copy = avl_clone_parallel(avlt, copy_func, 4)) == NULL || AVL_BYTES(copy) == 0 || \
+		heap.bytes != (long) (2 * sizeof(avltree) + AVL_BYTES(avlt) + AVL_BYTES(copy))) {
+		fprintf(stdout, "bucket clone heap %ld\n", heap.bytes);
+		if (copy != NULL)
+			avl_destroy(copy);
+		goto err;
+	}
+	avl_destroy(copy);
+	r = avl_detach(avlt);
+	while (avl_reclaim(r, 10)) ;
+	avl_destroy(avlt);
+	if (heap.bytes != 0 || heap.blocks != 0) {
+		fprintf(stdout, "bucket heap %ld\n", heap.bytes);
+		goto err0;
+	}
+	#endif
+
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
+int unit_test_np()
+{
+	avlnptree *t;
+	avlnpnode *node;
+	avlnpcursor c;
+	mydata *data, query;
+	char present[4096];
+	unsigned long count;
+	int i, k, prev;
+
+	if ((t = avlnp_create(compare_func, destroy_func)) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	/* random inserts and erases, checked against present */
+	memset(present, 0, sizeof(present));
+	count = 0;
+	srand(2019);
+	for (i = 0; i < 100000; i++) {
+		k = rand() % 4096;
+		query.key = k;
+		if (present[k]) {
+			if (avlnp_erase(t, &query) != 1) {
+				fprintf(stdout, "erase %d failed\n", k);
+				goto err;
+			}
+			present[k] = 0;
+			count--;
+		} else {
+			if (avlnp_erase(t, &query) != 0) {
+				fprintf(stdout, "erase of absent %d failed\n", k);
+				goto err;
+			}
+			if ((data = makedata(k)) == NULL)
+				goto err;
+			if (avlnp_insert(t, data) == NULL) {
+				fprintf(stdout, "insert %d failed\n", k);
+				free(data);
+				goto err;
+			}
+			present[k] = 1;
+			count++;
+		}
+		if (i % 10000 == 0 && avlnp_check(t) != 1) {
+			fprintf(stdout, "invalid tree after %d operations\n", i);
+			goto err;
+		}
+	}
+	if (avlnp_check(t) != 1 || AVLNP_COUNT(t) != count) {
+		fprintf(stdout, "invalid tree\n");
+		goto err;
+	}
+
+	/* a full scan and a scan from each key visit the present keys in order */
+	for (k = 0, node = avlnp_first(t, &c); node != NULL; node = avlnp_next(&c), k++) {
+		for ( ; k < 4096 && !present[k]; k++) ;
+		if (((mydata *) node->data)->key != k) {
+			fprintf(stdout, "scan found %d, expected %d\n", ((mydata *) node->data)->key, k);
+			goto err;
+		}
+	}
+	for (prev = 0, k = 4095; k >= 0; k--) {
+		query.key = k;
+		node = avlnp_seek(t, &c, &query);
+		if (present[k])
+			prev = k;
+		if ((node == NULL) != (prev < k || !present[prev]) || (node != NULL && \
+			(((mydata *) node->data)->key != prev || (avlnp_find(t, &query) != NULL) != present[k]))) {
+			fprintf(stdout, "seek %d failed\n", k);
+			goto err;
+		}
+	}
+
+	/* drain from the minimum */
+	while ((node = avlnp_first(t, &c)) != NULL) {
+		query.key = ((mydata *) node->data)->key;
+		avlnp_erase(t, &query);
+	}
+	if (AVLNP_COUNT(t) != 0 || !AVLNP_ISEMPTY(t)) {
+		fprintf(stdout, "drain failed\n");
+		goto err;
+	}
+
+	avlnp_destroy(t);
+	return 1;
+
+err:
+	avlnp_destroy(t);
+err0:
+	return 0;
+}
+
+/*
+ * return the height of n, -1 if it is not height-balanced
+ */
+static int avl_balanced(avltree *avlt, avlnode *n)
+{
+	int lh, rh;
+
+	if (n == AVL_NIL(avlt))
+		return 0;
+	if ((lh = avl_balanced(avlt, n->left)) < 0 || (rh = avl_balanced(avlt, n->right)) < 0 || \
+		lh - rh > 1 || rh - lh > 1)
+		return -1;
+	return 1 + ((lh > rh) ? lh : rh);
+}
+
+int unit_test_wavl()
+{
+	avltree *avlt, *copy;
+	mydata lo, hi, **data;
+	char present[4096];
+	avlstats stats;
+	unsigned long count;
+	int i, k;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	/* an AVL tree is ranked in place, and without deletes stays an AVL tree */
+	for (i = 0; i < 1000; i++) {
+		if (tree_insert(avlt, (i * 7919) % 4096) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	if (avl_set_engine(avlt, AVL_WAVL) != 0 || tree_check(avlt) != 1) {
+		fprintf(stdout, "set engine failed\n");
+		goto err;
+	}
+	for (i = 1000; i < 3000; i++) {
+		if (tree_insert(avlt, (i * 7919) % 4096) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	if (tree_check(avlt) != 1 || avl_balanced(avlt, AVL_FIRST(avlt)) < 0) {
+		fprintf(stdout, "insert-only weak AVL tree is not an AVL tree\n");
+		goto err;
+	}
+	if (avl_set_engine(avlt, AVL_BF) == 0) {
+		fprintf(stdout, "non-empty tree switched back\n");
+		goto err;
+	}
+
+	/* random inserts and deletes, checked against present */
+	memset(present, 0, sizeof(present));
+	for (i = 0; i < 3000; i++)
+		present[(i * 7919) % 4096] = 1;
+	srand(2019);
+	for (i = 0; i < 100000; i++) {
+		k = rand() % 4096;
+		if (present[k]) {
+			#ifdef AVL_STATS
+			unsigned long rotations = avlt->counters.delete_single_rotations + 2 * avlt->counters.delete_double_rotations;
+			#endif
+			if (tree_delete(avlt, k) != 1)
+				goto err;
+			#ifdef AVL_STATS
+			rotations = avlt->counters.delete_single_rotations + 2 * avlt->counters.delete_double_rotations - rotations;
+			if (rotations > 2) {
+				fprintf(stdout, "delete %d rotated %lu times\n", k, rotations);
+				goto err;
+			}
+			#endif
+		} else if (tree_insert(avlt, k) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+		present[k] = !present[k];
+		if (i % 10000 == 0 && tree_check(avlt) != 1) {
+			fprintf(stdout, "invalid tree after %d operations\n", i);
+			goto err;
+		}
+	}
+	for (count = 0, k = 0; k < 4096; k++) {
+		count += present[k];
+		if ((tree_find(avlt, k) != NULL) != present[k]) {
+			fprintf(stdout, "find %d failed\n", k);
+			goto err;
+		}
+	}
+	if (AVL_COUNT(avlt) != count || tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid tree\n");
+		goto err;
+	}
+
+	/* the height is reported from the ranks, within 2 log n */
+	avl_stats(avlt, &stats);
+	if (stats.height <= 0 || (1UL << stats.height) <= count || (1UL << ((stats.height - 1) / 2)) > count) {
+		fprintf(stdout, "invalid height %d for %lu nodes\n", stats.height, count);
+		goto err;
+	}
+
+	/* a range is erased node by node, a clone keeps the ranks */
+	lo.key = 1000;
+	hi.key = 3000;
+	for (k = lo.key; k < hi.key; k++)
+		count -= present[k];
+	avl_erase_range(avlt, &lo, &hi);
+	for (k = 0; k < 4096; k++) {
+		if ((tree_find(avlt, k) != NULL) != (present[k] && (k < lo.key || k >= hi.key))) {
+			fprintf(stdout, "%d erased wrongly\n", k);
+			goto err;
+		}
+	}
+	if (AVL_COUNT(avlt) != count || tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid erase range\n");
+		goto err;
+	}
+	if ((copy = avl_clone(avlt, copy_func)) == NULL) {
+		fprintf(stdout, "clone failed\n");
+		goto err;
+	}
+	if (copy->engine != AVL_WAVL || tree_check(copy) != 1) {
+		fprintf(stdout, "invalid clone\n");
+		avl_destroy(copy);
+		goto err;
+	}
+	avl_destroy(copy);
+
+	/* drain, then switch back and build in parallel with ranks */
+	avl_erase_range(avlt, NULL, NULL);
+	if (!AVL_ISEMPTY(avlt) || avl_set_engine(avlt, AVL_BF) != 0 || avl_set_engine(avlt, AVL_WAVL) != 0) {
+		fprintf(stdout, "switch empty tree failed\n");
+		goto err;
+	}
+	if ((data = (mydata **) malloc(5000 * sizeof(mydata *))) == NULL)
+		goto err;
+	for (i = 0; i < 5000; i++) {
+		if ((data[i] = makedata((i * 7919) % 5000)) == NULL) {
+			while (i-- > 0)
+				free(data[i]);
+			free(data);
+			goto err;
+		}
+	}
+	if (avl_build_parallel(avlt, (void **) data, 5000, 4) != 0) {
+		fprintf(stdout, "build failed\n");
+		for (i = 0; i < 5000; i++)
+			free(data[i]);
+		free(data);
+		goto err;
+	}
+	free(data);
+	for (k = 0; k < 5000; k += 2)
+		tree_delete(avlt, k);
+	if (AVL_COUNT(avlt) != 2500 || tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid built tree\n");
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+
+#ifdef AVL_MULTISET
+int unit_test_multiset()
+{
+	avltree *avlt;
+	avlnode *n1, *n2;
+	mydata query;
+	int i;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	/* B and D once, C a thousand times */
+	if (tree_insert(avlt, 'B') == NULL || tree_insert(avlt, 'D') == NULL || (n1 = tree_insert(avlt, 'C')) == NULL) {
+		fprintf(stdout, "init failed\n");
+		goto err;
+	}
+	for (i = 1; i < 1000; i++) {
+		if ((n2 = tree_insert(avlt, 'C')) != n1) {
+			fprintf(stdout, "insert duplicate failed\n");
+			goto err;
+		}
+	}
+
+	query.key = 'C';
+	if (AVL_COUNT(avlt) != 3 || avl_count(avlt, &query) != 1000 || tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid count\n");
+		goto err;
+	}
+
+	if (avl_erase_one(avlt, &query) != 1 || avl_count(avlt, &query) != 999) {
+		fprintf(stdout, "erase one failed\n");
+		goto err;
+	}
+
+	/* erasing the minimal one leaves C as the minimal node */
+	query.key = 'B';
+	if (avl_count(avlt, &query) != 1 || avl_erase_one(avlt, &query) != 1 || avl_count(avlt, &query) != 0 || \
+		avl_erase_one(avlt, &query) != 0) {
+		fprintf(stdout, "erase last failed\n");
+		goto err;
+	}
+
+	#ifdef AVL_MIN
+	if (AVL_MINIMAL(avlt) != n1) {
+		fprintf(stdout, "invalid min\n");
+		goto err;
+	}
+	#endif
+
+	query.key = 'C';
+	if (avl_erase_all(avlt, &query) != 999 || avl_count(avlt, &query) != 0 || AVL_COUNT(avlt) != 1 || tree_check(avlt) != 1) {
+		fprintf(stdout, "erase all failed\n");
+		goto err;
+	}
+
+	/* a node with a bucket deleted through its two-child successor */
+	if (tree_insert(avlt, 'A') == NULL || tree_insert(avlt, 'E') == NULL || tree_insert(avlt, 'E') == NULL || \
+		tree_insert(avlt, 'D') == NULL || tree_delete(avlt, 'D') != 1) {
+		fprintf(stdout, "delete failed\n");
+		goto err;
+	}
+	query.key = 'E';
+	if (avl_count(avlt, &query) != 2 || tree_check(avlt) != 1) {
+		fprintf(stdout, "bucket lost\n");
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+#endif
+
+#ifdef AVL_PREFIX
+/* coarse on purpose, so that ties fall back to the comparator */
+static unsigned long long normalize_func(const void *d)
+{
+	return (unsigned long long) ((long long) ((const mydata *) d)->key - MIN) >> 4;
+}
+
+int unit_test_prefix()
+{
+	avltree *avlt;
+	int i;
+
+	if (!(avl_prefix("ab", 2) < avl_prefix("abc", 3) && avl_prefix("abc", 3) < avl_prefix("abd", 3) && \
+		avl_prefix("b", 1) > avl_prefix("abcdefghij", 10))) {
+		fprintf(stdout, "invalid prefix order\n");
+		goto err0;
+	}
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	/* half of the nodes get their prefixes when the normalizer is set */
+	for (i = 0; i < 1000; i++) {
+		if (i == 500)
+			avl_set_normalizer(avlt, normalize_func);
+		if (tree_insert(avlt, (i * 7919) % 1000 - 500) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	if (tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid tree\n");
+		goto err;
+	}
+
+	for (i = -500; i < 500; i++) {
+		if (tree_find(avlt, i) == NULL) {
+			fprintf(stdout, "find %d failed\n", i);
+			goto err;
+		}
+	}
+	if (tree_find(avlt, 500) != NULL || tree_find(avlt, MIN) != NULL) {
+		fprintf(stdout, "find absent failed\n");
+		goto err;
+	}
+
+	/* two-child deletions move prefixes with the data */
+	for (i = -500; i < 500; i += 2) {
+		if (tree_delete(avlt, i) != 1) {
+			fprintf(stdout, "delete %d failed\n", i);
+			goto err;
+		}
+	}
+	if (tree_check(avlt) != 1 || tree_find(avlt, 499) == NULL || tree_find(avlt, 498) != NULL) {
+		fprintf(stdout, "invalid tree after delete\n");
+		goto err;
+	}
+
+	avl_set_normalizer(avlt, NULL);
+	if (tree_check(avlt) != 1 || tree_find(avlt, -499) == NULL) {
+		fprintf(stdout, "unset normalizer failed\n");
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+#endif
+
+#ifdef AVL_AUGMENT
+/* sum of keys in i[0], number of values in i[1] */
+static void sum_func(avlaux *aux, const avlaux *left, const avlnode *node, const avlaux *right)
+{
+	long long n = 1;
+
+	#ifdef AVL_MULTISET
+	n += node->bucket ? node->bucket->count : 0;
+	#endif
+	aux->i[0] = left->i[0] + n * ((mydata *) node->data)->key + right->i[0];
+	aux->i[1] = left->i[1] + n + right->i[1];
+}
+
+int unit_test_augment()
+{
+	avltree *avlt;
+	avlnode *node;
+	avlaux identity, result;
+	mydata lo, hi;
+	int present[256];
+	long long sum, count;
+	int i, j, k;
+
+	memset(&identity, 0, sizeof(identity));
+	memset(present, 0, sizeof(present));
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	/* aggregates of present nodes are computed when the function is set */
+	for (i = 0; i < 64; i++) {
+		k = (i * 37) % 256;
+		if (tree_insert(avlt, k) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+		present[k]++;
+	}
+	avl_set_augment(avlt, sum_func, &identity);
+
+	srand(2019);
+	for (i = 0; i < 5000; i++) {
+		k = rand() % 256;
+		if (present[k] && rand() % 2) {
+			if ((node = tree_find(avlt, k)) == NULL) {
+				fprintf(stdout, "find failed\n");
+				goto err;
+			}
+			avl_delete(avlt, node, 0);
+			#ifdef AVL_MULTISET
+			present[k] = 0; /* the other values go with the node */
+			#else
+			present[k]--;
+			#endif
+		} else {
+			if (tree_insert(avlt, k) == NULL) {
+				fprintf(stdout, "insert failed\n");
+				goto err;
+			}
+			#if defined(AVL_DUP) || defined(AVL_MULTISET)
+			present[k]++;
+			#else
+			present[k] = 1;
+			#endif
+		}
+
+		/* erased ranges leave joined subtrees behind */
+		if (i % 500 == 499) {
+			lo.key = rand() % 256;
+			hi.key = lo.key + rand() % 32;
+			avl_erase_range(avlt, &lo, &hi);
+			for (j = lo.key; j < hi.key && j < 256; j++)
+				present[j] = 0;
+		}
+
+		if (i % 50 != 0)
+			continue;
+
+		/* every range against a scan of present */
+		lo.key = rand() % 300 - 20;
+		hi.key = lo.key + rand() % 300;
+		sum = count = 0;
+		for (j = 0; j < 256; j++) {
+			if (j >= lo.key && j < hi.key) {
+				sum += (long long) j * present[j];
+				count += present[j];
+			}
+		}
+		avl_aggregate(avlt, &lo, &hi, &result);
+		if (result.i[0] != sum || result.i[1] != count) {
+			fprintf(stdout, "invalid aggregate over [%d, %d)\n", lo.key, hi.key);
+			goto err;
+		}
+	}
+
+	if (tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid tree\n");
+		goto err;
+	}
+
+	/* unbounded */
+	avl_aggregate(avlt, NULL, NULL, &result);
+	if (result.i[1] != AVL_FIRST(avlt)->aux.i[1]) {
+		fprintf(stdout, "invalid total\n");
+		goto err;
+	}
+	lo.key = 300;
+	avl_aggregate(avlt, &lo, NULL, &result);
+	if (result.i[0] != 0 || result.i[1] != 0) {
+		fprintf(stdout, "invalid empty range\n");
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+#endif
+
+#ifdef AVL_INTERVAL
+typedef struct {
+	avlinterval iv;
+	int id;
+} myinterval;
+
+/* by start and end, then by id so that equal intervals are distinct */
+static int interval_compare_func(const void *d1, const void *d2)
+{
+	int cmp;
+
+	if ((cmp = avl_interval_compare(d1, d2)) != 0)
+		return cmp;
+	return ((const myinterval *) d1)->id - ((const myinterval *) d2)->id;
+}
+
+/* count the intervals found, check they come by start */
+static int overlap_func(void *d, void *cookie)
+{
+	long long *state = (long long *) cookie; /* count, last start */
+
+	if (((myinterval *) d)->iv.lo < state[1])
+		return -1;
+	state[0]++;
+	state[1] = ((myinterval *) d)->iv.lo;
+	return 0;
+}
+
+int unit_test_interval()
+{
+	avltree *avlt;
+	avlnode *node;
+	myinterval *live[1000], *p;
+	long long state[2], lo, hi, count;
+	int n, i, j, id;
+
+	if ((avlt = avl_create(interval_compare_func, free)) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+	avl_set_interval(avlt);
+
+	srand(2019);
+	n = id = 0;
+	for (i = 0; i < 4000; i++) {
+		if (n == 1000 || (n > 0 && rand() % 3 == 0)) {
+			j = rand() % n;
+			if ((node = avl_find(avlt, live[j])) == NULL || node->data != live[j]) {
+				fprintf(stdout, "find failed\n");
+				goto err;
+			}
+			avl_delete(avlt, node, 0);
+			live[j] = live[--n];
+		} else {
+			if ((p = (myinterval *) malloc(sizeof(myinterval))) == NULL) {
+				fprintf(stdout, "out of memory\n");
+				goto err;
+			}
+			p->iv.lo = rand() % 10000;
+			p->iv.hi = p->iv.lo + ((rand() % 10 == 0) ? rand() % 5000 : rand() % 50);
+			p->id = id++;
+			if (avl_insert(avlt, p) == NULL) {
+				fprintf(stdout, "insert failed\n");
+				free(p);
+				goto err;
+			}
+			live[n++] = p;
+		}
+
+		if (i % 20 != 0)
+			continue;
+
+		/* stabbing on even steps, overlap otherwise, against a scan of live */
+		lo = rand() % 11000 - 500;
+		hi = (i % 40 == 0) ? lo : lo + rand() % 200;
+		for (count = 0, j = 0; j < n; j++)
+			if (live[j]->iv.lo <= hi && live[j]->iv.hi >= lo)
+				count++;
+		state[0] = 0;
+		state[1] = LLONG_MIN;
+		if ((lo == hi ? AVL_STAB(avlt, lo, overlap_func, state) : avl_overlap(avlt, lo, hi, overlap_func, state)) != 0 || \
+			state[0] != count) {
+			fprintf(stdout, "invalid overlap [%lld, %lld]: %lld, expected %lld\n", lo, hi, state[0], count);
+			goto err;
+		}
+	}
+
+	if (avl_check_height(avlt) != 1 || AVL_COUNT(avlt) != (unsigned long) n) {
+		fprintf(stdout, "invalid tree\n");
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+#endif
+
+#ifdef AVL_LAZY
+int unit_test_lazy()
+{
+	avltree *avlt;
+	avlnode *node, *handle[500];
+	mydata lo, hi;
+	int present[500];
+	int i, k, n, count;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+	avl_set_lazy(avlt, 0.25);
+
+	memset(present, 0, sizeof(present));
+	srand(2019);
+	for (i = 0; i < 20000; i++) {
+		k = rand() % 500;
+		if (!present[k]) {
+			if ((handle[k] = tree_insert(avlt, k)) == NULL) {
+				fprintf(stdout, "insert failed\n");
+				goto err;
+			}
+			present[k] = 1;
+		} else if (i % 1000 == 999) {
+			lo.key = k;
+			hi.key = k + 20;
+			avl_erase_range(avlt, &lo, &hi);
+			for ( ; k < 500 && k < hi.key; k++)
+				present[k] = 0;
+		} else {
+			if ((node = tree_find(avlt, k)) == NULL || node != handle[k]) {
+				fprintf(stdout, "find %d failed\n", k);
+				goto err;
+			}
+			avl_delete(avlt, node, 0);
+			present[k] = 0;
+			if (avlt->tombstones > avlt->lazy * avlt->count) {
+				fprintf(stdout, "not purged\n");
+				goto err;
+			}
+		}
+
+		if (i % 100 != 0)
+			continue;
+
+		/* lookups, iteration and min see only the live nodes */
+		for (n = 0, k = 0; k < 500; k++) {
+			n += present[k];
+			if ((tree_find(avlt, k) != NULL) != present[k]) {
+				fprintf(stdout, "invalid find %d\n", k);
+				goto err;
+			}
+		}
+		for (k = 0; k < 500 && !present[k]; k++) ;
+		count = 0;
+		if (AVL_COUNT(avlt) != (unsigned long) n || AVL_APPLY(avlt, count_func, &count, INORDER) != 0 || count != n || \
+			(k == 500 ? AVL_MINIMAL(avlt) != NULL : AVL_MINIMAL(avlt) != handle[k])) {
+			fprintf(stdout, "invalid tree: %d nodes, %d applied\n", n, count);
+			goto err;
+		}
+		for (count = 0, node = AVL_MINIMAL(avlt); node != NULL; node = avl_successor(avlt, node))
+			count++;
+		if (count != n || tree_check(avlt) != 1) {
+			fprintf(stdout, "invalid iteration\n");
+			goto err;
+		}
+	}
+
+	/* purge by hand, handles of live nodes stay valid */
+	avl_set_lazy(avlt, 1);
+	for (k = 0; k < 500; k += 2) {
+		if (present[k]) {
+			avl_delete(avlt, handle[k], 0);
+			present[k] = 0;
+		}
+	}
+	avl_purge(avlt);
+	for (n = 0, k = 0; k < 500; k++) {
+		n += present[k];
+		if (present[k] && tree_find(avlt, k) != handle[k]) {
+			fprintf(stdout, "handle %d lost\n", k);
+			goto err;
+		}
+	}
+	if (avlt->tombstones != 0 || AVL_COUNT(avlt) != (unsigned long) n || avlt->count != (unsigned long) n || \
+		tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid tree after purge\n");
+		goto err;
+	}
+
+	/* the minimal with a tombstone on its left, deleted eagerly or moved */
+	avl_destroy(avlt);
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+	avl_set_lazy(avlt, 0.9);
+	for (k = 2; k >= 1; k--)
+		handle[k] = tree_insert(avlt, k);
+	for (k = 3; k <= 5; k++)
+		handle[k] = tree_insert(avlt, k);
+	for (k = 1; k <= 5; k++) {
+		if (handle[k] == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	avl_delete(avlt, handle[1], 0);
+	if (AVL_MINIMAL(avlt) != handle[2] || handle[2]->left != handle[1]) {
+		fprintf(stdout, "invalid min over a tombstone\n");
+		goto err;
+	}
+	free(avl_delete(avlt, handle[2], 1));
+	if (AVL_MINIMAL(avlt) != handle[3] || tree_insert(avlt, 6) == NULL || tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid min after eager delete\n");
+		goto err;
+	}
+	((mydata *) handle[3]->data)->key = 10;
+	avl_reposition(avlt, handle[3]);
+	if (AVL_MINIMAL(avlt) != handle[4] || tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid min after reposition\n");
+		goto err;
+	}
+
+	#ifndef AVL_DUP
+	/* a node moved onto the key of a tombstone replaces it */
+	avl_destroy(avlt);
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+	avl_set_lazy(avlt, 1);
+	for (k = 1; k <= 7; k++) {
+		if ((handle[k] = tree_insert(avlt, k)) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	avl_delete(avlt, handle[4], 0);
+	((mydata *) handle[7]->data)->key = 4;
+	avl_reposition(avlt, handle[7]);
+	if (tree_find(avlt, 4) != handle[7] || tree_find(avlt, 7) != NULL || avlt->tombstones != 0 || \
+		AVL_COUNT(avlt) != 6 || tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid reposition onto a tombstone\n");
+		goto err;
+	}
+	#endif
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+#endif
+
+#ifdef AVL_CACHE
+static unsigned long long hash_func(const void *d)
+{
+	return (unsigned long long) ((mydata *) d)->key * 0x9E3779B97F4A7C15ULL;
+}
+
+int unit_test_cache()
+{
+	avltree *avlt, *copy;
+	avlnode *node;
+	avlstats stats;
+	mydata lo, hi, keys[50];
+	void *data[50];
+	avlnode *out[50];
+	unsigned long hits;
+	int i, k;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+	if (avl_set_cache(avlt, hash_func, 200) != 0 || avlt->cache_mask != 255) {
+		fprintf(stdout, "set cache failed\n");
+		goto err;
+	}
+
+	for (i = 0; i < 10000; i++) {
+		if (tree_insert(avlt, (i * 7919) % 10000) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+
+	/* skewed: 100 hot keys, every tenth lookup cold */
+	srand(2019);
+	for (i = 0; i < 100000; i++) {
+		k = (i % 10 == 0) ? rand() % 10000 : (rand() % 100) * 97;
+		if ((node = tree_find(avlt, k)) == NULL || ((mydata *) node->data)->key != k) {
+			fprintf(stdout, "find %d failed\n", k);
+			goto err;
+		}
+	}
+	avl_stats(avlt, &stats);
+	if (stats.cache_hits + stats.cache_misses != 100000 || stats.cache_hits < 80000) {
+		fprintf(stdout, "cache hits %lu, misses %lu\n", stats.cache_hits, stats.cache_misses);
+		goto err;
+	}
+
+	/* a batch fills the cache, the same batch again is answered from it */
+	hits = stats.cache_hits;
+	for (i = 0; i < 50; i++) {
+		keys[i].key = 5000 + i;
+		data[i] = &keys[i];
+	}
+	if (avl_find_batch(avlt, data, 50, out) != 50 || avl_find_batch(avlt, data, 50, out) != 50) {
+		fprintf(stdout, "find batch failed\n");
+		goto err;
+	}
+	avl_stats(avlt, &stats);
+	if (stats.cache_hits + stats.cache_misses != 100100 || stats.cache_hits - hits < 50 || \
+		out[49] == NULL || ((mydata *) out[49]->data)->key != 5049) {
+		fprintf(stdout, "batch cache hits %lu, misses %lu\n", stats.cache_hits, stats.cache_misses);
+		goto err;
+	}
+
+	/* cached nodes deleted, moved by compaction, repositioned or erased by range */
+	for (k = 0; k < 100 * 97; k += 2 * 97) {
+		if ((node = tree_find(avlt, k)) == NULL) {
+			fprintf(stdout, "find %d failed\n", k);
+			goto err;
+		}
+		avl_delete(avlt, node, 0);
+	}
+	if (avl_compact(avlt) != 0) {
+		fprintf(stdout, "compact failed\n");
+		goto err;
+	}
+	node = tree_find(avlt, 97);
+	((mydata *) node->data)->key = 10001;
+	avl_reposition(avlt, node);
+	lo.key = 100 * 97 / 2;
+	hi.key = 100 * 97;
+	avl_erase_range(avlt, &lo, &hi);
+	for (k = 0; k < 100 * 97; k += 97) {
+		node = tree_find(avlt, k);
+		if ((node != NULL) != (k % (2 * 97) != 0 && k != 97 && k < lo.key) || \
+			(node != NULL && ((mydata *) node->data)->key != k)) {
+			fprintf(stdout, "invalid cached find %d\n", k);
+			goto err;
+		}
+	}
+	if ((node = tree_find(avlt, 10001)) == NULL || tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid tree\n");
+		goto err;
+	}
+
+	/* clones start with an empty cache */
+	for (i = 1; i <= 4; i *= 4) {
+		if ((copy = avl_clone_parallel(avlt, copy_func, i)) == NULL) {
+			fprintf(stdout, "clone failed\n");
+			goto err;
+		}
+		for (node = AVL_FIRST(copy); node->left != AVL_NIL(copy); node = node->left) ;
+		for ( ; node != NULL && node->cached == 0; node = avl_successor(copy, node)) ;
+		if (node != NULL || tree_find(copy, 10001) == NULL || tree_find(copy, 97) != NULL) {
+			fprintf(stdout, "invalid cache of clone on %d threads\n", i);
+			avl_destroy(copy);
+			goto err;
+		}
+		avl_destroy(copy);
+	}
+
+	if (avl_set_cache(avlt, NULL, 0) != 0 || avlt->cache != NULL || tree_find(avlt, 1) == NULL) {
+		fprintf(stdout, "drop cache failed\n");
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+#endif
+
+#ifdef AVL_BLOOM
+static unsigned long long bloom_func(const void *d)
+{
+	unsigned long long h = (unsigned long long) ((mydata *) d)->key;
+
+	h = (h ^ (h >> 33)) * 0xFF51AFD7ED558CCDULL;
+	return h ^ (h >> 33);
+}
+
+int unit_test_bloom()
+{
+	avltree *avlt, *copy;
+	avlnode *node;
+	avlreclaim *r;
+	mydata lo, hi, keys[1000];
+	void *data[1000];
+	avlnode *out[1000];
+	int i;
+
+	if ((avlt = tree_create()) == NULL) {
+		fprintf(stdout, "create AVL tree failed\n");
+		goto err0;
+	}
+
+	/* even keys, half inserted before the filter is built from them, half after */
+	for (i = 0; i < 10000; i += 2) {
+		if (tree_insert(avlt, i) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	if (avl_set_bloom(avlt, bloom_func, 10000) != 0 || avlt->bloom_mask != 255) {
+		fprintf(stdout, "set bloom failed\n");
+		goto err;
+	}
+	for (i = 10000; i < 20000; i += 2) {
+		if (tree_insert(avlt, i) == NULL) {
+			fprintf(stdout, "insert failed\n");
+			goto err;
+		}
+	}
+	for (i = 0; i < 20000; i++) {
+		node = tree_find(avlt, i);
+		if ((node != NULL) != (i % 2 == 0) || (node != NULL && ((mydata *) node->data)->key != i)) {
+			fprintf(stdout, "find %d failed\n", i);
+			goto err;
+		}
+	}
+
+	/* deleted, repositioned and erased keys stay in the filter as stale */
+	for (i = 0; i < 1000; i += 4)
+		avl_delete(avlt, tree_find(avlt, i), 0);
+	node = tree_find(avlt, 2);
+	((mydata *) node->data)->key = 20001;
+	avl_reposition(avlt, node);
+	lo.key = 19000;
+	hi.key = 20000;
+	avl_erase_range(avlt, &lo, &hi);
+	if (avlt->bloom_stale != 250 + 1 + 500 || tree_find(avlt, 20001) == NULL || tree_find(avlt, 2) != NULL || \
+		tree_find(avlt, 4) != NULL || tree_find(avlt, 19000) != NULL || tree_find(avlt, 6) == NULL || \
+		tree_check(avlt) != 1) {
+		fprintf(stdout, "invalid filtered tree\n");
+		goto err;
+	}
+
+	/* a batch skips the keys ruled out by the filter */
+	for (i = 0; i < 1000; i++) {
+		keys[i].key = i;
+		data[i] = &keys[i];
+	}
+	if (avl_find_batch(avlt, data, 1000, out) != 500 - 250 - 1) {
+		fprintf(stdout, "find batch failed\n");
+		goto err;
+	}
+	for (i = 0; i < 1000; i++) {
+		if ((out[i] != NULL) != (i % 4 == 2 && i != 2) || (out[i] != NULL && ((mydata *) out[i]->data)->key != i)) {
+			fprintf(stdout, "find batch %d failed\n", i);
+			goto err;
+		}
+	}
+
+	/* a clone, serial or parallel, rebuilds the filter at its size, a rebuild drops the stale keys */
+	for (i = 1; i <= 4; i *= 4) {
+		if ((copy = avl_clone_parallel(avlt, copy_func, i)) == NULL) {
+			fprintf(stdout, "clone failed\n");
+			goto err;
+		}
+		if (copy->bloom == NULL || copy->bloom_stale != 0 || copy->bloom_mask != avlt->bloom_mask || \
+			tree_find(copy, 20001) == NULL || tree_find(copy, 4) != NULL) {
+			fprintf(stdout, "invalid clone on %d threads\n", i);
+			avl_destroy(copy);
+			goto err;
+		}
+		avl_destroy(copy);
+	}
+	if (avl_set_bloom(avlt, bloom_func, 0) != 0 || avlt->bloom_stale != 0 || avlt->bloom_mask != 255) {
+		fprintf(stdout, "rebuild bloom failed\n");
+		goto err;
+	}
+	for (i = 0; i < 20002; i++) {
+		node = tree_find(avlt, i);
+		if ((node != NULL) != (i % 2 == 0 ? (i >= 1000 || i % 4 != 0) && i != 2 && i < 19000 : i == 20001)) {
+			fprintf(stdout, "find %d after rebuild failed\n", i);
+			goto err;
+		}
+	}
+
+	/* a detached tree leaves an empty filter */
+	r = avl_detach(avlt);
+	while (avl_reclaim(r, 1000)) ;
+	if (tree_find(avlt, 6) != NULL || tree_insert(avlt, 6) == NULL || tree_find(avlt, 6) == NULL) {
+		fprintf(stdout, "filter after detach failed\n");
+		goto err;
+	}
+
+	if (avl_set_bloom(avlt, NULL, 0) != 0 || avlt->bloom != NULL || tree_find(avlt, 6) == NULL) {
+		fprintf(stdout, "drop bloom failed\n");
+		goto err;
+	}
+
+	avl_destroy(avlt);
+	return 1;
+
+err:
+	avl_destroy(avlt);
+err0:
+	return 0;
+}
+#endif
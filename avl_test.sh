@@ -1,3 +1,3 @@
 #!/bin/bash
 
-gcc avl_bf.c avl_data.c avl_test.c && time ./a.out
+gcc -pthread avl_bf.c avl_data.c avl_hist.c avl_frozen.c avl_parallel.c avl_timer.c avl_small.c avl_np.c avl_test.c && time ./a.out
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include "avl_timer.h"
+
+static int compare(const void *d1, const void *d2);
+static void unschedule(void *d);
+static void expire(void *d, void *cookie);
+static void relocate(void *d, avlnode *node);
+static int unlist(avltimers *t, avltimer *timer);
+
+/*
+ * construction
+ * return NULL if out of memory
+ */
+avltimers *avl_timers_create(void)
+{
+	avltimers *t;
+
+	if ((t = (avltimers *) malloc(sizeof(avltimers))) == NULL)
+		return NULL; /* out of memory */
+
+	if ((t->avlt = avl_create(compare, unschedule)) == NULL) {
+		free(t);
+		return NULL; /* out of memory */
+	}
+
+	avl_set_relocate(t->avlt, relocate); /* the tree may be compacted */
+
+	t->seq = 0;
+	t->expired = NULL;
+	t->tail = &t->expired;
+
+	return t;
+}
+
+/*
+ * destruction, the timers are left unscheduled
+ */
+void avl_timers_destroy(avltimers *t)
+{
+	avl_destroy(t->avlt);
+	free(t);
+}
+
+/*
+ * schedule timer for item at deadline, or move it there if it is scheduled
+ * return non-zero if out of memory
+ */
+int avl_timer_schedule(avltimers *t, avltimer *timer, void *item, long long deadline)
+{
+	timer->item = item;
+
+	return avl_timer_reschedule(t, timer, deadline);
+}
+
+/*
+ * move timer to deadline, in O(log n) without freeing or allocating if it is scheduled;
+ * a timer expired but not fired yet is scheduled again instead
+ * return non-zero if out of memory
+ */
+int avl_timer_reschedule(avltimers *t, avltimer *timer, long long deadline)
+{
+	timer->deadline = deadline;
+	timer->seq = t->seq++; /* after the timers already at deadline */
+
+	if (timer->node != NULL) {
+		avl_reposition(t->avlt, timer->node);
+		return 0;
+	}
+
+	if (timer->pprev != NULL)
+		unlist(t, timer);
+	if ((timer->node = avl_insert(t->avlt, timer)) == NULL)
+		return -1; /* out of memory */
+
+	return 0;
+}
+
+/*
+ * cancel timer, scheduled or expired but not fired yet
+ * return 1 if cancelled, 0 if not scheduled
+ */
+int avl_timer_cancel(avltimers *t, avltimer *timer)
+{
+	if (timer->node != NULL) {
+		avl_delete(t->avlt, timer->node, 1);
+		timer->node = NULL;
+		return 1;
+	}
+
+	return unlist(t, timer);
+}
+
+/*
+ * timer with the earliest deadline
+ * return NULL if none is scheduled
+ */
+avltimer *avl_timer_first(avltimers *t)
+{
+	avlnode *p;
+
+	#ifdef AVL_MIN
+	p = AVL_MINIMAL(t->avlt);
+	#else
+	for (p = AVL_FIRST(t->avlt); p != AVL_NIL(t->avlt) && p->left != AVL_NIL(t->avlt); p = p->left) ;
+	if (p == AVL_NIL(t->avlt))
+		p = NULL;
+	#endif
+
+	return (p != NULL) ? (avltimer *) p->data : NULL;
+}
+
+/*
+ * fire the timers with deadline <= now by deadline, func may schedule, reschedule or cancel
+ * any timer, the one fired included; the expired timers are split off the tree at once
+ * return the number of timers fired
+ */
+unsigned long avl_timer_advance(avltimers *t, long long now, void (*func)(avltimer *, void *), void *cookie)
+{
+	avltimer bound, *timer;
+	unsigned long count;
+
+	if ((timer = avl_timer_first(t)) == NULL || timer->deadline > now)
+		return 0; /* none expired */
+
+	bound.deadline = now;
+	bound.seq = ULLONG_MAX; /* after all timers at now */
+	avl_take_range(t->avlt, NULL, &bound, expire, t);
+
+	for (count = 0; (timer = t->expired) != NULL; count++) {
+		if ((t->expired = timer->next) == NULL)
+			t->tail = &t->expired;
+		else
+			t->expired->pprev = &t->expired;
+		timer->next = NULL;
+		timer->pprev = NULL;
+		func(timer, cookie);
+	}
+
+	return count;
+}
+
+/*
+ * order by deadline, then by scheduling
+ */
+int compare(const void *d1, const void *d2)
+{
+	const avltimer *p1 = (const avltimer *) d1;
+	const avltimer *p2 = (const avltimer *) d2;
+
+	if (p1->deadline != p2->deadline)
+		return (p1->deadline < p2->deadline) ? -1 : 1;
+	if (p1->seq != p2->seq)
+		return (p1->seq < p2->seq) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * the tree does not own the timers
+ */
+void unschedule(void *d)
+{
+	((avltimer *) d)->node = NULL;
+}
+
+/*
+ * follow a node moved by compaction
+ */
+void relocate(void *d, avlnode *node)
+{
+	((avltimer *) d)->node = node;
+}
+
+/*
+ * append a timer split off the tree to the expired list
+ */
+void expire(void *d, void *cookie)
+{
+	avltimers *t = (avltimers *) cookie;
+	avltimer *timer = (avltimer *) d;
+
+	timer->node = NULL;
+	timer->next = NULL;
+	timer->pprev = t->tail;
+	*t->tail = timer;
+	t->tail = &timer->next;
+}
+
+/*
+ * remove timer from the expired list in O(1)
+ * return 1 if listed, 0 if not
+ */
+int unlist(avltimers *t, avltimer *timer)
+{
+	if (timer->pprev == NULL)
+		return 0; /* not listed */
+
+	if ((*timer->pprev = timer->next) != NULL)
+		timer->next->pprev = timer->pprev;
+	else
+		t->tail = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+
+	return 1;
+}
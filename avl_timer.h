@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2019 xieqing. https://github.com/xieqing
+ * May be freely redistributed, but copyright notice must be retained.
+ */
+
+#ifndef _AVL_TIMER_HEADER
+#define _AVL_TIMER_HEADER
+
+#include "avl_bf.h"
+
+/*
+ * expiry map: timers ordered by deadline in an AVL tree
+ *
+ * timers are owned by the caller, typically embedded in the object they time out, and the
+ * tree only references them. a timer is moved to a new deadline without freeing or allocating,
+ * and avl_timer_advance splits all expired timers off the left of the tree at once, in
+ * O(k + log n) for k timers, and does nothing but look at the minimal if none expired.
+ * timers with equal deadlines expire in the order they were scheduled.
+ * the tree may be compacted with avl_compact or avl_compact_step, the timers follow their nodes.
+ */
+
+typedef struct avltimer {
+	long long deadline;
+	unsigned long long seq; /* orders equal deadlines by scheduling */
+	void *item;
+	avlnode *node; /* NULL if not scheduled */
+	struct avltimer *next; /* in the list of expired timers not fired yet */
+	struct avltimer **pprev; /* NULL if not in the list */
+} avltimer;
+
+typedef struct {
+	avltree *avlt;
+	unsigned long long seq;
+	avltimer *expired; /* being fired by avl_timer_advance */
+	avltimer **tail;
+} avltimers;
+
+/* a timer must be initialized before it is first scheduled */
+#define AVL_TIMER_INIT(timer) ((timer)->node = NULL, (timer)->next = NULL, (timer)->pprev = NULL)
+#define AVL_TIMERS_COUNT(t) AVL_COUNT((t)->avlt)
+
+avltimers *avl_timers_create(void);
+void avl_timers_destroy(avltimers *t);
+
+int avl_timer_schedule(avltimers *t, avltimer *timer, void *item, long long deadline);
+int avl_timer_reschedule(avltimers *t, avltimer *timer, long long deadline);
+int avl_timer_cancel(avltimers *t, avltimer *timer);
+avltimer *avl_timer_first(avltimers *t);
+unsigned long avl_timer_advance(avltimers *t, long long now, void (*func)(avltimer *, void *), void *cookie);
+
+#endif /* _AVL_TIMER_HEADER */